@@ -6,9 +6,392 @@
 #define FITS_HANDLER_H_
 
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <longnam.h>
 #include <fitsio.h>
 
+/*!
+ * @brief 由大端字节序存储的数据取得本机字节序的值
+ */
+template <class T>
+inline T fits_from_be(const unsigned char* ptr) {
+	T val;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	unsigned char buff[sizeof(T)];
+	for (size_t i = 0; i < sizeof(T); ++i) buff[i] = ptr[sizeof(T) - 1 - i];
+	memcpy(&val, buff, sizeof(T));
+#else
+	memcpy(&val, ptr, sizeof(T));
+#endif
+	return val;
+}
+
+/*!
+ * @brief 本机类型对应的二进制表TFORM数据类型代码
+ * - 无符号整数按FITS约定以有符号类型加TZERO存储, 类型代码与同宽度的有符号类型相同
+ * - 未列出的类型代码为0, 不匹配任何列
+ */
+template <class T> struct fits_tform_type { enum { code = 0 }; };
+template <> struct fits_tform_type<unsigned char>  { enum { code = TBYTE }; };
+template <> struct fits_tform_type<signed char>    { enum { code = TBYTE }; };
+template <> struct fits_tform_type<short>          { enum { code = TSHORT }; };
+template <> struct fits_tform_type<unsigned short> { enum { code = TSHORT }; };
+template <> struct fits_tform_type<int>            { enum { code = TLONG }; };
+template <> struct fits_tform_type<unsigned int>   { enum { code = TLONG }; };
+template <> struct fits_tform_type<long long>      { enum { code = TLONGLONG }; };
+template <> struct fits_tform_type<unsigned long long> { enum { code = TLONGLONG }; };
+template <> struct fits_tform_type<float>          { enum { code = TFLOAT }; };
+template <> struct fits_tform_type<double>         { enum { code = TDOUBLE }; };
+
+/*!
+ * @struct fits_column 二进制表中一列的布局
+ */
+typedef struct {
+	char name[72];		//< TTYPEn
+	int typecode;		//< 数据类型, cfitsio类型代码. 负数为变长数组描述符
+	LONGLONG repeat;	//< 每行元素数
+	long width;			//< 单个元素字节数
+	long offset;		//< 在行内的字节偏移
+	long bytes;			//< 在行内占用的字节数
+	double tscale;		//< TSCALn, 缺省1
+	double tzero;		//< TZEROn, 缺省0
+} fits_column;
+
+/*!
+ * @struct fits_table_geometry 二进制表数据区布局
+ */
+struct fits_table_geometry {
+	LONGLONG datastart;	//< 数据区在文件中的起始位置
+	LONGLONG dataend;	//< 数据区结束位置(含填充)
+	LONGLONG nrows;		//< 行数, NAXIS2
+	long rowlen;		//< 行长, NAXIS1
+	std::vector<fits_column> cols;	//< 各列布局, 列号1对应cols[0]
+};
+
+/*!
+ * @struct FITSColumnView 映射到内存的只读列视图
+ * - 数据按FITS约定以大端字节序存储, 访问时转换为本机字节序
+ * - 返回存储值, 不应用TSCAL/TZERO
+ */
+template <class T>
+struct FITSColumnView {
+	const unsigned char* base;	//< 第0行该列的地址
+	long stride;	//< 行长
+	LONGLONG nrows;	//< 行数
+
+public:
+	FITSColumnView() {
+		base   = NULL;
+		stride = 0;
+		nrows  = 0;
+	}
+
+	bool valid() const {
+		return base != NULL;
+	}
+
+	LONGLONG size() const {
+		return nrows;
+	}
+
+	T operator[](LONGLONG row) const {
+		return fits_from_be<T>(base + row * stride);
+	}
+
+	/*!
+	 * @brief 将[first, first + n)行复制到out, 转换为本机字节序
+	 */
+	void Copy(LONGLONG first, LONGLONG n, T* out) const {
+		const unsigned char* ptr = base + first * stride;
+		for (LONGLONG i = 0; i < n; ++i, ptr += stride) out[i] = fits_from_be<T>(ptr);
+	}
+};
+
+/*!
+ * @struct FITSTableMap 以mmap方式只读映射的二进制表数据区
+ * 由FITSHandler::MapTable()建立. 映射与FITS文件句柄相互独立, 关闭文件后仍可访问
+ * 也可由Adopt()接管内存中的数据区, 以相同方式访问
+ */
+struct FITSTableMap {
+	fits_table_geometry geom;	//< 数据区布局
+	const unsigned char* data;	//< 第0行地址
+
+protected:
+	void* addr;		//< 映射起始地址, 按页对齐
+	size_t length;	//< 映射长度
+	std::vector<unsigned char> owned;	//< 由Adopt()接管的数据区
+
+	/*!
+	 * @brief 空表数据区的地址. 0行的表不建立映射, 列视图指向此处, 仍为有效视图
+	 */
+	static const unsigned char* EmptyData() {
+		static const unsigned char sentinel[8] = {0};
+		return sentinel;
+	}
+
+public:
+	FITSTableMap() {
+		data   = NULL;
+		addr   = NULL;
+		length = 0;
+	}
+
+	virtual ~FITSTableMap() {
+		Unmap();
+	}
+
+	/*!
+	 * @brief 映射文件中[offset, offset + len)字节
+	 */
+	bool Map(const char* filepath, LONGLONG offset, LONGLONG len) {
+		Unmap();
+
+		int fd;
+		long pagesize = sysconf(_SC_PAGESIZE);
+		LONGLONG page = offset & ~LONGLONG(pagesize - 1);
+
+		if (len < 0 || (fd = open(filepath, O_RDONLY)) < 0) return false;
+		if (len == 0) {// 空表: 无数据可映射
+			close(fd);
+			data = EmptyData();
+			return true;
+		}
+		length = size_t(offset - page + len);
+		addr   = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, off_t(page));
+		close(fd);
+		if (addr == MAP_FAILED) {
+			addr   = NULL;
+			length = 0;
+			return false;
+		}
+		data = (const unsigned char*) addr + (offset - page);
+		return true;
+	}
+
+	/*!
+	 * @brief 接管已读入内存的数据区, 用于无法直接映射的表, 如分块压缩表解压后的数据
+	 * @param buff 数据区, 被交换为空
+	 */
+	void Adopt(std::vector<unsigned char>& buff) {
+		Unmap();
+		owned.swap(buff);
+		data = owned.empty() ? EmptyData() : &owned[0];
+	}
+
+	void Unmap() {
+		if (addr) munmap(addr, length);
+		addr   = NULL;
+		length = 0;
+		data   = NULL;
+		std::vector<unsigned char>().swap(owned);
+	}
+
+	/*!
+	 * @brief 提示内核将按顺序读取数据区
+	 */
+	void AdviseSequential() {
+		if (addr) madvise(addr, length, MADV_SEQUENTIAL);
+	}
+
+	/*!
+	 * @brief 取得列视图
+	 * @param colnum 列号, [1, 列数]
+	 * @return
+	 * 列号无效, 或TFORM类型、元素宽度与T不符时返回无效视图
+	 */
+	template <class T>
+	FITSColumnView<T> Column(int colnum) const {
+		FITSColumnView<T> view;
+		if (data && colnum >= 1 && colnum <= int(geom.cols.size())
+				&& geom.cols[colnum - 1].typecode == int(fits_tform_type<T>::code)
+				&& geom.cols[colnum - 1].width == long(sizeof(T))) {
+			view.base   = data + geom.cols[colnum - 1].offset;
+			view.stride = geom.rowlen;
+			view.nrows  = geom.nrows;
+		}
+		return view;
+	}
+
+	/*!
+	 * @brief 由列名查找列号
+	 * @return
+	 * 列号. 未找到时返回0
+	 */
+	int ColumnIndex(const char* name) const {
+		for (size_t i = 0; i < geom.cols.size(); ++i) {
+			if (!strcasecmp(geom.cols[i].name, name)) return int(i + 1);
+		}
+		return 0;
+	}
+};
+
+#define FITS_ASYNC_INFLIGHT	8388608	//< 异步写入时排队数据量上限, 字节
+#define FITS_ASYNC_SPARE	4		//< 异步写入时保留以复用的缓冲区数量
+
+enum {
+	FITS_JOB_TBLBYTES,	//< fits_write_tblbytes
+	FITS_JOB_COLUMN		//< fits_write_col
+};
+
+/*!
+ * @struct fits_write_job 异步写入任务, 持有待写入数据
+ */
+struct fits_write_job {
+	int kind;			//< 任务类型, FITS_JOB_*
+	int datatype;		//< fits_write_col: 数据类型
+	int colnum;			//< fits_write_col: 列号
+	LONGLONG firstrow;	//< 起始行, 自1开始
+	LONGLONG firstelem;	//< fits_write_tblbytes: 行内起始字节; fits_write_col: 起始元素. 自1开始
+	LONGLONG nelem;		//< fits_write_col: 元素数量
+	std::vector<unsigned char> buff;	//< 数据. fits_write_tblbytes写入全部字节
+};
+
+/*!
+ * @struct fits_async_writer 后台写入线程
+ * - 调用线程提交任务后即返回, 由写入线程按提交顺序执行cfitsio写操作
+ * - 排队数据量超过上限时提交阻塞, 限制内存占用
+ * - 出错后丢弃后续任务, 错误代码由Wait()/Stop()返回
+ */
+struct fits_async_writer {
+protected:
+	fitsfile* fitsptr;	//< 文件访问接口. 运行期间仅由写入线程使用
+	size_t maxbytes;	//< 排队数据量上限
+	size_t inflight;	//< 已提交未写完的数据量
+	int pending;		//< 已提交未写完的任务数
+	int errcode;		//< 首个写入错误
+	bool stop;			//< 通知写入线程退出
+	std::deque<fits_write_job*> jobs;	//< 待写入任务
+	std::vector<fits_write_job*> spare;	//< 已完成任务, 复用其缓冲区
+	std::mutex mtx;
+	std::condition_variable cv_job;		//< 通知: 有新任务或需退出
+	std::condition_variable cv_done;	//< 通知: 有任务完成
+	std::thread thrd;
+
+protected:
+	void run() {
+		std::unique_lock<std::mutex> lck(mtx);
+		fits_write_job* job;
+		int status;
+
+		while (true) {
+			while (!stop && jobs.empty()) cv_job.wait(lck);
+			if (jobs.empty()) break;
+			job = jobs.front();
+			jobs.pop_front();
+			status = errcode;
+			lck.unlock();
+			if (!status) {
+				if (job->kind == FITS_JOB_TBLBYTES) {
+					fits_write_tblbytes(fitsptr, job->firstrow, job->firstelem, LONGLONG(job->buff.size()),
+							job->buff.empty() ? NULL : &job->buff[0], &status);
+				}
+				else {
+					fits_write_col(fitsptr, job->datatype, job->colnum, job->firstrow, job->firstelem, job->nelem,
+							job->buff.empty() ? NULL : &job->buff[0], &status);
+				}
+			}
+			lck.lock();
+			if (status && !errcode) errcode = status;
+			inflight -= job->buff.size();
+			--pending;
+			recycle(job);
+			cv_done.notify_all();
+		}
+	}
+
+	void recycle(fits_write_job* job) {
+		if (spare.size() < FITS_ASYNC_SPARE) spare.push_back(job);
+		else delete job;
+	}
+
+public:
+	fits_async_writer(fitsfile* fptr, size_t bytes) {
+		fitsptr  = fptr;
+		maxbytes = bytes;
+		inflight = 0;
+		pending  = 0;
+		errcode  = 0;
+		stop     = false;
+		thrd     = std::thread(&fits_async_writer::run, this);
+	}
+
+	virtual ~fits_async_writer() {
+		Stop();
+		for (size_t i = 0; i < spare.size(); ++i) delete spare[i];
+	}
+
+	/*!
+	 * @brief 取得空闲任务. 其缓冲区保留上次使用时的内容和容量
+	 */
+	fits_write_job* Acquire() {
+		std::lock_guard<std::mutex> lck(mtx);
+		fits_write_job* job;
+
+		if (spare.empty()) job = new fits_write_job;
+		else {
+			job = spare.back();
+			spare.pop_back();
+		}
+		return job;
+	}
+
+	/*!
+	 * @brief 提交任务, 由写入线程接管
+	 * @return
+	 * 此前写入已出错时丢弃任务并返回false
+	 */
+	bool Submit(fits_write_job* job) {
+		std::unique_lock<std::mutex> lck(mtx);
+		size_t bytes = job->buff.size();
+
+		while (!errcode && inflight && inflight + bytes > maxbytes) cv_done.wait(lck);
+		if (errcode || stop) {
+			recycle(job);
+			return false;
+		}
+		jobs.push_back(job);
+		inflight += bytes;
+		++pending;
+		cv_job.notify_one();
+		return true;
+	}
+
+	/*!
+	 * @brief 等待已提交任务全部完成
+	 * @return
+	 * 首个写入错误代码. 0表示无错误
+	 */
+	int Wait() {
+		std::unique_lock<std::mutex> lck(mtx);
+		while (pending) cv_done.wait(lck);
+		return errcode;
+	}
+
+	/*!
+	 * @brief 写完已提交任务后结束写入线程
+	 */
+	int Stop() {
+		if (thrd.joinable()) {
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				stop = true;
+				cv_job.notify_one();
+			}
+			thrd.join();
+		}
+		return errcode;
+	}
+};
+
 struct FITSHandler {
 	fitsfile *fitsptr;	//< 基于cfitsio接口的文件操作接口
 	int errcode;		//< 错误代码
@@ -17,6 +400,7 @@ struct FITSHandler {
 protected:
 	int hdunum;		//< HDU数量
 	int *hdutype;	//< HDU类型
+	fits_async_writer* async;	//< 后台写入线程. NULL表示同步写入
 
 protected:
 	void update_hdunum(int n) {
@@ -36,6 +420,7 @@ public:
 		errcode = 0;
 		hdunum  = 0;
 		hdutype = NULL;
+		async   = NULL;
 	}
 
 	virtual ~FITSHandler() {
@@ -43,13 +428,104 @@ public:
 		if (hdutype) free(hdutype);
 	}
 
+	/*!
+	 * @brief 关闭文件
+	 * @return
+	 * 关闭失败, 或异步写入过程中出错时返回false. 后者的错误代码保留在errcode中
+	 */
 	bool Close() {
+		int errasync = AsyncEnd();
+
 		errcode = 0;
 		if (fitsptr)  fits_close_file(fitsptr, &errcode);
-		if (!errcode) fitsptr = NULL;
+		if (!errcode) {
+			fitsptr = NULL;
+			errcode = errasync;
+		}
+		return !errcode;
+	}
+
+	/*!
+	 * @brief 启用异步写入: 由后台线程执行WriteTblBytes()/WriteCol()提交的写操作
+	 * @param maxbytes 排队数据量上限, 字节. 超出时提交阻塞
+	 * @note
+	 * 启用期间不应直接以fitsptr访问文件. 需要同步操作时先调用AsyncWait()
+	 */
+	bool AsyncBegin(size_t maxbytes = FITS_ASYNC_INFLIGHT) {
+		if (!fitsptr || errcode) return false;
+		if (!async) async = new fits_async_writer(fitsptr, maxbytes);
+		return true;
+	}
+
+	/*!
+	 * @brief 等待已提交的异步写操作完成
+	 * @return
+	 * 写入过程无错误时返回true. 否则错误代码存入errcode
+	 */
+	bool AsyncWait() {
+		if (async && !errcode) errcode = async->Wait();
 		return !errcode;
 	}
 
+	/*!
+	 * @brief 结束异步写入, 恢复同步写入
+	 * @return
+	 * 异步写入过程中的首个错误代码
+	 */
+	int AsyncEnd() {
+		int err(0);
+		if (async) {
+			err = async->Stop();
+			delete async;
+			async = NULL;
+		}
+		return err;
+	}
+
+	/*!
+	 * @brief 从firstrow行第firstchar字节起写入buff中的全部字节
+	 * @param buff 数据. 异步写入时被接管, 换回此前已写完的缓冲区, 其内容和长度不确定
+	 * @return
+	 * 同步写入结果; 或异步写入已出错时返回false
+	 */
+	bool WriteTblBytes(LONGLONG firstrow, LONGLONG firstchar, std::vector<unsigned char>& buff) {
+		if (!fitsptr || errcode) return false;
+		if (!async) {
+			fits_write_tblbytes(fitsptr, firstrow, firstchar, LONGLONG(buff.size()),
+					buff.empty() ? NULL : &buff[0], &errcode);
+			return !errcode;
+		}
+		fits_write_job* job = async->Acquire();
+		job->kind      = FITS_JOB_TBLBYTES;
+		job->firstrow  = firstrow;
+		job->firstelem = firstchar;
+		job->buff.swap(buff);
+		return async->Submit(job);
+	}
+
+	/*!
+	 * @brief 从firstrow行第firstelem个元素起向colnum列写入nelem个datatype类型的元素
+	 * @param buff 数据, 本机字节序. 异步写入时被接管, 同WriteTblBytes()
+	 */
+	bool WriteCol(int datatype, int colnum, LONGLONG firstrow, LONGLONG firstelem, LONGLONG nelem,
+			std::vector<unsigned char>& buff) {
+		if (!fitsptr || errcode) return false;
+		if (!async) {
+			fits_write_col(fitsptr, datatype, colnum, firstrow, firstelem, nelem,
+					buff.empty() ? NULL : &buff[0], &errcode);
+			return !errcode;
+		}
+		fits_write_job* job = async->Acquire();
+		job->kind      = FITS_JOB_COLUMN;
+		job->datatype  = datatype;
+		job->colnum    = colnum;
+		job->firstrow  = firstrow;
+		job->firstelem = firstelem;
+		job->nelem     = nelem;
+		job->buff.swap(buff);
+		return async->Submit(job);
+	}
+
 	int* Status() {
 		return &errcode;
 	}
@@ -119,6 +595,77 @@ public:
 		if (!errcode) fits_get_hdrspace(fitsptr, &n0, &n1, &errcode);
 		return (errcode ? 0 : n0);
 	}
+
+	/*!
+	 * @brief 查询当前HDU的二进制表数据区布局
+	 * @return
+	 * 当前HDU不是二进制表, 或为压缩表时返回false
+	 */
+	bool TableGeometry(fits_table_geometry& geom) {
+		char keyname[FLEN_KEYWORD], tform[FLEN_VALUE];
+		LONGLONG headstart;
+		long offset(0);
+		int type, ncol, i, zflag(0);
+
+		geom.cols.clear();
+		if (!fitsptr || errcode) return false;
+		fits_get_hdu_type(fitsptr, &type, &errcode);
+		if (errcode || type != BINARY_TBL) return false;
+		fits_read_key(fitsptr, TLOGICAL, "ZTABLE", &zflag, NULL, &errcode);
+		if (errcode == KEY_NO_EXIST) errcode = 0;
+		if (errcode || zflag) return false;
+
+		fits_get_hduaddrll(fitsptr, &headstart, &geom.datastart, &geom.dataend, &errcode);
+		fits_get_num_rowsll(fitsptr, &geom.nrows, &errcode);
+		fits_read_key_lng(fitsptr, "NAXIS1", &geom.rowlen, NULL, &errcode);
+		fits_get_num_cols(fitsptr, &ncol, &errcode);
+		for (i = 1; !errcode && i <= ncol; ++i) {
+			fits_column col;
+
+			memset(&col, 0, sizeof(col));
+			fits_make_keyn("TFORM", i, keyname, &errcode);
+			fits_read_key_str(fitsptr, keyname, tform, NULL, &errcode);
+			fits_binary_tformll(tform, &col.typecode, &col.repeat, &col.width, &errcode);
+			if (errcode) break;
+			if (col.typecode == TBIT) col.bytes = long((col.repeat + 7) / 8);
+			else if (col.typecode == TSTRING) col.bytes = long(col.repeat);
+			else if (col.typecode < 0) col.bytes = strchr(tform, 'Q') ? 16 : 8;
+			else col.bytes = long(col.repeat) * col.width;
+			col.offset = offset;
+			offset += col.bytes;
+
+			fits_make_keyn("TTYPE", i, keyname, &errcode);
+			fits_read_key_str(fitsptr, keyname, col.name, NULL, &errcode);
+			if (errcode == KEY_NO_EXIST) errcode = 0;
+			col.tscale = 1.0;
+			fits_make_keyn("TSCAL", i, keyname, &errcode);
+			fits_read_key_dbl(fitsptr, keyname, &col.tscale, NULL, &errcode);
+			if (errcode == KEY_NO_EXIST) errcode = 0;
+			fits_make_keyn("TZERO", i, keyname, &errcode);
+			fits_read_key_dbl(fitsptr, keyname, &col.tzero, NULL, &errcode);
+			if (errcode == KEY_NO_EXIST) errcode = 0;
+			geom.cols.push_back(col);
+		}
+		if (!errcode && offset != geom.rowlen) errcode = BAD_ROW_WIDTH;
+		return !errcode;
+	}
+
+	/*!
+	 * @brief 以mmap方式只读映射当前HDU的二进制表数据区
+	 * @note
+	 * - 映射前刷新缓冲区, 已写入的数据对映射可见
+	 * - 压缩表、内存文件等无法直接映射时返回false, 由调用者改用cfitsio读取
+	 */
+	bool MapTable(FITSTableMap& map) {
+		char filepath[FLEN_FILENAME];
+
+		map.Unmap();
+		if (!TableGeometry(map.geom)) return false;
+		fits_flush_file(fitsptr, &errcode);
+		fits_file_name(fitsptr, filepath, &errcode);
+		if (errcode) return false;
+		return map.Map(filepath, map.geom.datastart, map.geom.nrows * map.geom.rowlen);
+	}
 };
 typedef FITSHandler* HFITS;
 
@@ -0,0 +1,161 @@
+/**
+ * @file astbench_build.cpp 索引构建流程的运行检验与性能评估
+ * @note
+ * - 在工作目录下生成模拟UCAC4天区(已存在的天区文件直接复用), 调用build_ucac4_fits()导入
+ * - 以导入的中间星表调用build_index(): 均匀化, 载入占用位图, 构建并量化星表K-D树
+ * - 统计各阶段耗时. 任一阶段失败时返回非0
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "build_index.h"
+#include "occupancy.h"
+#include "ucac4api.h"
+#include "ucac4synth.h"
+
+using namespace std;
+
+void print_help(const char* progname) {
+	printf ("\nUsage: %s\n\n"
+			"    -h                   print help\n"
+			"    -d <dir>             working directory for synthetic zones and outputs\n"
+			"                       (default: a temporary directory removed on exit)\n"
+			"    -s <scale>           number of records relative to UCAC4 (default: 0.01)\n"
+			"    -N <nside>           healpix Nside for quad-building (default: 128)\n"
+			"    -U <nside>           healpix Nside for uniformization (default: same as -N)\n"
+			"    -n <sweeps>          number of stars per fine healpix grid cell (default: 10)\n"
+			"    -j <jitter>          positional error of stars in arcsec (default: 1)\n"
+			"    -E                   scan occupied healpixes while ingesting and load them while building\n"
+			"    [-t, --threads <n>]  number of threads (default: 1)\n"
+			"    [--seed <n>]         random seed of the synthetic catalog (default: 1)\n"
+			"    [--mem-limit <size>] memory budget for uniformization, K/M/G suffix allowed\n"
+			"\n",
+			progname);
+}
+
+static double bench_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief 删除工作目录中生成的文件
+ */
+static void remove_workdir(const char* dir, const index_param& param) {
+	char filepath[PATH_MAX];
+
+	for (int zone = 1; zone <= UCAC4_NZONE; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+		unlink(filepath);
+	}
+	snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+	rmdir(filepath);
+	if (param.scanoccupied && occupancy_path(param.pathcat, param.Nside, filepath)) unlink(filepath);
+	unlink(param.pathcat);
+	if (rmdir(dir)) printf ("working directory [%s] is kept\n", dir);
+}
+
+int main(int argc, char **argv) {
+	index_param param;
+	index_t* index(NULL);
+	char tmpdir[] = "/tmp/astbench-XXXXXX";
+	char filepath[PATH_MAX];
+	const char *dir = NULL;
+	double scale(0.01), t0, t1, t2;
+	int zone, nrec, rslt;
+	uint64_t seed(1);
+	struct stat st;
+
+	init_index_param(param);
+	param.usecache = false;
+	param.Nside    = 128;
+	enum {// 仅有长格式的选项
+		OPT_SEED = 256,
+		OPT_MEM_LIMIT
+	};
+	const struct option longopts[] = {
+		{"threads",   required_argument, NULL, 't'},
+		{"seed",      required_argument, NULL, OPT_SEED},
+		{"mem-limit", required_argument, NULL, OPT_MEM_LIMIT},
+		{NULL, 0, NULL, 0}
+	};
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, "d:Ehj:n:s:t:N:U:", longopts, NULL)) != -1) {
+		switch(ch) {
+		case 'h':
+			print_help(argv[0]);
+			return -1;
+		case 'd': dir = optarg;
+			break;
+		case 'E': param.scanoccupied = true;
+			break;
+		case 'j': param.jitter = atof(optarg);
+			break;
+		case 'n': param.sweeps = atoi(optarg);
+			break;
+		case 's': scale = atof(optarg);
+			break;
+		case 't': param.nthread = atoi(optarg);
+			break;
+		case 'N': param.Nside = atoi(optarg);
+			break;
+		case 'U': param.UNside = atoi(optarg);
+			break;
+		case OPT_SEED: seed = strtoull(optarg, NULL, 10);
+			break;
+		case OPT_MEM_LIMIT:
+			if ((param.memlimit = parse_size(optarg)) < (1 << 20)) {
+				printf ("memory limit '%s' should be at least 1M\n", optarg);
+				return -2;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	if (scale <= 0. || param.nthread < 1 || param.Nside < 1 || param.UNside < 0 || param.sweeps < 1
+			|| param.jitter <= 0.) {
+		print_help(argv[0]);
+		return -3;
+	}
+	if (!dir && !(dir = mkdtemp(tmpdir))) {
+		printf ("Failed to create temporary directory\n");
+		return -4;
+	}
+	snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+	mkdir(dir, 0755);
+	mkdir(filepath, 0755);
+
+	// 生成模拟天区
+	t0 = bench_clock();
+	for (zone = 1; zone <= UCAC4_NZONE; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+		if (!stat(filepath, &st) && st.st_size % UCAC4_UNIT == 0) continue;
+		if (!ucac4_synth_zone(dir, zone, scale, seed, nrec)) {
+			printf ("Failed to write synthetic zone [%s]\n", filepath);
+			return -5;
+		}
+	}
+	t1 = bench_clock();
+	printf ("synthetic UCAC4 in [%s]: %.2f s\n\n", dir, t1 - t0);
+
+	// 导入与构建
+	if (!build_ucac4_fits(dir, param)) {
+		printf ("build_ucac4_fits() failed\n");
+		return -6;
+	}
+	t2 = bench_clock();
+	printf ("\n");
+	rslt = build_index(param, &index, NULL);
+	printf ("\nbuild: ingest %.3f s, build_index %.3f s, %s\n", t2 - t1, bench_clock() - t2,
+			rslt ? "failed" : "done");
+
+	if (dir == tmpdir) remove_workdir(dir, param);
+	return rslt ? -7 : 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * @file astbench_healpix.cpp HEALPix像元计算的正确性检验与性能评估
+ * @note
+ * - 参考值由独立实现(HEALPix C++库算法, 以z=cos(θ)计算)生成, 已剔除位于像元边界±2mas内的位置
+ * - 检验批量实现与标量实现逐位一致, RING/NESTED编号互换, 像元中心回代及相邻关系的对称性
+ * - 检验大像元及边缘区域: 与逐单元沿相邻关系搜索margin层的判定结果比较
+ * - 计时对n颗随机恒星批量计算像元编号
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "healpix.h"
+
+using namespace std;
+
+void print_help(const char* progname) {
+	printf ("\nUsage: %s\n\n"
+			"    -h               print help\n"
+			"    -n <stars>       number of random stars to bin (default: 100000000)\n"
+			"    -s <nside>       nside for timing, power of 2 (default: 1024)\n"
+			"\n",
+			progname);
+}
+
+static double bench_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct {
+	int nside;
+	uint32_t ra, spd;
+	int64_t ring, nest;
+} healpix_ref;
+
+static const healpix_ref refs[] = {
+	{    1024,  323946139u, 423938499u,        3361792LL,        6241331LL },
+	{       4, 1150797845u, 101071364u,            178LL,            179LL },
+	{       2, 1089709946u,   1818841u,             47LL,             44LL },
+	{     128,  194804716u, 591682483u,           3637LL,          15484LL },
+	{  262144,  265862673u, 239701014u,   576175425601LL,   354355609797LL },
+	{  262144,  132847736u, 619659571u,     3885846397LL,    67843275884LL },
+	{       2,  474769608u,  50017772u,             45LL,             36LL },
+	{      16,  621931211u, 645605415u,              1LL,            511LL },
+	{  131072,  388106949u, 110655224u,   191677405391LL,   163486225080LL },
+	{ 1048576,  403449954u,   2986809u, 13193447822457LL,  9895791948576LL },
+	{  524288,  442292975u, 533021001u,   249672647044LL,   516495329234LL },
+	{    8192,  674625911u, 499936196u,       99377381LL,      179752932LL },
+	{   16384,  776492204u, 321872363u,     1627265377LL,     1701336750LL },
+	{      32,  524193277u,  87891151u,          11703LL,           9324LL },
+	{   65536, 1063254275u, 368804211u,    20216104986LL,    32162133357LL },
+	{     512,  157197671u, 126772164u,        2856352LL,        2155850LL },
+	{      32,  734559255u, 163192149u,          10374LL,          10856LL },
+	{    8192,   84196939u,  83344353u,      772865902LL,      546998580LL },
+	{  524288, 1066600997u, 622657734u,    12432539161LL,  1097569228555LL },
+	{       4,  200995867u, 289845088u,            106LL,            143LL },
+	{   16384,  611164247u, 414240403u,      928250041LL,     1859879669LL },
+	{    2048,   48453507u, 495741540u,        6548850LL,        2752338LL },
+	{     128,  854478760u, 419779047u,          54353LL,          34770LL },
+	{   32768,  173047027u, 178634438u,    10616128605LL,     9038081607LL },
+	{  131072,  596654991u, 147023327u,   181062795878LL,   159805220715LL },
+	{    4096,  495535103u,    634591u,      201326072LL,      150995050LL },
+	{       1, 1041449535u,   1182503u,             11LL,             11LL },
+	{    1024,  269490963u, 553504709u,         646857LL,         871464LL },
+	{ 1048576,  115948850u, 490317463u,  1835622228045LL,   673797174552LL },
+	{       8, 1034062382u, 647124384u,              3LL,            255LL },
+	{       8,     500964u,    425572u,            764LL,            512LL },
+	{   32768,  263801685u, 123859888u,    11757793496LL,     8896596616LL },
+	{      16,  219446233u, 367902431u,           1195LL,           1467LL },
+	{   65536,  707950177u, 239489168u,    36035374942LL,    26107730982LL },
+	{      64,  514081106u, 430231565u,          12261LL,           4953LL },
+	{       1,   59994414u, 300023374u,              4LL,              4LL },
+	{      64,  739337659u, 480207058u,           7705LL,          10669LL },
+	{    2048,  783049602u,  86477158u,       48152211LL,       42560773LL },
+	{    4096,  994629687u, 430985811u,       50778398LL,      133538592LL },
+	{     256,   90621424u, 104953188u,         736232LL,         536146LL },
+	{     256, 1201546737u, 217527775u,         588213LL,         752030LL },
+	{     512,   97146781u,   1128421u,        3145689LL,        2097161LL },
+};
+
+/*!
+ * @brief 与参考值比较
+ * @return
+ * 不一致的数量
+ */
+static int check_reference() {
+	int n = sizeof(refs) / sizeof(healpix_ref), bad(0);
+	int64_t ring, nest;
+
+	for (int i = 0; i < n; ++i) {
+		const healpix_ref& ref = refs[i];
+		ring = healpix_mas2pix(ref.nside, HEALPIX_RING, ref.ra, ref.spd);
+		nest = healpix_mas2pix(ref.nside, HEALPIX_NEST, ref.ra, ref.spd);
+		if (ring != ref.ring || nest != ref.nest) {
+			printf ("  nside=%d ra=%u spd=%u: expects %lld/%lld, got %lld/%lld\n", ref.nside, ref.ra, ref.spd,
+					(long long) ref.ring, (long long) ref.nest, (long long) ring, (long long) nest);
+			++bad;
+		}
+	}
+	printf ("reference: %d positions, %d mismatched\n", n, bad);
+	return bad;
+}
+
+/*!
+ * @brief 检验编号互换、像元中心回代与相邻关系对称性
+ */
+static int check_consistency(const vector<uint32_t>& ra, const vector<uint32_t>& spd, int count) {
+	int64_t ring, nest, nb[8], nb2[8];
+	uint32_t cra, cspd;
+	int bad(0), nside, i, j, k;
+	bool found;
+
+	for (i = 0; i < count; ++i) {
+		nside = 1 << (i % 21);
+		ring  = healpix_mas2pix(nside, HEALPIX_RING, ra[i], spd[i]);
+		nest  = healpix_mas2pix(nside, HEALPIX_NEST, ra[i], spd[i]);
+		if (healpix_ring2nest(nside, ring) != nest || healpix_nest2ring(nside, nest) != ring) ++bad;
+		healpix_pix2mas(nside, HEALPIX_NEST, nest, cra, cspd);
+		if (healpix_mas2pix(nside, HEALPIX_NEST, cra, cspd) != nest) ++bad;
+
+		healpix_neighbours(nside, HEALPIX_RING, ring, nb);
+		for (k = 0; k < 8; ++k) {
+			if (nb[k] < 0) continue;
+			healpix_neighbours(nside, HEALPIX_RING, nb[k], nb2);
+			for (j = 0, found = false; j < 8 && !found; ++j) found = nb2[j] == ring;
+			if (!found || nb[k] == ring) ++bad;
+		}
+	}
+	printf ("consistency: %d positions, %d failed\n", count, bad);
+	return bad;
+}
+
+/*!
+ * @brief 逐单元判定: 自cell起沿相邻关系扩展margin层, 检查是否遇到中心落在大像元内的单元
+ */
+static bool near_region(int bignside, int64_t bighp, int nside, int margin, int64_t cell) {
+	vector<int64_t> front(1, cell), next, seen(1, cell);
+	int64_t nb[8];
+	uint32_t ra, spd;
+
+	for (int d = 0; d <= margin; ++d) {
+		for (size_t i = 0; i < front.size(); ++i) {
+			healpix_pix2mas(nside, HEALPIX_RING, front[i], ra, spd);
+			if (healpix_mas2pix(bignside, HEALPIX_NEST, ra, spd) == bighp) return true;
+		}
+		next.clear();
+		for (size_t i = 0; i < front.size() && d < margin; ++i) {
+			healpix_neighbours(nside, HEALPIX_RING, front[i], nb);
+			for (int k = 0; k < 8; ++k) {
+				if (nb[k] < 0 || find(seen.begin(), seen.end(), nb[k]) != seen.end()) continue;
+				seen.push_back(nb[k]);
+				next.push_back(nb[k]);
+			}
+		}
+		front.swap(next);
+	}
+	return false;
+}
+
+/*!
+ * @brief 检验大像元及边缘区域的判定
+ * @note
+ * 恒星取自各大像元外扩边缘后的外包范围
+ */
+static int check_region() {
+	const int conf[][4] = {// bignside, bighp, nside, margin
+		{ 2,  5,  64, 0 }, { 2,  5,  64, 3 }, { 4, 191, 256, 4 }, { 1, 4, 37, 3 },
+		{ 2, 44,  50, 2 }, { 8,  3, 200, 5 }, { 1,  0,   1, 1 }, { 4, 100, 4, 2 }
+	};
+	int nconf = sizeof(conf) / sizeof(conf[0]), n(20000), bad(0), nkept, c, i;
+	vector<uint32_t> ra(n), spd(n);
+	vector<uint8_t> mask(n);
+	healpix_bound bound;
+	mt19937 gen(2);
+	uniform_real_distribution<double> unit(0., 1.);
+	double t0, elapse, dec, phi, width;
+	int64_t cell;
+	bool kept;
+
+	for (c = 0; c < nconf; ++c) {
+		int bignside = conf[c][0], nside = conf[c][2], margin = conf[c][3];
+		int64_t bighp = conf[c][1];
+
+		healpix_nest_bound(bignside, bighp, 3. * (margin + 1) / nside, bound);
+		width = bound.rahi - bound.ralo;
+		if (width < 0.) width += 2. * M_PI;
+		for (i = 0; i < n; ++i) {
+			dec = bound.declo + (bound.dechi - bound.declo) * unit(gen);
+			phi = bound.allra ? 2. * M_PI * unit(gen) : fmod(bound.ralo + width * unit(gen), 2. * M_PI);
+			ra[i]  = uint32_t(phi / M_PI * 648000000.) % 1296000000u;
+			spd[i] = uint32_t(min(max((dec / M_PI + 0.5) * 648000000., 0.), 648000000.));
+		}
+
+		t0 = bench_clock();
+		const healpix_region* region = healpix_region_get(bignside, bighp, nside, margin);
+		elapse = bench_clock() - t0;
+		nkept  = region->Select(ra.data(), spd.data(), n, mask.data());
+		int differ(0);
+		for (i = 0; i < n; ++i) {
+			cell = healpix_mas2pix(nside, HEALPIX_RING, ra[i], spd[i]);
+			kept = healpix_mas2pix(bignside, HEALPIX_NEST, ra[i], spd[i]) == bighp
+					|| (margin > 0 && near_region(bignside, bighp, nside, margin, cell));
+			differ += kept != (mask[i] != 0);
+		}
+		printf ("  big %d/%lld, nside %d, margin %d: %s, %d interval(s), %.3f ms; %d of %d kept, %d differ\n",
+				bignside, (long long) bighp, nside, margin, region->scheme == HEALPIX_NEST ? "NESTED" : "RING",
+				int(region->lo.size()), elapse * 1E3, nkept, n, differ);
+		bad += differ;
+	}
+	printf ("region: %d configurations, %d failed\n", nconf, bad);
+	return bad;
+}
+
+int main(int argc, char **argv) {
+	int nside(1024), nstar(100000000), ch, bad, scheme, i;
+	double t0, t1;
+
+	while ((ch = getopt(argc, argv, "hn:s:")) != -1) {
+		switch(ch) {
+		case 'h':
+			print_help(argv[0]);
+			return -1;
+		case 'n': nstar = atoi(optarg);
+			break;
+		case 's': nside = atoi(optarg);
+			break;
+		default:
+			break;
+		}
+	}
+	if (nstar < 1 || nside < 1 || nside > (1 << 28) || (nside & (nside - 1))) {
+		print_help(argv[0]);
+		return -3;
+	}
+
+	vector<uint32_t> ra(nstar), spd(nstar);
+	vector<int64_t> pix(nstar);
+	mt19937 gen(1);
+	uniform_int_distribution<uint32_t> dra(0, 1295999999), dspd(0, 648000000);
+	for (i = 0; i < nstar; ++i) {
+		ra[i]  = dra(gen);
+		spd[i] = dspd(gen);
+	}
+
+	bad = check_reference();
+	bad += check_consistency(ra, spd, nstar < 100000 ? nstar : 100000);
+	bad += check_region();
+
+	printf ("\nbinning %d stars, nside=%d\n", nstar, nside);
+	printf ("  %-8s %10s %10s %10s %10s\n", "scheme", "batch(s)", "scalar(s)", "Mstar/s", "differs");
+	for (scheme = HEALPIX_RING; scheme <= HEALPIX_NEST; ++scheme) {
+		long long differ(0);
+
+		t0 = bench_clock();
+		healpix_mas2pix_batch(nside, scheme, ra.data(), spd.data(), nstar, pix.data());
+		t1 = bench_clock();
+		for (i = 0; i < nstar; ++i) differ += pix[i] != healpix_mas2pix(nside, scheme, ra[i], spd[i]);
+		printf ("  %-8s %10.3f %10.3f %10.1f %10lld\n", scheme == HEALPIX_RING ? "RING" : "NESTED",
+				t1 - t0, bench_clock() - t1, nstar * 1E-6 / (t1 - t0), differ);
+		bad += differ;
+	}
+
+	return bad ? 1 : 0;
+}
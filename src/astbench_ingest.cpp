@@ -0,0 +1,192 @@
+/**
+ * @file astbench_ingest.cpp 星表导入性能评估
+ * @note
+ * - 在工作目录下生成模拟UCAC4天区文件(已存在的天区文件直接复用)
+ * - 多次调用build_ucac4_fits(), 统计端到端耗时, 输出记录数/秒及MB/秒
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "build_index.h"
+#include "ucac4api.h"
+#include "ucac4synth.h"
+
+using namespace std;
+
+void print_help(const char* progname) {
+	printf ("\nUsage: %s\n\n"
+			"    -h                   print help\n"
+			"    -d <dir>             working directory for synthetic zones and outputs\n"
+			"                       (default: a temporary directory removed on exit)\n"
+			"    -s <scale>           number of records relative to UCAC4 (default: 0.01)\n"
+			"    -r <repeats>         number of timed runs (default: 3)\n"
+			"    -b <band>            filter band (default: V)\n"
+			"    [-t, --threads <n>]  number of threads for decoding UCAC4 zones (default: 1)\n"
+			"    [--reader <mode>]    mmap, fread or pipeline (default: mmap)\n"
+			"    [--seed <n>]         random seed of the synthetic catalog (default: 1)\n"
+			"    [--cache]            enable the decoded catalog cache (default: disabled)\n"
+			"    [--write-batch <size>]  bytes per write to the intermediate catalog, K/M suffix allowed\n"
+			"\n",
+			progname);
+}
+
+static double bench_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief 删除工作目录中生成的文件
+ */
+static void remove_workdir(const char* dir, const index_param& param) {
+	char filepath[PATH_MAX];
+
+	for (int zone = 1; zone <= UCAC4_NZONE; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+		unlink(filepath);
+	}
+	snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+	rmdir(filepath);
+	unlink(param.pathcat);
+	if (rmdir(dir)) printf ("working directory [%s] is kept\n", dir);
+}
+
+int main(int argc, char **argv) {
+	index_param param;
+	char tmpdir[] = "/tmp/astbench-XXXXXX";
+	char filepath[PATH_MAX];
+	const char *dir = NULL;
+	double scale(0.01);
+	int repeats(3), nzone, zone, nrec, i;
+	uint64_t seed(1);
+	int64_t nrec_total(0), bytes(0);
+	struct stat st;
+
+	init_index_param(param);
+	param.usecache = false;
+	enum {// 仅有长格式的选项
+		OPT_READER = 256,
+		OPT_SEED,
+		OPT_CACHE,
+		OPT_WRITE_BATCH
+	};
+	const struct option longopts[] = {
+		{"threads", required_argument, NULL, 't'},
+		{"reader",  required_argument, NULL, OPT_READER},
+		{"seed",    required_argument, NULL, OPT_SEED},
+		{"cache",   no_argument,       NULL, OPT_CACHE},
+		{"write-batch", required_argument, NULL, OPT_WRITE_BATCH},
+		{NULL, 0, NULL, 0}
+	};
+	long long size;
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, "b:d:hr:s:t:", longopts, NULL)) != -1) {
+		switch(ch) {
+		case 'h':
+			print_help(argv[0]);
+			return -1;
+		case 'b':
+			for (i = 0; i < UCAC4_NBAND && strcmp(optarg, ucac4_band[i]); ++i);
+			if (i == UCAC4_NBAND) {
+				printf ("unknown band '%s'\n", optarg);
+				return -2;
+			}
+			param.filter_band = i;
+			break;
+		case 'd': dir = optarg;
+			break;
+		case 'r': repeats = atoi(optarg);
+			break;
+		case 's': scale = atof(optarg);
+			break;
+		case 't': param.nthread = atoi(optarg);
+			break;
+		case OPT_READER:
+			if (!strcmp(optarg, "mmap")) param.reader = UCAC4_READ_MMAP;
+			else if (!strcmp(optarg, "fread")) param.reader = UCAC4_READ_FREAD;
+			else if (!strcmp(optarg, "pipeline")) param.reader = UCAC4_READ_PIPELINE;
+			else {
+				printf ("unknown reader '%s', expects mmap, fread or pipeline\n", optarg);
+				return -2;
+			}
+			break;
+		case OPT_SEED: seed = strtoull(optarg, NULL, 10);
+			break;
+		case OPT_CACHE: param.usecache = true;
+			break;
+		case OPT_WRITE_BATCH:
+			if ((size = parse_size(optarg)) < CAT_ROW_BYTES || size > (1 << 30)) {
+				printf ("write batch '%s' should be %d bytes to 1G\n", optarg, CAT_ROW_BYTES);
+				return -2;
+			}
+			param.writebatch = int(size);
+			break;
+		default:
+			break;
+		}
+	}
+	if (scale <= 0. || repeats < 1 || param.nthread < 1) {
+		print_help(argv[0]);
+		return -3;
+	}
+	if (!dir && !(dir = mkdtemp(tmpdir))) {
+		printf ("Failed to create temporary directory\n");
+		return -4;
+	}
+	snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+	mkdir(dir, 0755);
+	mkdir(filepath, 0755);
+
+	// 生成模拟天区
+	double t0 = bench_clock();
+	for (zone = 1, nzone = 0; zone <= UCAC4_NZONE; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+		if (!stat(filepath, &st) && st.st_size % UCAC4_UNIT == 0) {
+			nrec_total += st.st_size / UCAC4_UNIT;
+			continue;
+		}
+		if (!ucac4_synth_zone(dir, zone, scale, seed, nrec)) {
+			printf ("Failed to write synthetic zone [%s]\n", filepath);
+			return -5;
+		}
+		nrec_total += nrec;
+		++nzone;
+	}
+	bytes = nrec_total * UCAC4_UNIT;
+	printf ("synthetic UCAC4 in [%s]: %d zones generated in %.2f s, %lld records, %.1f MB\n",
+			dir, nzone, bench_clock() - t0, (long long) nrec_total, bytes * 1E-6);
+
+	// 端到端计时. 缓存写入工作目录, 不使用用户的缓存目录
+	if (param.usecache && !param.cachedir[0]
+			&& snprintf(param.cachedir, sizeof(param.cachedir), "%s", dir) >= int(sizeof(param.cachedir))) {
+		printf ("working directory [%s] is too long for the catalog cache\n", dir);
+		return -6;
+	}
+	vector<double> elapse;
+	for (i = 0; i < repeats; ++i) {
+		t0 = bench_clock();
+		if (!build_ucac4_fits(dir, param)) {
+			printf ("build_ucac4_fits() failed in run %d\n", i + 1);
+			return -7;
+		}
+		elapse.push_back(bench_clock() - t0);
+	}
+	sort(elapse.begin(), elapse.end());
+	double best = elapse[0], median = elapse[repeats / 2];
+	printf ("\ningest: %d run(s), %d thread(s), reader %s, write batch %d bytes\n", repeats, param.nthread,
+			param.reader == UCAC4_READ_MMAP ? "mmap" : (param.reader == UCAC4_READ_FREAD ? "fread" : "pipeline"),
+			param.writebatch);
+	printf ("  best   %8.3f s  %12.0f records/s  %8.1f MB/s\n", best, nrec_total / best, bytes * 1E-6 / best);
+	printf ("  median %8.3f s  %12.0f records/s  %8.1f MB/s\n", median, nrec_total / median, bytes * 1E-6 / median);
+
+	if (dir == tmpdir) remove_workdir(dir, param);
+	return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * @file astbench_kdtree.cpp K-D树构建的正确性检验与性能评估
+ * @note
+ * - 在单位球面上生成n个随机点, 以1至t个线程构建星表K-D树并计时
+ * - 检验排列与重排后的数据一致, 并以kdtree_check()检验叶节点区间, 包围盒与分割值
+ * - 以q个随机查询点计时小半径范围查询与最近邻, 比较定维实例与通用实例(维数取自kd->ndim),
+ *   部分查询与穷举结果比较
+ * - 量化树(u32, u16): 比较内存, 误差上限与实测最大误差及查询耗时. 检验范围查询不遗漏距离不大于
+ *   r - e的点, 且不返回距离大于r + e的点(e为误差上限)
+ * - 节点排列: 以叶节点平均L个点构建深树(默认2, 2000万点时约1700万节点), 比较堆序与vEB排列的查询耗时
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "kdtree.h"
+#include "kdtree_kernel.h"
+#include "startree.h"
+
+using namespace std;
+
+void print_help(const char* progname) {
+	printf ("\nUsage: %s\n\n"
+			"    -h               print help\n"
+			"    -n <points>      number of random points (default: 20000000)\n"
+			"    -t <threads>     maximum number of threads (default: 8)\n"
+			"    -q <queries>     number of random queries (default: 1000000)\n"
+			"    -k <neighbours>  mean number of points per range query (default: 10)\n"
+			"    -L <Nleaf>       points per leaf of the deep tree for the layout comparison (default: 2)\n"
+			"\n",
+			progname);
+}
+
+static double bench_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void random_points(mt19937& gen, int n, double* xyz) {
+	uniform_real_distribution<double> dz(-1.0, 1.0), da(0.0, 2.0 * M_PI);
+
+	for (int i = 0; i < n; ++i) {
+		double z = dz(gen), alpha = da(gen), r = sqrt(1.0 - z * z);
+		xyz[3 * i]     = r * cos(alpha);
+		xyz[3 * i + 1] = r * sin(alpha);
+		xyz[3 * i + 2] = z;
+	}
+}
+
+static double dist2(const double* a, const double* b) {
+	return (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]);
+}
+
+/*!
+ * @brief 与穷举结果比较范围查询的结果数及最近邻的距离
+ * @return
+ * 不一致的查询数
+ */
+static int check_queries(const kdtree_t* kd, const vector<double>& xyz, const double* query, int nquery,
+		double maxd2) {
+	kdtree_qres_t* res = NULL;
+	int bad(0), k, i, count, nearest;
+	double d2, best, mind2;
+
+	for (k = 0; k < nquery; ++k) {
+		const double* q = query + 3 * k;
+		for (i = 0, count = 0, best = HUGE_VAL; i < kd->ndata; ++i) {
+			d2 = dist2(q, &xyz[3 * size_t(i)]);
+			count += d2 <= maxd2;
+			best = min(best, d2);
+		}
+		res = kdtree_rangesearch_options_reuse(kd, res, q, maxd2, KD_OPTIONS_COMPUTE_DISTS | KD_OPTIONS_SORT_DISTS);
+		nearest = kdtree_nearest_neighbour(kd, q, &mind2);
+		bad += int(res->nres) != count || mind2 != best || dist2(q, &xyz[3 * size_t(nearest)]) != best;
+		for (i = 1; i < int(res->nres); ++i) bad += res->sdists[i] < res->sdists[i - 1];
+	}
+	kdtree_free_query(res);
+	return bad;
+}
+
+/*!
+ * @brief 检验量化树: 数据点的量化误差及范围查询结果
+ * @return
+ * 不一致的查询数与误差超出上限的数据点数之和
+ */
+static int check_quantized(const kdtree_t* kd, const vector<double>& xyz, const double* query, int nquery,
+		double maxd2, double& maxerr) {
+	double err = kdtree_quantization_error(kd), r = sqrt(maxd2), pt[3], d;
+	kdtree_qres_t* res = NULL;
+	vector<bool> found(kd->ndata);
+	int bad(0), k, i;
+	unsigned int j;
+
+	for (i = 0, maxerr = 0.0; i < kd->ndata; ++i) {
+		kd->funcs.copy_data_double(kd, i, 1, pt);
+		maxerr = max(maxerr, sqrt(dist2(pt, &xyz[3 * size_t(kd->perm[i])])));
+	}
+	bad += maxerr > err;
+	for (k = 0; k < nquery; ++k) {
+		const double* q = query + 3 * k;
+		res = kdtree_rangesearch_options_reuse(kd, res, q, maxd2, 0);
+		for (j = 0; j < res->nres; ++j) {
+			found[res->inds[j]] = true;
+			bad += sqrt(dist2(q, &xyz[3 * size_t(res->inds[j])])) > r + err;
+		}
+		for (i = 0; i < kd->ndata; ++i) {
+			d = sqrt(dist2(q, &xyz[3 * size_t(i)]));
+			bad += d <= r - err && !found[i];
+		}
+		for (j = 0; j < res->nres; ++j) found[res->inds[j]] = false;
+	}
+	kdtree_free_query(res);
+	return bad;
+}
+
+/*!
+ * @brief 计时范围查询与最近邻
+ */
+static void time_queries(const kdtree_t* kd, const char* name, const double* query, int nquery, double maxd2) {
+	kdtree_qres_t* res = NULL;
+	long long nres(0);
+	double t0, t1, t2, mind2;
+	int k;
+
+	t0 = bench_clock();
+	for (k = 0; k < nquery; ++k) {
+		res = kdtree_rangesearch_options_reuse(kd, res, query + 3 * k, maxd2, 0);
+		nres += res->nres;
+	}
+	t1 = bench_clock();
+	for (k = 0; k < nquery; ++k) nres += kdtree_nearest_neighbour(kd, query + 3 * k, &mind2) >= 0;
+	t2 = bench_clock();
+	printf ("  %-8s %12.3f %12.3f %12.1f\n", name, (t1 - t0) * 1E6 / nquery, (t2 - t1) * 1E6 / nquery,
+			double(nres - nquery) / nquery);
+	kdtree_free_query(res);
+}
+
+int main(int argc, char **argv) {
+	int npoint(20000000), nthread(8), nquery(1000000), neighbour(10), nleaf(2), ch, bad(0), t, i, d;
+	double t0, t1;
+
+	while ((ch = getopt(argc, argv, "hn:t:q:k:L:")) != -1) {
+		switch(ch) {
+		case 'h':
+			print_help(argv[0]);
+			return -1;
+		case 'n': npoint = atoi(optarg);
+			break;
+		case 't': nthread = atoi(optarg);
+			break;
+		case 'q': nquery = atoi(optarg);
+			break;
+		case 'k': neighbour = atoi(optarg);
+			break;
+		case 'L': nleaf = atoi(optarg);
+			break;
+		default:
+			break;
+		}
+	}
+	if (npoint < 1 || nthread < 1 || nquery < 1 || neighbour < 1 || nleaf < 1) {
+		print_help(argv[0]);
+		return -3;
+	}
+
+	vector<double> xyz(size_t(npoint) * 3), data, query(size_t(nquery) * 3);
+	mt19937 gen(1);
+	random_points(gen, npoint, xyz.data());
+	random_points(gen, nquery, query.data());
+
+	printf ("\nbuilding star trees over %d points, Nleaf=%d\n", npoint, STARTREE_NLEAF);
+	printf ("  %-8s %10s %10s %10s\n", "threads", "build(s)", "Mpoint/s", "check");
+	for (t = 1; t <= nthread; t *= 2) {
+		data = xyz;
+		t0 = bench_clock();
+		kdtree_t* kd = kdtree_build(data.data(), npoint, 3, STARTREE_NLEAF, KDTT_DOUBLE,
+				KD_BUILD_BBOX | KD_BUILD_SPLIT, t);
+		t1 = bench_clock();
+
+		int rslt = kdtree_check(kd);
+		for (i = 0; i < npoint && !rslt; ++i) {
+			for (d = 0; d < 3; ++d) rslt |= data[3 * i + d] != xyz[3 * size_t(kd->perm[i]) + d];
+		}
+		printf ("  %-8d %10.3f %10.1f %10s\n", t, t1 - t0, npoint * 1E-6 / (t1 - t0), rslt ? "FAILED" : "ok");
+		bad += rslt != 0;
+		kdtree_free(kd);
+	}
+
+	// 查询: 球冠内平均有neighbour个点时, 弦长平方为4 * neighbour / npoint
+	double maxd2 = 4.0 * neighbour / npoint;
+	kdtree_t* kd;
+	data = xyz;
+	kd = kdtree_build(data.data(), npoint, 3, STARTREE_NLEAF, KDTT_DOUBLE, KD_BUILD_BBOX | KD_BUILD_SPLIT, nthread);
+	i = check_queries(kd, xyz, query.data(), min(nquery, 20), maxd2);
+	printf ("\n%d queries, %d points per range query on average: %s\n", nquery, neighbour, i ? "FAILED" : "ok");
+	bad += i;
+	printf ("  %-8s %12s %12s %12s\n", "kernel", "range(us)", "nearest(us)", "results");
+	time_queries(kd, "ndim=3", query.data(), nquery, maxd2);
+	kdtree_kernel<double, double, double, 0>::install(kd->funcs);
+	time_queries(kd, "generic", query.data(), nquery, maxd2);
+	size_t bytes = kdtree_bytes(kd);
+	kdtree_free(kd);
+
+	// 量化树
+	const uint32_t types[] = { KDTT_DUU, KDTT_DSS };
+	const char* names[] = { "u32", "u16" };
+	printf ("\nquantized trees\n");
+	printf ("  %-8s %10s %12s %12s %12s %12s %10s\n", "type", "MB", "bound", "max error", "range(us)",
+			"nearest(us)", "check");
+	printf ("  %-8s %10.1f %12s %12s\n", "double", bytes / 1048576.0, "0", "0");
+	for (t = 0; t < 2; ++t) {
+		double maxerr, t2;
+		kdtree_qres_t* res = NULL;
+
+		data = xyz;
+		kd = kdtree_build(data.data(), npoint, 3, STARTREE_NLEAF, types[t], KD_BUILD_BBOX | KD_BUILD_SPLIT, nthread);
+		t0 = bench_clock();
+		for (i = 0; i < nquery; ++i) res = kdtree_rangesearch_options_reuse(kd, res, &query[3 * size_t(i)], maxd2, 0);
+		t1 = bench_clock();
+		for (i = 0; i < nquery; ++i) kdtree_nearest_neighbour(kd, &query[3 * size_t(i)], &maxerr);
+		t2 = bench_clock();
+		kdtree_free_query(res);
+
+		i = kdtree_check(kd) + check_quantized(kd, xyz, query.data(), min(nquery, 20), maxd2, maxerr);
+		printf ("  %-8s %10.1f %12.3g %12.3g %12.3f %12.3f %10s\n", names[t], kdtree_bytes(kd) / 1048576.0,
+				kdtree_quantization_error(kd), maxerr, (t1 - t0) * 1E6 / nquery, (t2 - t1) * 1E6 / nquery,
+				i ? "FAILED" : "ok");
+		bad += i != 0;
+		kdtree_free(kd);
+	}
+
+	// 节点排列: 同一棵深树依次以堆序与vEB排列查询
+	data = xyz;
+	kd = kdtree_build(data.data(), npoint, 3, nleaf, KDTT_DUU, KD_BUILD_BBOX | KD_BUILD_SPLIT, nthread);
+	printf ("\nnode layout: u32 tree, %d levels, %d nodes, %.1f MB\n", kd->nlevels, kd->nnodes,
+			kdtree_bytes(kd) / 1048576.0);
+	printf ("  %-8s %12s %12s %12s\n", "layout", "range(us)", "nearest(us)", "results");
+	for (t = KD_LAYOUT_HEAP; t <= KD_LAYOUT_VEB; ++t) {
+		kdtree_set_layout(kd, t);
+		bad += kdtree_check(kd) != 0;
+		time_queries(kd, t == KD_LAYOUT_HEAP ? "heap" : "vEB", query.data(), nquery, maxd2);
+	}
+	kdtree_free(kd);
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/**
+ * @file astbench_load.cpp 中间星表加载性能评估: 原始表与分块压缩表
+ * @note
+ * - 以-i指定的中间星表为原始表; 未指定时在工作目录下生成模拟UCAC4并调用build_ucac4_fits()
+ * - 对每种压缩算法生成分块压缩表, 统计压缩耗时与压缩比
+ * - 每次加载前以posix_fadvise(POSIX_FADV_DONTNEED)将文件逐出页缓存, 计时打开文件并读出全部行
+ * - 最后检验0行的中间星表及其压缩副本能否打开, 失败时返回非0
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "build_index.h"
+#include "cat_index.h"
+#include "tblcomp.h"
+#include "ucac4api.h"
+#include "ucac4synth.h"
+
+using namespace std;
+
+void print_help(const char* progname) {
+	printf ("\nUsage: %s\n\n"
+			"    -h                   print help\n"
+			"    -i <catalog>         intermediate catalog to load (default: generated from a synthetic UCAC4)\n"
+			"    -d <dir>             working directory for synthetic zones and compressed copies\n"
+			"                       (default: a temporary directory removed on exit)\n"
+			"    -s <scale>           number of synthetic records relative to UCAC4 (default: 0.05)\n"
+			"    -r <repeats>         number of timed loads per file (default: 3)\n"
+			"    [-t, --threads <n>]  number of threads for compressing and decompressing tiles (default: 1)\n"
+			"    [--compress <list>]  comma-separated algorithms to compare (default: rice,gzip,gzip2)\n"
+			"    [--tile-rows <n>]    rows per compressed tile (default: about 4MB of rows)\n"
+			"\n",
+			progname);
+}
+
+static double bench_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief 将文件逐出页缓存, 使下一次读取来自存储设备
+ * @note
+ * NFS上仅逐出客户端缓存, 服务端缓存不受影响
+ */
+static bool drop_cache(const char* filepath) {
+	int fd, rc;
+
+	if ((fd = open(filepath, O_RDONLY)) < 0) return false;
+	fdatasync(fd);
+	rc = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	return rc == 0;
+}
+
+/*!
+ * @brief 打开中间星表并读出全部行
+ * @param sum 输出: 各行校验和
+ * @return
+ * 行数. 失败时返回-1
+ */
+static long long load_catalog(const char* filepath, int nthread, uint64_t& sum) {
+	CatReader reader;
+	CatBatch batch;
+	long long first, rows;
+	int n, i;
+
+	if (!reader.Open(filepath, nthread)) return -1;
+	rows = reader.Rows();
+	for (first = 0, sum = 0; first < rows; first += n) {
+		n = rows - first < CAT_WRITE_BATCH ? int(rows - first) : CAT_WRITE_BATCH;
+		batch.clear();
+		reader.Read(first, n, batch);
+		for (i = 0; i < n; ++i) sum += batch.ra[i] + 3 * uint64_t(batch.spd[i]) + uint16_t(batch.mag[i]);
+	}
+	return rows;
+}
+
+/*!
+ * @brief 检验空星表: 写入0行的中间星表及其压缩副本, 应能打开且行数为0
+ * @return
+ * 检验结果
+ */
+static bool check_empty_catalog(const char* dir, int nthread) {
+	char pathraw[PATH_MAX], pathcomp[PATH_MAX];
+	CatWriter writer;
+	uint64_t sum;
+	long long rows(-1), rows_comp(-1);
+
+	snprintf(pathraw, sizeof(pathraw), "%s/astbench-empty.fit", dir);
+	snprintf(pathcomp, sizeof(pathcomp), "%s/astbench-empty-rice.fit", dir);
+	if (writer.Create(pathraw) && writer.Close()) {
+		rows = load_catalog(pathraw, nthread, sum);
+		if (tbl_compress_file(pathraw, pathcomp, tbl_compress_algor("rice"), 0, nthread))
+			rows_comp = load_catalog(pathcomp, nthread, sum);
+	}
+	printf ("\nempty catalog: raw %s, compressed %s\n",
+			rows == 0 ? "ok" : "failed", rows_comp == 0 ? "ok" : "failed");
+	unlink(pathraw);
+	unlink(pathcomp);
+	return rows == 0 && rows_comp == 0;
+}
+
+/*!
+ * @brief 删除工作目录中生成的文件
+ * @param first files中自此开始为生成的文件
+ */
+static void remove_workdir(const char* dir, const vector<string>& files, size_t first) {
+	char filepath[PATH_MAX];
+
+	for (int zone = 1; zone <= UCAC4_NZONE; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+		unlink(filepath);
+	}
+	snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+	rmdir(filepath);
+	for (size_t i = first; i < files.size(); ++i) unlink(files[i].c_str());
+	if (rmdir(dir)) printf ("working directory [%s] is kept\n", dir);
+}
+
+int main(int argc, char **argv) {
+	index_param param;
+	char tmpdir[] = "/tmp/astbench-XXXXXX";
+	char filepath[PATH_MAX], list[200] = "rice,gzip,gzip2", *token, *save;
+	const char *dir = NULL, *catalog = NULL, *algor;
+	double scale(0.05), t0;
+	int repeats(3), nthread(1), zone, nrec, i;
+	long tilelen(0);
+	struct stat st;
+
+	init_index_param(param);
+	param.usecache = false;
+	enum {// 仅有长格式的选项
+		OPT_COMPRESS = 256,
+		OPT_TILE_ROWS
+	};
+	const struct option longopts[] = {
+		{"threads",   required_argument, NULL, 't'},
+		{"compress",  required_argument, NULL, OPT_COMPRESS},
+		{"tile-rows", required_argument, NULL, OPT_TILE_ROWS},
+		{NULL, 0, NULL, 0}
+	};
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, "d:hi:r:s:t:", longopts, NULL)) != -1) {
+		switch(ch) {
+		case 'h':
+			print_help(argv[0]);
+			return -1;
+		case 'd': dir = optarg;
+			break;
+		case 'i': catalog = optarg;
+			break;
+		case 'r': repeats = atoi(optarg);
+			break;
+		case 's': scale = atof(optarg);
+			break;
+		case 't': nthread = atoi(optarg);
+			break;
+		case OPT_COMPRESS:
+			strncpy(list, optarg, sizeof(list) - 1);
+			break;
+		case OPT_TILE_ROWS: tilelen = atol(optarg);
+			break;
+		default:
+			break;
+		}
+	}
+	if (scale <= 0. || repeats < 1 || nthread < 1 || tilelen < 0) {
+		print_help(argv[0]);
+		return -3;
+	}
+	if (!dir && !(dir = mkdtemp(tmpdir))) {
+		printf ("Failed to create temporary directory\n");
+		return -4;
+	}
+	mkdir(dir, 0755);
+
+	// 原始表
+	vector<string> files, names;
+	if (!catalog) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b", dir);
+		mkdir(filepath, 0755);
+		for (zone = 1; zone <= UCAC4_NZONE; ++zone) {
+			snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", dir, zone);
+			if (!stat(filepath, &st) && st.st_size % UCAC4_UNIT == 0) continue;
+			if (!ucac4_synth_zone(dir, zone, scale, 1, nrec)) {
+				printf ("Failed to write synthetic zone [%s]\n", filepath);
+				return -5;
+			}
+		}
+		if (!build_ucac4_fits(dir, param)) {
+			printf ("build_ucac4_fits() failed\n");
+			return -6;
+		}
+		files.push_back(param.pathcat);
+	}
+	else files.push_back(catalog);
+	names.push_back("raw");
+
+	// 分块压缩表
+	printf ("\ncompress: %d thread(s), %s rows per tile\n", nthread, tilelen ? "given" : "default");
+	for (token = strtok_r(list, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+		if (!(algor = tbl_compress_algor(token))) {
+			printf ("unknown compression '%s', expects rice, gzip or gzip2\n", token);
+			continue;
+		}
+		snprintf(filepath, sizeof(filepath), "%s/astbench-%s.fit", dir, algor);
+		t0 = bench_clock();
+		if (!tbl_compress_file(files[0].c_str(), filepath, algor, tilelen, nthread)) {
+			printf ("Failed to compress [%s] by %s\n", files[0].c_str(), algor);
+			continue;
+		}
+		printf ("  %-8s %8.3f s\n", algor, bench_clock() - t0);
+		files.push_back(filepath);
+		names.push_back(algor);
+	}
+
+	// 冷缓存加载计时
+	uint64_t sum0(0), sum;
+	long long rows0(0), rows;
+	off_t size0(0);
+	printf ("\nload: %d run(s) per file from cold cache, %d thread(s)\n", repeats, nthread);
+	printf ("  %-8s %10s %7s %10s %10s %10s\n", "table", "MB", "ratio", "best(s)", "median(s)", "MB/s");
+	for (size_t k = 0; k < files.size(); ++k) {
+		vector<double> elapse;
+		bool cold(true);
+
+		stat(files[k].c_str(), &st);
+		for (i = 0; i < repeats; ++i) {
+			cold = drop_cache(files[k].c_str()) && cold;
+			t0 = bench_clock();
+			rows = load_catalog(files[k].c_str(), nthread, sum);
+			elapse.push_back(bench_clock() - t0);
+			if (rows < 0) break;
+		}
+		if (rows < 0) {
+			printf ("  %-8s failed to load [%s]\n", names[k].c_str(), files[k].c_str());
+			continue;
+		}
+		if (k == 0) {
+			rows0 = rows;
+			sum0  = sum;
+			size0 = st.st_size;
+		}
+		else if (rows != rows0 || sum != sum0) printf ("  %-8s content differs from raw table\n", names[k].c_str());
+
+		sort(elapse.begin(), elapse.end());
+		double best = elapse[0], median = elapse[elapse.size() / 2];
+		printf ("  %-8s %10.1f %7.3f %10.3f %10.3f %10.1f%s\n", names[k].c_str(), st.st_size * 1E-6,
+				double(st.st_size) / size0, best, median, rows * CAT_ROW_BYTES * 1E-6 / best,
+				cold ? "" : "  (cache not dropped)");
+	}
+	printf ("  %lld rows; MB/s counts uncompressed table bytes\n", rows0);
+	bool empty_ok = check_empty_catalog(dir, nthread);
+
+	if (dir == tmpdir) remove_workdir(dir, files, catalog ? 1 : 0);
+	return empty_ok ? 0 : -7;
+}
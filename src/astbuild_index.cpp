@@ -12,6 +12,7 @@
 #include "build_index.h"
 #include "keywords.h"
 #include "ucac4api.h"
+#include "tblcomp.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 /*!
@@ -21,6 +22,8 @@ void print_help(const char* progname) {
 	printf ("\nUsage: %s\n\n"
 			"    -h                   print help\n"
 			"    -o <output-index>    output filename for index\n"
+			"    -C, --catalog <dir>  UCAC4 directory holding u4b/z001..z900 (default: $UCAC4_DIR).\n"
+			"                       the intermediate catalog astindex-<id>.fit is written there\n"
 			"    (\n"
 			"    -P <scale-number>    use 'preset' values for '-N', '-l' and '-u'\n"
 			"        -P 0    should be good for images about 2 arcmin in size\n"
@@ -42,9 +45,11 @@ void print_help(const char* progname) {
 			"    )\n"
 			"    [-b <band>]          filter band for magnitude. using alphabet or digit number.\n"
 			"                       0-4 correspond to BVgri and 5-7 with JHK. default: V\n"
+			"    [--bands <list>]     extract these bands as well in the same UCAC4 pass, e.g. VrJ or 1,3,5.\n"
+			"                       each band is written to astindex-<id>-<band>.fit\n"
 			"    [-B <val>]           the brightest mag value\n"
 			"    [-U <Nside>]         healpix Nside for uniformization; default: same as -N\n"
-			"    [-H <big healpix>]   default: all-sky\n"
+			"    [-H <big healpix>]   NESTED index at Nside -s; only UCAC4 data around it is read. default: all-sky\n"
 			"    [-s <big healpix Nside]        default: 0\n"
 			"    [-m <margin>]        add ad margin of <margin> healpixels; default: 0\n"
 			"    [-n <sweeps>]        number of stars per fine healpix grid cell; default: 10\n"
@@ -56,22 +61,112 @@ void print_help(const char* progname) {
 			"    [-L <max-reuses>]    make extra passes through the healpixes, increasing the \"-r\" reuse\n"
 			"                       limit each time, up to \"max-reuses\"\n"
 			"    [-E]                 scan through the catalog, checking which healpixes are occupied.\n"
+			"                       the bitmap is built while decoding and saved beside the catalog\n"
 			"    [-I <unique-id]      set the unique ID of this index\n"
+			"    [-t, --threads <n>]  number of threads for decoding UCAC4 zones (default: 1)\n"
+			"    [--reader <mode>]    how UCAC4 zone files are read: mmap, fread or pipeline (default: mmap).\n"
+			"                       pipeline overlaps reading (io_uring when available), decoding and writing\n"
+			"    [--cache-dir <dir>]  directory of the decoded catalog cache\n"
+			"                       (default: $XDG_CACHE_HOME/astindex or ~/.cache/astindex)\n"
+			"    [--no-cache]         neither reuse nor write the decoded catalog cache\n"
+			"    [--epoch <year>]     propagate star positions by proper motion to this epoch, e.g. 2026.5\n"
+			"                       (default: catalog epoch J2000)\n"
+			"    [--reject-flags <spec>]  drop stars by UCAC4 quality flags while decoding. <spec> is a\n"
+			"                       comma-separated list of cdf, x2m, leda (flag is nonzero), objt (any\n"
+			"                       nonzero object type) or objt=<v> (object type v), e.g. cdf,leda,objt=1\n"
+			"    [--write-batch <size>]  bytes per write to the intermediate catalog, K/M suffix allowed,\n"
+			"                       e.g. the filesystem stripe size (default: 1M)\n"
+			"    [--compress <algo>]  store the intermediate catalog as a tile-compressed table:\n"
+			"                       rice, gzip or gzip2. tiles are compressed by --threads threads\n"
+			"    [--tile-rows <n>]    rows per compressed tile (default: about 4MB of rows)\n"
+			"    [--mem-limit <size>] memory budget for uniformization, K/M/G suffix allowed. larger catalogs\n"
+			"                       are sorted externally in temporary files under the cache directory\n"
+			"                       or beside the intermediate catalog (default: unlimited)\n"
 			"\n",
 			progname);
 }
 
+/*!
+ * @brief 由字母或数字查找波段索引
+ * @return
+ * 波段索引, [0, 7]. 无法识别时返回-1
+ */
+int band_index(char ch) {
+	if (ch >= '0' && ch <= '7') return ch - '0';
+	for (int i = 0; i < 8; ++i) {
+		if (ucac4_band[i][0] == ch) return i;
+	}
+	return -1;
+}
+
+/*!
+ * @brief 解析--reject-flags, 将剔除条件写入param.reject及param.reject_objt
+ * @return
+ * 无法识别时返回false
+ */
+bool parse_reject_flags(const char* spec, index_param& param) {
+	char buff[200], *token, *save;
+	int val;
+
+	strncpy(buff, spec, sizeof(buff) - 1);
+	buff[sizeof(buff) - 1] = 0;
+	for (token = strtok_r(buff, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(token, "cdf")) param.reject |= UCAC4_REJECT_CDF;
+		else if (!strcmp(token, "x2m")) param.reject |= UCAC4_REJECT_X2M;
+		else if (!strcmp(token, "leda")) param.reject |= UCAC4_REJECT_LEDA;
+		else if (!strcmp(token, "objt")) param.reject_objt |= ~1U;
+		else if (!strncmp(token, "objt=", 5) && sscanf(token + 5, "%d", &val) == 1 && val >= 0) {
+			param.reject_objt |= 1U << (val < 31 ? val : 31);
+		}
+		else {
+			printf ("unknown flag '%s' in --reject-flags %s\n", token, spec);
+			return false;
+		}
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
 	index_param param;
 	char *idxfn = NULL;	// index文件名称
+	const char *catdir = getenv("UCAC4_DIR");	// UCAC4星表根目录
 	int preset = -100;
 
 	init_index_param(param);
 	/* 解析命令行参数 */
-	const char optstr[] = "d:hj:l:m:n:o:p:r:s:u:B:EH:I:L:N:P:R:U:";
+	const char optstr[] = "b:d:hj:l:m:n:o:p:r:s:t:u:B:C:EH:I:L:N:P:R:U:";
+	enum {// 仅有长格式的选项
+		OPT_READER = 256,
+		OPT_BANDS,
+		OPT_CACHE_DIR,
+		OPT_NO_CACHE,
+		OPT_EPOCH,
+		OPT_REJECT_FLAGS,
+		OPT_WRITE_BATCH,
+		OPT_COMPRESS,
+		OPT_TILE_ROWS,
+		OPT_MEM_LIMIT
+	};
+	const struct option longopts[] = {
+		{"threads", required_argument, NULL, 't'},
+		{"catalog", required_argument, NULL, 'C'},
+		{"reader",  required_argument, NULL, OPT_READER},
+		{"bands",   required_argument, NULL, OPT_BANDS},
+		{"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+		{"no-cache",  no_argument,       NULL, OPT_NO_CACHE},
+		{"epoch",     required_argument, NULL, OPT_EPOCH},
+		{"reject-flags", required_argument, NULL, OPT_REJECT_FLAGS},
+		{"write-batch",  required_argument, NULL, OPT_WRITE_BATCH},
+		{"compress",     required_argument, NULL, OPT_COMPRESS},
+		{"tile-rows",    required_argument, NULL, OPT_TILE_ROWS},
+		{"mem-limit",    required_argument, NULL, OPT_MEM_LIMIT},
+		{NULL, 0, NULL, 0}
+	};
+	const char *algor;
+	long long size;
 	int ch;
 
-	while ((ch = getopt(argc, argv, optstr)) != -1) {
+	while ((ch = getopt_long(argc, argv, optstr, longopts, NULL)) != -1) {
 		switch(ch) {
 		case 'h':
 			print_help(argv[0]);
@@ -100,7 +195,13 @@ int main(int argc, char **argv) {
 			break;
 		case 'n': param.sweeps = atoi(optarg);
 			break;
-		case 'o': strcpy(param.output, idxfn);
+		case 'o':
+			if (strlen(optarg) >= sizeof(param.output)) {
+				printf ("output filename '%s' is longer than %d characters\n", optarg, int(sizeof(param.output)) - 1);
+				return -19;
+			}
+			idxfn = optarg;
+			snprintf(param.output, sizeof(param.output), "%s", idxfn);
 			break;
 		case 'p': param.passes = atoi(optarg);
 			break;
@@ -108,6 +209,8 @@ int main(int argc, char **argv) {
 			break;
 		case 's': param.bignside = atoi(optarg);
 			break;
+		case 't': param.nthread = atoi(optarg);
+			break;
 		case 'u': param.qhi = atof(optarg);
 			break;
 		case 'B': param.brightcut = atof(optarg);
@@ -128,6 +231,67 @@ int main(int argc, char **argv) {
 			break;
 		case 'U': param.UNside = atoi(optarg);
 			break;
+		case OPT_READER:
+			if (!strcmp(optarg, "mmap")) param.reader = UCAC4_READ_MMAP;
+			else if (!strcmp(optarg, "fread")) param.reader = UCAC4_READ_FREAD;
+			else if (!strcmp(optarg, "pipeline")) param.reader = UCAC4_READ_PIPELINE;
+			else {
+				printf ("unknown reader '%s', expects mmap, fread or pipeline\n", optarg);
+				return -9;
+			}
+			break;
+		case OPT_BANDS:
+			for (const char* ptr = optarg; *ptr; ++ptr) {
+				int band = band_index(*ptr);
+				if (band >= 0) param.bands |= 1 << band;
+				else if (*ptr != ',') {
+					printf ("unknown band '%c' in --bands %s\n", *ptr, optarg);
+					return -10;
+				}
+			}
+			break;
+		case OPT_CACHE_DIR:
+			if (strlen(optarg) >= sizeof(param.cachedir)) {
+				printf ("cache directory '%s' is longer than %d characters\n", optarg, int(sizeof(param.cachedir)) - 1);
+				return -18;
+			}
+			snprintf(param.cachedir, sizeof(param.cachedir), "%s", optarg);
+			break;
+		case OPT_NO_CACHE: param.usecache = false;
+			break;
+		case 'C': catdir = optarg;
+			break;
+		case OPT_EPOCH: param.epoch = atof(optarg);
+			break;
+		case OPT_REJECT_FLAGS:
+			if (!parse_reject_flags(optarg, param)) return -12;
+			break;
+		case OPT_WRITE_BATCH:
+			if ((size = parse_size(optarg)) < CAT_ROW_BYTES || size > (1 << 30)) {
+				printf ("write batch '%s' should be %d bytes to 1G\n", optarg, CAT_ROW_BYTES);
+				return -14;
+			}
+			param.writebatch = int(size);
+			break;
+		case OPT_COMPRESS:
+			if (!(algor = tbl_compress_algor(optarg))) {
+				printf ("unknown compression '%s', expects rice, gzip or gzip2\n", optarg);
+				return -15;
+			}
+			strcpy(param.compress, algor);
+			break;
+		case OPT_TILE_ROWS:
+			if ((param.tilelen = atol(optarg)) < 1) {
+				printf ("rows per tile '%s' should be positive\n", optarg);
+				return -16;
+			}
+			break;
+		case OPT_MEM_LIMIT:
+			if ((param.memlimit = parse_size(optarg)) < (1 << 20)) {
+				printf ("memory limit '%s' should be at least 1M\n", optarg);
+				return -17;
+			}
+			break;
 		default:
 			break;
 		}
@@ -154,6 +318,18 @@ int main(int argc, char **argv) {
 		printf ("Quad dimension %i exceeds compiled-in max %i\n", param.dimquads, DQMAX);
 		return -5;
 	}
+	if (!catdir || !catdir[0]) {
+		printf ("requires UCAC4 directory by -C or environment variable UCAC4_DIR\n");
+		return -13;
+	}
+	if (param.nthread < 1) {
+		printf ("number of threads %i should be positive\n", param.nthread);
+		return -8;
+	}
+	if (param.epoch != 0. && (param.epoch < 1900. || param.epoch > 2100.)) {
+		printf ("epoch %g is out of range [1900, 2100]\n", param.epoch);
+		return -11;
+	}
 	if (preset > -100) {
 		/* 存疑:
 		 * - hpbase预设值如何确定
@@ -195,8 +371,14 @@ int main(int argc, char **argv) {
 	param.argc = argc;
 	param.argv = argv;
 
-	strcpy (param.pathcat, "/Users/lxm/Catalogue/UCAC4/astindex-0.fit");
-	build_index_files(param);
+	if (!build_ucac4_fits(catdir, param)) {
+		printf ("Failed to build catalog from UCAC4\n");
+		return -20;
+	}
+	if (build_index_files(param)) {
+		printf ("Failed to build index [%s]\n", param.output);
+		return -21;
+	}
 
 	return 0;
 }
@@ -4,22 +4,17 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include "build_index.h"
+#include "cat_index.h"
+#include "uniformize.h"
+#include "occupancy.h"
+#include "healpix.h"
+#include "catcache.h"
+#include "ucac4api.h"
 #include "bl.h"
 
-void init_index_param(index_param& param) {
-	memset(&param, 0, sizeof(index_param));
-	param.filter_band = 1;
-	param.jitter    = 1.0;
-	param.sweeps	= 10;
-	param.passes	= 16;
-	param.Nreuse	= 8;
-	param.Nloosen	= 20;
-	param.dimquads	= 4;
-	param.brightcut	= 0.1;
-	param.bighp		= -1;
-}
-
 int build_index(index_param& p, index_t** p_index, const char* indexfn) {
 //	fitstable_t* uniform;
 
@@ -56,17 +51,81 @@ int build_index(index_param& p, index_t** p_index, const char* indexfn) {
 
     if (!p.UNside) p.UNside = p.Nside;
 
+	// 均匀化: 各网格单元内选取最亮的sweeps颗恒星, 遍次存入starkd->sweep
+	CatBatch uniform;
+	starkd = (startree_t*) calloc(1, sizeof(startree_t));
+	if (!uniformize_catalog(p, uniform, starkd)) {
+		free(starkd);
+		return -1;
+	}
+
+	// 星表K-D树: 入选恒星的单位矢量. 树序到均匀化输出顺序的映射为starkd->tree->perm
+	int nstar = int(uniform.ra.size());
+	double* xyz = (double*) malloc(sizeof(double) * 3 * (nstar ? nstar : 1));
+	const double mas2rad = M_PI / 648000000.;
+	for (int i = 0; i < nstar; ++i) {
+		double alpha = uniform.ra[i] * mas2rad, delta = uniform.spd[i] * mas2rad - M_PI_2;
+		xyz[3 * i]     = cos(delta) * cos(alpha);
+		xyz[3 * i + 1] = cos(delta) * sin(alpha);
+		xyz[3 * i + 2] = sin(delta);
+	}
+	// 量化误差不超过STARTREE_QUANT_ERROR倍jitter: 角秒换算为单位球面上的弦长
+	double maxerr = STARTREE_QUANT_ERROR * p.jitter * M_PI / 648000.;
+	starkd->tree = kdtree_build_quantized(xyz, nstar, 3, STARTREE_NLEAF, maxerr, KD_BUILD_BBOX | KD_BUILD_SPLIT,
+			p.nthread);
+	if (!starkd->tree) {
+		printf ("Failed to build star kdtree over %d stars\n", nstar);
+		free(xyz);
+		free(starkd->sweep);
+		free(starkd);
+		return -1;
+	}
+	if (starkd->tree->data.any == xyz) starkd->tree->free_data = 1;
+	else free(xyz);
+	printf ("star kdtree: %d stars, %d nodes, %s, %.1f MB, quantization error %.2g arcsec\n", nstar,
+			starkd->tree->nnodes, starkd->tree->type == KDTT_DUU ? "u32" : (starkd->tree->type == KDTT_DSS ? "u16" : "double"),
+			kdtree_bytes(starkd->tree) / 1048576.0, kdtree_quantization_error(starkd->tree) * 648000. / M_PI);
+
+	// 占用的像元: 载入导入阶段生成的位图, 留待构建四边形时使用(四边形构建尚未实现)
+	// 位图须与当前中间星表的参数与源文件一致, 否则可能来自以其它条件导入的星表
+	OccupancyMap occupied;
+	if (p.scanoccupied) {
+		char pathocc[PATH_MAX];
+		catcache_header hdr;
+		ucac4_footprint fp;
+		uint64_t catkey(0);
+		bool loaded;
+
+		occupancy_path(p.pathcat, p.Nside, pathocc);
+		ucac4_footprint_init(fp, p);
+		ucac4_cache_header(hdr, p.pathucac4, p, p.filter_band, fp);
+		if (!(loaded = occupied.Load(pathocc, p.Nside, catkey)) || !p.pathucac4[0] || catkey != catcache_key(hdr)) {
+			if (loaded) printf ("Occupancy bitmap [%s] does not match the catalog\n", pathocc);
+			else printf ("Failed to load occupancy bitmap [%s]\n", pathocc);
+			kdtree_free(starkd->tree);
+			free(starkd->sweep);
+			free(starkd);
+			return -1;
+		}
+		printf ("%lld of %lld healpixes at Nside %d are occupied\n", (long long) occupied.Count(),
+				(long long) healpix_npix(p.Nside), p.Nside);
+	}
+
+	kdtree_free(starkd->tree);
+	free(starkd->sweep);
+	free(starkd);
 	return 0;
 }
 
-void build_index_files(index_param& param) {
+int build_index_files(index_param& param) {
 	index_t* index;
 
-	build_index(param, &index, NULL);
+	return build_index(param, &index, NULL);
 }
 
 int merge_index(quadfile_t* quad, codetree_t* code, startree_t* star,
                 const char* indexfn) {
+#if 0	// 依赖的quadfile/codetree/startree/fitstable写出接口尚未移植
     FILE* fout;
     fitstable_t* tag = NULL;
 
@@ -125,4 +184,8 @@ int merge_index(quadfile_t* quad, codetree_t* code, startree_t* star,
         return -1;
     }
     return 0;
+#else
+    printf ("merge_index() is not available: index file writers are not ported yet\n");
+    return -1;
+#endif
 }
@@ -5,16 +5,40 @@
 #ifndef SRC_BUILD_INDEX_H_
 #define SRC_BUILD_INDEX_H_
 
+#include <limits.h>
 #include "codetree.h"
 #include "quadfile.h"
 #include "startree.h"
 
+/*!
+ * @brief UCAC4天区文件读取方式
+ */
+enum {
+	UCAC4_READ_FREAD,	///< fread分块复制到缓冲区后解析
+	UCAC4_READ_MMAP,	///< mmap映射整个文件, 原位解析
+	UCAC4_READ_PIPELINE	///< 读取/解析/写入三级流水线, 各级独立线程
+};
+
+/*!
+ * @brief 解析时剔除的UCAC4质量标志
+ */
+enum {
+	UCAC4_REJECT_CDF  = 0x01,	///< 双星组合标记cdf非0
+	UCAC4_REJECT_X2M  = 0x02,	///< 2MASS扩展源标记x2m非0
+	UCAC4_REJECT_LEDA = 0x04	///< LEDA星系匹配标志leda非0
+};
+
 /*!
  * @struct index_param 生成索引文件的控制参数
  */
 typedef struct {
-	char pathcat[100];	/// 临时FITS星表路径
+	char pathcat[PATH_MAX];	/// 临时FITS星表路径
+	char pathucac4[PATH_MAX];	/// UCAC4根目录, 由build_ucac4_fits()记录, 用于核对占用位图
 	int filter_band;	/// 滤光片波段. 0-4: BVgri; 5-7: JHK
+	int bands;		/// 同时提取的其它波段, 位i对应波段i
+	double epoch;	/// 目标历元, 量纲: 年. 0: 保持星表历元J2000
+	int reject;		/// 剔除的质量标志, UCAC4_REJECT_*的组合
+	unsigned int reject_objt;	/// 剔除的目标类型, 位v对应objt == v; 位31对应objt >= 31
 	double jitter;	// 位置误差阈值; 量纲: arcsec
 
 	// 均匀化
@@ -39,6 +63,14 @@ typedef struct {
 
 	// 常规参数
 	char output[200];	// 输出路径
+	int nthread;		// 星表解析线程数
+	int reader;			// UCAC4文件读取方式
+	bool usecache;		// 是否使用中间星表缓存
+	char cachedir[200];	// 缓存目录. 空: $XDG_CACHE_HOME/astindex或~/.cache/astindex
+	int writebatch;		// 每次写入中间星表的字节数
+	char compress[16];	// 中间星表的分块压缩算法, cfitsio名称. 空: 不压缩
+	long tilelen;		// 分块压缩的每瓦片行数. 0: 自动
+	long long memlimit;	// 均匀化的内存上限, 字节. 0: 不限制. 超出时以外排序方式处理
 	// 命令行参数
 	int argc;
 	char** argv;
@@ -91,11 +123,19 @@ typedef struct {
 
 // 初始化参数
 void init_index_param(index_param& param);
+/*!
+ * @brief 解析字节数, 可带后缀K、M或G(1024进制)
+ * @return
+ * 字节数. 无法识别时返回-1
+ */
+long long parse_size(const char* str);
 /*!
  * @brief 构建索引文件
  * @param param    索引构建参数
+ * @return
+ * 0: 成功; 其它: 失败
  */
-void build_index_files(index_param& param);
+int build_index_files(index_param& param);
 int build_index(index_param& p,
                 index_t** p_index, const char* indexfn);
 int merge_index(quadfile_t* quads, codetree_t* codekd, startree_t* starkd,
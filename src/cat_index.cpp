@@ -0,0 +1,212 @@
+/**
+ * @file cat_index.cpp 定义用来生成索引的星表的接口
+ */
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "cat_index.h"
+#include "tblcomp.h"
+
+static void pack_rows_scalar(const uint32_t* ra, const uint32_t* spd, const short* mag, int n,
+		unsigned char* rows) {
+	uint32_t v32;
+	uint16_t v16;
+
+	for (int i = 0; i < n; ++i, rows += CAT_ROW_BYTES) {
+		v32 = __builtin_bswap32(ra[i]);
+		memcpy(rows, &v32, 4);
+		v32 = __builtin_bswap32(spd[i]);
+		memcpy(rows + 4, &v32, 4);
+		v16 = __builtin_bswap16(uint16_t(mag[i]));
+		memcpy(rows + 8, &v16, 2);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * SSSE3: 每次打包8行(80字节, 5个16字节输出块)
+ * 输入为5个16字节源: ra[0:4], ra[4:8], spd[0:4], spd[4:8], mag[0:8]. 每个输出块由各源经pshufb重排后
+ * 按位或得到, 重排表同时完成大端转换; 不参与的字节以0x80置0
+ */
+static unsigned char pack_shuffle[5][5][16];
+
+static bool init_pack_shuffle() {
+	int p, row, off, src, idx;
+
+	memset(pack_shuffle, 0x80, sizeof(pack_shuffle));
+	for (p = 0; p < 8 * CAT_ROW_BYTES; ++p) {
+		row = p / CAT_ROW_BYTES;
+		off = p % CAT_ROW_BYTES;
+		if (off < 4) {// RA
+			idx = row * 4 + 3 - off;
+			src = idx / 16;
+		}
+		else if (off < 8) {// DEC
+			idx = row * 4 + 7 - off;
+			src = 2 + idx / 16;
+		}
+		else {// Mag
+			idx = row * 2 + 9 - off;
+			src = 4;
+		}
+		pack_shuffle[p / 16][src][p % 16] = (unsigned char) (idx % 16);
+	}
+	return true;
+}
+
+__attribute__((target("ssse3")))
+static void pack_rows_ssse3(const uint32_t* ra, const uint32_t* spd, const short* mag, int n,
+		unsigned char* rows) {
+	static const bool ready = init_pack_shuffle();
+	__m128i src[5], mask, out;
+	int i, k, s;
+
+	(void) ready;
+	for (i = 0; i + 8 <= n; i += 8, rows += 8 * CAT_ROW_BYTES) {
+		src[0] = _mm_loadu_si128((const __m128i*)(ra + i));
+		src[1] = _mm_loadu_si128((const __m128i*)(ra + i + 4));
+		src[2] = _mm_loadu_si128((const __m128i*)(spd + i));
+		src[3] = _mm_loadu_si128((const __m128i*)(spd + i + 4));
+		src[4] = _mm_loadu_si128((const __m128i*)(mag + i));
+		for (k = 0; k < 5; ++k) {
+			out = _mm_setzero_si128();
+			for (s = 0; s < 5; ++s) {
+				mask = _mm_loadu_si128((const __m128i*) pack_shuffle[k][s]);
+				out  = _mm_or_si128(out, _mm_shuffle_epi8(src[s], mask));
+			}
+			_mm_storeu_si128((__m128i*)(rows + k * 16), out);
+		}
+	}
+	if (i < n) pack_rows_scalar(ra + i, spd + i, mag + i, n - i, rows);
+}
+#endif
+
+typedef void (*pack_rows_func)(const uint32_t*, const uint32_t*, const short*, int, unsigned char*);
+
+static pack_rows_func select_pack_rows() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) return pack_rows_ssse3;
+#endif
+	return pack_rows_scalar;
+}
+
+void cat_pack_rows(const uint32_t* ra, const uint32_t* spd, const short* mag, int n, unsigned char* rows) {
+	static const pack_rows_func func = select_pack_rows();
+	func(ra, spd, mag, n, rows);
+}
+
+CatWriter::CatWriter() {
+	nrow  = 0;
+	batch = CAT_WRITE_BATCH / CAT_ROW_BYTES;
+}
+
+void CatWriter::SetBatch(int bytes) {
+	batch = bytes / CAT_ROW_BYTES;
+	if (batch < 1) batch = 1;
+}
+
+CatWriter::~CatWriter() {
+	hfit.Close();
+}
+
+bool CatWriter::Create(const char* filepath, const char* band) {
+	char *ttype3[] = {(char*) "RA", (char*) "DEC", (char*) "Mag"};
+	char *tform3[] = {(char*) "1J", (char*) "1J", (char*) "1I"};
+	char *tunit3[] = {(char*) "mas", (char*) "mas", (char*) "millimag"};
+	char pathname[FLEN_FILENAME];
+
+	nrow = 0;
+	if (snprintf(pathname, sizeof(pathname), "!%s", filepath) >= int(sizeof(pathname))) return false;	// 覆盖已有文件
+	if (!hfit(pathname, 2)) return false;
+	// HDU 1
+	fits_create_img(hfit(), BYTE_IMG, 0, NULL, hfit.Status());
+	fits_write_comment(hfit(),
+			"simplified binary TYCHO2 catalog, just stores RA/DEC and Magnitude, expected to be used for celestial fix. "
+			"including all-sky stars from tycho2 and its' supplementary catalog. "
+			"RA is stored as 32-bit unsigned integer in milli arcsecs. "
+			"DEC is transformed to distance from SOUTH Pole and then stored as 32-bit unsigned ingeter in milli arcsecs. "
+			"Magnitude refers to V band from BT and VT, is stored as 16-bit integer in milli mag.",
+			hfit.Status());
+	fits_write_comment(hfit(),
+			"RA is stored as 32-bit unsigned integer in milli arcsecs. ",
+			hfit.Status());
+	fits_write_comment(hfit(),
+			"DEC is transformed to distance from SOUTH Pole and then stored as 32-bit unsigned ingeter in milli arcsecs. ",
+			hfit.Status());
+	fits_write_comment(hfit(),
+			"Magnitude refers to V band from BT and VT, is stored as 16-bit integer in milli mag.",
+			hfit.Status());
+	// HDU 2: 以0行创建, 写入时由cfitsio扩展
+	fits_create_tbl(hfit(), BINARY_TBL, 0, 3, ttype3, tform3, tunit3, NULL, hfit.Status());
+	if (band) fits_write_key_str(hfit(), "BAND", band, "filter band of Mag", hfit.Status());
+	// 表数据由后台线程写入, 打包下一批时上一批仍在写
+	if (hfit.Success()) hfit.AsyncBegin();
+
+	return hfit.Success();
+}
+
+bool CatWriter::Append(const uint32_t* ra, const uint32_t* spd, const short* mag, int n) {
+	if (!hfit() || !hfit.Success()) return false;
+
+	int i, m;
+	bool rslt(true);
+
+	for (i = 0; i < n && rslt; i += m) {// 写入超出表尾时, cfitsio自动扩展NAXIS2
+		m = n - i < batch ? n - i : batch;
+		rowbuf.resize(m * CAT_ROW_BYTES);	// 换回的缓冲区通常已是同样长度
+		cat_pack_rows(ra + i, spd + i, mag + i, m, &rowbuf[0]);
+		if ((rslt = hfit.WriteTblBytes(nrow + 1, 1, rowbuf))) nrow += m;
+	}
+
+	return rslt;
+}
+
+bool CatReader::Open(const char* filepath, int nthread) {
+	FITSHandler hfit;
+
+	Close();
+	if (!hfit(filepath) || !hfit.MovetoHDU(2)) return false;
+	if (!(tbl_is_compressed(hfit) ? tbl_load_compressed(hfit, map, nthread) : hfit.MapTable(map))) return false;
+	ra  = map.Column<uint32_t>(map.ColumnIndex("RA"));
+	spd = map.Column<uint32_t>(map.ColumnIndex("DEC"));
+	mag = map.Column<short>(map.ColumnIndex("Mag"));
+	if (!ra.valid() || !spd.valid() || !mag.valid()) {
+		Close();
+		return false;
+	}
+	map.AdviseSequential();
+	return true;
+}
+
+void CatReader::Close() {
+	map.Unmap();
+	ra  = FITSColumnView<uint32_t>();
+	spd = FITSColumnView<uint32_t>();
+	mag = FITSColumnView<short>();
+}
+
+void CatReader::Read(long long first, int n, CatBatch& batch) const {
+	int k = batch.size();
+
+	batch.resize(k + n);
+	ra.Copy(first, n, &batch.ra[k]);
+	spd.Copy(first, n, &batch.spd[k]);
+	mag.Copy(first, n, &batch.mag[k]);
+}
+
+bool CatWriter::Close() {
+	if (!hfit()) return false;
+
+	LONGLONG rows(0);
+	bool rslt;
+
+	hfit.AsyncWait();
+	fits_get_num_rowsll(hfit(), &rows, hfit.Status());
+	rslt = hfit.Success() && rows == nrow;
+	if (!hfit.Close()) rslt = false;
+
+	return rslt;
+}
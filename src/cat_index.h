@@ -6,10 +6,152 @@
 #define SRC_CAT_INDEX_H_
 
 #include <stdint.h>
+#include <vector>
+#include "FITSHandler.hpp"
+
+#define CAT_ROW_BYTES	10			//< 二进制表每行字节数: RA(1J), DEC(1J), Mag(1I)
+#define CAT_WRITE_BATCH	1048576		//< 默认每次写入二进制表的字节数
 
 typedef struct {
 	uint32_t ra, spd;	//< 赤经; 南天极距离. 量纲: 毫角秒
 	short mag;		//< 星等. 量纲: 毫星等
 } CatStar;
 
+/*!
+ * @brief 将n颗恒星按二进制表行格式(大端字节序)打包
+ * @param rows 输出: n * CAT_ROW_BYTES字节
+ * @note
+ * 运行时按CPU能力选择SSSE3/标量实现: SSSE3以字节重排同时完成字节序转换与行交织
+ */
+void cat_pack_rows(const uint32_t* ra, const uint32_t* spd, const short* mag, int n, unsigned char* rows);
+
+/*!
+ * @struct CatBatch 按列存储的一批恒星(struct-of-arrays)
+ * 各列直接打包为二进制表行, 无需经过CatStar转换
+ */
+struct CatBatch {
+	std::vector<uint32_t> ra;	//< 赤经. 量纲: 毫角秒
+	std::vector<uint32_t> spd;	//< 南天极距离. 量纲: 毫角秒
+	std::vector<short> mag;		//< 星等. 量纲: 毫星等
+
+public:
+	int size() const {
+		return int(ra.size());
+	}
+
+	void resize(int n) {
+		ra.resize(n);
+		spd.resize(n);
+		mag.resize(n);
+	}
+
+	void reserve(int n) {
+		ra.reserve(n);
+		spd.reserve(n);
+		mag.reserve(n);
+	}
+
+	void clear() {
+		ra.clear();
+		spd.clear();
+		mag.clear();
+	}
+
+	void swap(CatBatch& other) {
+		ra.swap(other.ra);
+		spd.swap(other.spd);
+		mag.swap(other.mag);
+	}
+};
+
+/*!
+ * @struct CatWriter 以流方式将恒星追加到FITS二进制表
+ * - 以0行创建二进制表, 每次Append()在表尾追加
+ * - NAXIS2在关闭HDU时按实际写入行数修正, 无需预先统计总数
+ * - 各列在内存中打包为大端字节序的行, 以fits_write_tblbytes整块写入, 不经cfitsio逐列转换
+ * - 由FITSHandler的后台线程写入, 写入错误在Close()时返回
+ */
+struct CatWriter {
+protected:
+	FITSHandler hfit;	//< FITS文件
+	long long nrow;		//< 已写入行数
+	int batch;			//< 每次写入的行数
+	std::vector<unsigned char> rowbuf;	//< 行打包缓冲区
+
+public:
+	CatWriter();
+	virtual ~CatWriter();
+	/*!
+	 * @brief 创建FITS文件, 写入主HDU说明及空二进制表
+	 * @param filepath 文件路径
+	 * @param band     星等波段名称, 非空时写入二进制表的BAND关键字
+	 * @return
+	 * 操作结果
+	 */
+	bool Create(const char* filepath, const char* band = NULL);
+	/*!
+	 * @brief 设置每次写入二进制表的字节数, 按整行取整. 可与文件系统条带大小匹配
+	 */
+	void SetBatch(int bytes);
+	/*!
+	 * @brief 在表尾追加n颗恒星
+	 * @param ra  赤经列
+	 * @param spd 南天极距离列
+	 * @param mag 星等列
+	 */
+	bool Append(const uint32_t* ra, const uint32_t* spd, const short* mag, int n);
+	bool Append(const CatBatch& batch) {
+		return batch.size() == 0
+				|| Append(&batch.ra[0], &batch.spd[0], &batch.mag[0], batch.size());
+	}
+	/*!
+	 * @brief 结束写入并关闭文件
+	 * @return
+	 * 写入过程无错误且表行数与写入量一致时返回true
+	 */
+	bool Close();
+	/*!
+	 * @brief 已写入行数
+	 */
+	long long Rows() const {
+		return nrow;
+	}
+	const char* GetError() {
+		return hfit.GetError();
+	}
+};
+
+/*!
+ * @struct CatReader 以mmap方式只读访问中间星表
+ * - 映射第2个HDU的二进制表数据区, 按列名RA/DEC/Mag取得列视图
+ * - 访问时转换字节序, 不经cfitsio缓冲区
+ * - 分块压缩的表在打开时并行解压到内存, 之后访问方式相同
+ */
+struct CatReader {
+protected:
+	FITSTableMap map;	//< 数据区映射
+
+public:
+	FITSColumnView<uint32_t> ra;	//< 赤经. 量纲: 毫角秒
+	FITSColumnView<uint32_t> spd;	//< 南天极距离. 量纲: 毫角秒
+	FITSColumnView<short> mag;		//< 星等. 量纲: 毫星等
+
+public:
+	/*!
+	 * @brief 打开并映射中间星表
+	 * @param nthread 解压分块压缩表的线程数
+	 * @return
+	 * 文件无法打开, 不是二进制表, 解压失败或缺少所需列时返回false
+	 */
+	bool Open(const char* filepath, int nthread = 1);
+	void Close();
+	long long Rows() const {
+		return ra.size();
+	}
+	/*!
+	 * @brief 将[first, first + n)行追加到batch
+	 */
+	void Read(long long first, int n, CatBatch& batch) const;
+};
+
 #endif /* SRC_CAT_INDEX_H_ */
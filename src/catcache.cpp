@@ -0,0 +1,197 @@
+/**
+ * @file catcache.cpp 定义中间星表缓存文件的接口
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "catcache.h"
+
+#define CATCACHE_ALIGN	4096	//< 列起始位置对齐, 量纲: 字节
+
+/*!
+ * @brief 文件头中决定缓存能否复用的部分的长度
+ */
+static inline size_t key_length() {
+	return offsetof(catcache_header, capacity);
+}
+
+/*!
+ * @brief 文件头中参数部分的起始位置
+ */
+static inline size_t key_offset() {
+	return offsetof(catcache_header, band);
+}
+
+uint64_t catcache_key(const catcache_header& hdr) {// FNV-1a
+	const unsigned char* ptr = (const unsigned char*) &hdr;
+	uint64_t key = 14695981039346656037ULL;
+
+	for (size_t i = key_offset(); i < key_length(); ++i) {
+		key ^= ptr[i];
+		key *= 1099511628211ULL;
+	}
+	return key;
+}
+
+bool catcache_path(const char* dir, const catcache_header& hdr, char* filepath) {
+	return snprintf(filepath, PATH_MAX, "%s/astcache-%016llx.cat", dir,
+			(unsigned long long) catcache_key(hdr)) < PATH_MAX;
+}
+
+static inline int64_t align_up(int64_t n) {
+	return (n + CATCACHE_ALIGN - 1) / CATCACHE_ALIGN * CATCACHE_ALIGN;
+}
+
+/*!
+ * @brief 写入完整的缓冲区
+ */
+static bool pwrite_all(int fd, const void* buff, size_t n, int64_t offset) {
+	const char* ptr = (const char*) buff;
+	ssize_t nwrite;
+
+	while (n > 0) {
+		if ((nwrite = pwrite(fd, ptr, n, offset)) <= 0) return false;
+		ptr    += nwrite;
+		offset += nwrite;
+		n      -= nwrite;
+	}
+	return true;
+}
+
+CatCacheWriter::CatCacheWriter() {
+	fd = -1;
+	memset(&hdr, 0, sizeof(hdr));
+}
+
+CatCacheWriter::~CatCacheWriter() {
+	Abort();
+}
+
+bool CatCacheWriter::Create(const char* filepath, const catcache_header& header) {
+	Abort();
+	hdr = header;
+	memcpy(hdr.magic, CATCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version   = CATCACHE_VERSION;
+	hdr.byteorder = 0x01020304;
+	hdr.nrow      = 0;
+	hdr.complete  = 0;
+	hdr.offset[0] = CATCACHE_HEADER;
+	hdr.offset[1] = align_up(hdr.offset[0] + hdr.capacity * sizeof(uint32_t));
+	hdr.offset[2] = align_up(hdr.offset[1] + hdr.capacity * sizeof(uint32_t));
+
+	if (snprintf(this->filepath, sizeof(this->filepath), "%s", filepath) >= int(sizeof(this->filepath)))
+		return false;
+	snprintf(pathtmp, sizeof(pathtmp), "%s.%d", filepath, int(getpid()));
+	if ((fd = open(pathtmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return false;
+	// 预留完整长度, 未写入部分为文件空洞
+	if (ftruncate(fd, hdr.offset[2] + hdr.capacity * sizeof(short))) {
+		Abort();
+		return false;
+	}
+	return true;
+}
+
+bool CatCacheWriter::Append(const CatBatch& batch) {
+	int n = batch.size();
+
+	if (fd < 0) return false;
+	if (n == 0) return true;
+	if (hdr.nrow + n > hdr.capacity) {
+		Abort();
+		return false;
+	}
+	if (!pwrite_all(fd, &batch.ra[0],  n * sizeof(uint32_t), hdr.offset[0] + hdr.nrow * sizeof(uint32_t))
+			|| !pwrite_all(fd, &batch.spd[0], n * sizeof(uint32_t), hdr.offset[1] + hdr.nrow * sizeof(uint32_t))
+			|| !pwrite_all(fd, &batch.mag[0], n * sizeof(short), hdr.offset[2] + hdr.nrow * sizeof(short))) {
+		Abort();
+		return false;
+	}
+	hdr.nrow += n;
+	return true;
+}
+
+bool CatCacheWriter::Close() {
+	if (fd < 0) return false;
+
+	char header[CATCACHE_HEADER];
+	bool rslt;
+
+	hdr.complete = 1;
+	memset(header, 0, sizeof(header));
+	memcpy(header, &hdr, sizeof(hdr));
+	rslt = pwrite_all(fd, header, sizeof(header), 0) && !fsync(fd);
+	rslt = !close(fd) && rslt;
+	fd = -1;
+	if (rslt) rslt = !rename(pathtmp, filepath);
+	if (!rslt) remove(pathtmp);
+	return rslt;
+}
+
+void CatCacheWriter::Abort() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+		remove(pathtmp);
+	}
+}
+
+CatCache::CatCache() {
+	addr = NULL;
+	size = 0;
+	ra   = spd = NULL;
+	mag  = NULL;
+	memset(&hdr, 0, sizeof(hdr));
+}
+
+CatCache::~CatCache() {
+	Close();
+}
+
+bool CatCache::Open(const char* filepath, const catcache_header& expect) {
+	struct stat st;
+	int fd;
+
+	Close();
+	if ((fd = open(filepath, O_RDONLY)) < 0) return false;
+	if (fstat(fd, &st) || st.st_size < CATCACHE_HEADER
+			|| pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)) {
+		close(fd);
+		return false;
+	}
+	// 校验: 格式, 参数, 源文件与完整性
+	if (memcmp(hdr.magic, CATCACHE_MAGIC, sizeof(hdr.magic))
+			|| hdr.version != CATCACHE_VERSION || hdr.byteorder != 0x01020304
+			|| memcmp((const char*) &hdr + key_offset(), (const char*) &expect + key_offset(),
+					key_length() - key_offset())
+			|| !hdr.complete || hdr.nrow < 0 || hdr.nrow > hdr.capacity
+			|| st.st_size < hdr.offset[2] + int64_t(hdr.nrow * sizeof(short))) {
+		close(fd);
+		return false;
+	}
+
+	size = st.st_size;
+	addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		addr = NULL;
+		return false;
+	}
+	madvise(addr, size, MADV_SEQUENTIAL);
+	ra  = (const uint32_t*) ((const char*) addr + hdr.offset[0]);
+	spd = (const uint32_t*) ((const char*) addr + hdr.offset[1]);
+	mag = (const short*) ((const char*) addr + hdr.offset[2]);
+	return true;
+}
+
+void CatCache::Close() {
+	if (addr) munmap(addr, size);
+	addr = NULL;
+	size = 0;
+	ra   = spd = NULL;
+	mag  = NULL;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file catcache.h 声明中间星表缓存文件的数据结构和接口
+ * @note
+ * 缓存文件格式:
+ * - 文件头: catcache_header, 占用CATCACHE_HEADER字节
+ * - 列: 赤经(uint32_t), 南天极距离(uint32_t), 星等(short), 各列起始位置按页对齐
+ * - 以本机字节序存储, 可直接mmap后按列访问
+ * - 各列按容量预留空间, 实际行数小于容量时剩余部分为文件空洞
+ */
+
+#ifndef SRC_CATCACHE_H_
+#define SRC_CATCACHE_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include "cat_index.h"
+
+#define CATCACHE_MAGIC		"ASTICACH"
+#define CATCACHE_VERSION	3
+#define CATCACHE_HEADER		4096	//< 文件头占用空间, 量纲: 字节
+
+/*!
+ * @struct catcache_header 缓存文件头
+ * 从band到srcsum的内容决定缓存是否可复用. 填写前应以0初始化
+ */
+typedef struct {
+	char magic[8];		//< CATCACHE_MAGIC
+	uint32_t version;	//< CATCACHE_VERSION
+	uint32_t byteorder;	//< 0x01020304, 以本机字节序写入
+	int32_t band;		//< 星等波段索引
+	int32_t brightcut;	//< 亮端截断, 量纲: 毫星等
+	int32_t zone0, zone1;	//< 天区范围
+	int32_t nra;			//< 赤经区间数量
+	uint32_t ra0[2], ra1[2];	//< 赤经区间, 量纲: 毫角秒
+	int32_t epoch;		//< 目标历元, 量纲: 0.001年. 0: 星表历元J2000
+	int32_t reject;		//< 剔除的质量标志
+	uint32_t reject_objt;	//< 剔除的目标类型
+	int32_t bignside, bighp;	//< 解析阶段限定的大像元. rgnside为0时不限定
+	int32_t rgnside;	//< 判定边缘所用的细网格
+	int32_t margin;		//< 边缘扩展的细网格像元数
+	uint64_t srcsum;	//< 源文件校验和: 各天区文件大小与修改时间
+	int64_t capacity;	//< 各列容量, 不小于源记录总数
+	int64_t nrow;		//< 行数
+	int64_t offset[3];	//< 各列在文件中的起始位置
+	int32_t complete;	//< 写入完成标志
+} catcache_header;
+
+/*!
+ * @brief 由文件头中参数部分计算64位键值, 用于构造缓存文件名
+ */
+uint64_t catcache_key(const catcache_header& hdr);
+/*!
+ * @brief 缓存文件路径: <dir>/astcache-<键值>.cat
+ * @param filepath 输出: 路径, 长度为PATH_MAX
+ * @return
+ * 路径超出PATH_MAX时返回false
+ */
+bool catcache_path(const char* dir, const catcache_header& hdr, char* filepath);
+
+/*!
+ * @struct CatCacheWriter 以流方式写入缓存文件
+ * 写入临时文件, Close()时补写文件头后改名, 中断的写入不会留下可用的缓存
+ */
+struct CatCacheWriter {
+protected:
+	catcache_header hdr;
+	char filepath[PATH_MAX];	//< 缓存文件路径
+	char pathtmp[PATH_MAX + 16];	//< 临时文件路径
+	int fd;
+
+public:
+	CatCacheWriter();
+	virtual ~CatCacheWriter();
+	/*!
+	 * @brief 创建缓存文件
+	 * @param filepath 文件路径
+	 * @param header   参数部分及capacity已填写的文件头
+	 */
+	bool Create(const char* filepath, const catcache_header& header);
+	bool Append(const CatBatch& batch);
+	bool Close();
+	/*!
+	 * @brief 放弃写入, 删除临时文件
+	 */
+	void Abort();
+};
+
+/*!
+ * @struct CatCache 以mmap方式只读访问缓存文件
+ */
+struct CatCache {
+protected:
+	void* addr;		//< 映射地址
+	size_t size;	//< 映射长度
+
+public:
+	catcache_header hdr;
+	const uint32_t* ra;
+	const uint32_t* spd;
+	const short* mag;
+
+public:
+	CatCache();
+	virtual ~CatCache();
+	/*!
+	 * @brief 打开缓存文件并校验
+	 * @param expect 期望的文件头参数部分
+	 * @return
+	 * 文件存在, 完整且参数与expect一致时返回true
+	 */
+	bool Open(const char* filepath, const catcache_header& expect);
+	void Close();
+	int64_t Rows() const {
+		return hdr.nrow;
+	}
+};
+
+#endif /* SRC_CATCACHE_H_ */
@@ -2,6 +2,31 @@
  * @file codetree.cpp 定义codetree接口
  */
 
+#include <stdlib.h>
 #include "codetree.h"
 
+double codetree_tolerance(double jitter, double qlo) {
+	// 编码以四边形的对角恒星距离归一化, 位置误差按该距离缩放
+	return qlo > 0.0 ? jitter / (qlo * 60.0) : jitter;
+}
 
+codetree_t* codetree_build(double* codes, int N, int dimcodes, double tolerance, int nthread) {
+	codetree_t* codekd = (codetree_t*) calloc(1, sizeof(codetree_t));
+
+	codekd->tree = kdtree_build_quantized(codes, N, dimcodes, CODETREE_NLEAF, CODETREE_QUANT_ERROR * tolerance,
+			KD_BUILD_BBOX | KD_BUILD_SPLIT, nthread);
+	if (!codekd->tree) {
+		free(codekd);
+		return NULL;
+	}
+	if (codekd->tree->data.any == codes) codekd->tree->free_data = 1;
+	else free(codes);
+	return codekd;
+}
+
+void codetree_free(codetree_t* codekd) {
+	if (!codekd) return;
+	kdtree_free(codekd->tree);
+	free(codekd->invperm);
+	free(codekd);
+}
@@ -7,11 +7,26 @@
 
 #include "kdtree.h"
 
+#define CODETREE_NLEAF	25		//< 四边形编码K-D树叶节点的平均编码数
+#define CODETREE_QUANT_ERROR	0.01	//< 量化误差上限与编码容差之比. 通常为u16
+
 typedef struct {
 	kdtree_t*	tree;
 	int*		invperm;
 } codetree_t;
 
-
+/*!
+ * @brief 编码容差: 恒星位置误差jitter在最小尺度qlo的四边形中引起的编码误差
+ * @param jitter 量纲: 角秒
+ * @param qlo    量纲: 角分
+ */
+double codetree_tolerance(double jitter, double qlo);
+/*!
+ * @brief 构建四边形编码K-D树. 量化误差不超过CODETREE_QUANT_ERROR倍编码容差
+ * @param codes    N个dimcodes维编码, 由malloc分配. 由编码树接管: 量化时释放, 否则作为树的数据点
+ * @param dimcodes 编码维数: 2 * (dimquads - 2)
+ */
+codetree_t* codetree_build(double* codes, int N, int dimcodes, double tolerance, int nthread);
+void codetree_free(codetree_t* codekd);
 
 #endif /* SRC_CODETREE_H_ */
@@ -0,0 +1,647 @@
+/**
+ * @file healpix.cpp 定义HEALPix像元几何接口
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_set>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "healpix.h"
+
+using std::vector;
+
+#define HP_PI		3.14159265358979323846
+#define HP_TWOPI	6.28318530717958647693
+#define HP_HALFPI	1.57079632679489661923
+
+static const int jrll[12] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};	//< 基础面南角所在环号/nside
+static const int jpll[12] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};	//< 基础面南角经度/(π/4)
+
+/*!
+ * @brief 抽取64位整数的偶数位
+ */
+static inline int compress_bits(int64_t v) {
+	uint64_t x = uint64_t(v) & 0x5555555555555555ULL;
+	x = (x | (x >> 1))  & 0x3333333333333333ULL;
+	x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x >> 4))  & 0x00FF00FF00FF00FFULL;
+	x = (x | (x >> 8))  & 0x0000FFFF0000FFFFULL;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+	return int(x);
+}
+
+void healpix_nest2xyf(int nside, int64_t pix, int& ix, int& iy, int& face) {
+	int64_t npface = int64_t(nside) * nside;
+	int64_t ipf;
+
+	face = int(pix / npface);
+	ipf  = pix % npface;
+	ix   = compress_bits(ipf);
+	iy   = compress_bits(ipf >> 1);
+}
+
+/*!
+ * @brief 将32位整数的各位分散到64位整数的偶数位
+ */
+static inline int64_t spread_bits(int v) {
+	uint64_t x = uint32_t(v);
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2))  & 0x3333333333333333ULL;
+	x = (x | (x << 1))  & 0x5555555555555555ULL;
+	return int64_t(x);
+}
+
+/*!
+ * @brief 整数平方根, 向下取整
+ */
+static inline int64_t isqrt(int64_t v) {
+	int64_t r = int64_t(sqrt(double(v) + 0.5));
+	while (r * r > v) --r;
+	while ((r + 1) * (r + 1) <= v) ++r;
+	return r;
+}
+
+int64_t healpix_xyf2nest(int nside, int ix, int iy, int face) {
+	return int64_t(face) * nside * nside + spread_bits(ix) + (spread_bits(iy) << 1);
+}
+
+void healpix_ring2xyf(int nside, int64_t pix, int& ix, int& iy, int& face) {
+	int64_t ns = nside, nl2 = 2 * ns, ncap = 2 * ns * (ns - 1), npix = 12 * ns * ns;
+	int64_t iring, iphi, kshift, nr, irt, ipt;
+
+	if (pix < ncap) {// 北极冠
+		iring  = (1 + isqrt(1 + 2 * pix)) >> 1;
+		iphi   = (pix + 1) - 2 * iring * (iring - 1);
+		kshift = 0;
+		nr     = iring;
+		face   = int((iphi - 1) / nr);
+	}
+	else if (pix < npix - ncap) {// 赤道带
+		int64_t ip  = pix - ncap;
+		int64_t tmp = ip / (4 * ns);
+		int64_t ire = tmp + 1, irm = nl2 + 1 - tmp;
+		int64_t ifm, ifp;
+
+		iring  = tmp + ns;
+		iphi   = ip - tmp * 4 * ns + 1;
+		kshift = (iring + ns) & 1;
+		nr     = ns;
+		ifm    = (iphi - (ire >> 1) + ns - 1) / ns;
+		ifp    = (iphi - (irm >> 1) + ns - 1) / ns;
+		face   = int(ifp == ifm ? (ifp | 4) : (ifp < ifm ? ifp : ifm + 8));
+	}
+	else {// 南极冠
+		int64_t ip = npix - pix;
+		iring  = (1 + isqrt(2 * ip - 1)) >> 1;
+		iphi   = 4 * iring + 1 - (ip - 2 * iring * (iring - 1));
+		kshift = 0;
+		nr     = iring;
+		iring  = 2 * nl2 - iring;
+		face   = int((iphi - 1) / nr + 8);
+	}
+
+	irt = iring - (2 + (face >> 2)) * ns + 1;
+	ipt = 2 * iphi - jpll[face] * nr - kshift - 1;
+	if (ipt >= nl2) ipt -= 8 * ns;
+	ix = int((ipt - irt) >> 1);
+	iy = int((-ipt - irt) >> 1);
+}
+
+int64_t healpix_xyf2ring(int nside, int ix, int iy, int face) {
+	int64_t ns = nside, nl4 = 4 * ns;
+	int64_t jr = jrll[face] * ns - ix - iy - 1;
+	int64_t nr, kshift, nbefore, jp;
+
+	if (jr < ns) {// 北极冠
+		nr      = jr;
+		nbefore = 2 * nr * (nr - 1);
+		kshift  = 0;
+	}
+	else if (jr > 3 * ns) {// 南极冠
+		nr      = nl4 - jr;
+		nbefore = 12 * ns * ns - 2 * (nr + 1) * nr;
+		kshift  = 0;
+	}
+	else {// 赤道带
+		nr      = ns;
+		nbefore = 2 * ns * (ns - 1) + (jr - ns) * nl4;
+		kshift  = (jr - ns) & 1;
+	}
+
+	jp = (jpll[face] * nr + ix - iy + 1 + kshift) / 2;
+	if (jp > nl4) jp -= nl4;
+	else if (jp < 1) jp += nl4;
+	return nbefore + jp - 1;
+}
+
+int64_t healpix_nest2ring(int nside, int64_t pix) {
+	int ix, iy, face;
+	healpix_nest2xyf(nside, pix, ix, iy, face);
+	return healpix_xyf2ring(nside, ix, iy, face);
+}
+
+int64_t healpix_ring2nest(int nside, int64_t pix) {
+	int ix, iy, face;
+	healpix_ring2xyf(nside, pix, ix, iy, face);
+	return healpix_xyf2nest(nside, ix, iy, face);
+}
+
+void healpix_xyf2loc(double x, double y, int face, double& z, double& phi) {
+	double jr = jrll[face] - x - y;
+	double nr, tmp;
+
+	if (jr < 1) {// 北极冠
+		nr  = jr;
+		z   = 1 - nr * nr / 3.;
+	}
+	else if (jr > 3) {// 南极冠
+		nr  = 4 - jr;
+		z   = nr * nr / 3. - 1;
+	}
+	else {// 赤道带
+		nr  = 1;
+		z   = (2 - jr) * 2. / 3.;
+	}
+
+	tmp = jpll[face] * nr + x - y;
+	if (tmp < 0)  tmp += 8;
+	if (tmp >= 8) tmp -= 8;
+	phi = nr < 1E-15 ? 0 : (0.5 * HP_HALFPI * tmp) / nr;
+}
+
+void healpix_nest_bound(int nside, int64_t pix, double pad, healpix_bound& bound) {
+	const int nstep = 32;	// 每条边的采样数
+	double x0, y0, x, y, z, phi, zmin(1), zmax(-1), cosmax, phipad, gap, width;
+	double phis[4 * nstep];
+	int ix, iy, face, i, k, n(0);
+	bool pole(false);
+
+	healpix_nest2xyf(nside, pix, ix, iy, face);
+	x0 = double(ix) / nside;
+	y0 = double(iy) / nside;
+	for (k = 0; k < 4; ++k) {// 逆时针沿4条边采样
+		for (i = 0; i < nstep; ++i) {
+			double t = double(i) / nstep;
+			if (k == 0)      { x = x0 + t / nside; y = y0; }
+			else if (k == 1) { x = x0 + 1. / nside; y = y0 + t / nside; }
+			else if (k == 2) { x = x0 + (1 - t) / nside; y = y0 + 1. / nside; }
+			else             { x = x0; y = y0 + (1 - t) / nside; }
+			healpix_xyf2loc(x, y, face, z, phi);
+			if (z < zmin) zmin = z;
+			if (z > zmax) zmax = z;
+			if (fabs(z) > 1 - 1E-12) pole = true;	// 极点位于像元顶点, 经度无意义
+			else phis[n++] = phi;
+		}
+	}
+
+	// 采样点之间的弦高误差远小于相邻采样点间距
+	pad += 1. / (nside * nstep);
+	bound.declo = asin(zmin) - pad;
+	bound.dechi = asin(zmax) + pad;
+	bound.allra = pole;
+	if (bound.declo <= -HP_HALFPI) { bound.declo = -HP_HALFPI; bound.allra = true; }
+	if (bound.dechi >=  HP_HALFPI) { bound.dechi =  HP_HALFPI; bound.allra = true; }
+	bound.ralo = 0;
+	bound.rahi = HP_TWOPI;
+	if (bound.allra || n == 0) {
+		bound.allra = true;
+		return;
+	}
+
+	// 赤经范围: 排序后去掉最大的相邻间隔, 剩余部分即覆盖全部采样点的最短弧
+	cosmax = cos(std::max(fabs(bound.declo), fabs(bound.dechi)));
+	phipad = pad / cosmax;
+	std::sort(phis, phis + n);
+	gap = phis[0] + HP_TWOPI - phis[n - 1];
+	k = 0;
+	for (i = 1; i < n; ++i) {
+		if (phis[i] - phis[i - 1] > gap) {
+			gap = phis[i] - phis[i - 1];
+			k = i;
+		}
+	}
+	width = HP_TWOPI - gap + 2 * phipad;
+	if (width >= HP_TWOPI) {
+		bound.allra = true;
+		return;
+	}
+	bound.ralo = phis[k] - phipad;
+	if (bound.ralo < 0) bound.ralo += HP_TWOPI;
+	bound.rahi = bound.ralo + width;
+	if (bound.rahi >= HP_TWOPI) bound.rahi -= HP_TWOPI;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 位置与像元的转换. 位置以毫角秒整数表示 */
+#define HP_MAS90	324000000	//< 90度对应的毫角秒
+#define HP_MAS360	1296000000	//< 360度对应的毫角秒
+#define HP_NCOEF	11
+
+static const double hp_sin_coef[HP_NCOEF] = {// sin(y)/y的Taylor系数, 按y^2降幂排列. 在[0, π/2]内误差小于1E-17
+	1.0 / 51090942171709440000., -1.0 / 121645100408832000., 1.0 / 355687428096000., -1.0 / 1307674368000.,
+	1.0 / 6227020800., -1.0 / 39916800., 1.0 / 362880., -1.0 / 5040., 1.0 / 120., -1.0 / 6., 1.0
+};
+static const double HP_MAS2RAD = HP_PI / (2. * HP_MAS90);
+
+/*!
+ * @brief 计算sin(y), y∈[0, π/2]
+ * @note
+ * 多项式与AVX2实现的运算顺序一致, 保证结果逐位相同
+ */
+static inline double hp_sin(double y) {
+	double y2 = y * y, c = hp_sin_coef[0];
+	for (int k = 1; k < HP_NCOEF; ++k) c = c * y2 + hp_sin_coef[k];
+	return c * y;
+}
+
+/*!
+ * @brief 由定位参数计算像元编号
+ * @param tt    赤经 / 90°, [0, 4)
+ * @param jp    赤道带: 沿升序对角线的坐标; 极冠: 沿经线方向的坐标, 截断为整数
+ * @param jm    赤道带: 沿降序对角线的坐标; 极冠: 沿纬线方向的坐标, 截断为整数
+ * @param eq    位于赤道带, |z| <= 2/3
+ * @param south 位于南半球
+ */
+static inline int64_t hp_loc2pix(int nside, int scheme, double tt, int jp, int jm, bool eq, bool south) {
+	int64_t ns = nside, ir, ip;
+
+	if (eq) {
+		if (scheme == HEALPIX_RING) {
+			ir = ns + 1 + jp - jm;	// [1, 2 * nside + 1]
+			ip = ((jp + jm - ns + (1 - (ir & 1)) + 1 + 8 * ns) >> 1) % (4 * ns);
+			return 2 * ns * (ns - 1) + (ir - 1) * 4 * ns + ip;
+		}
+		int ifp = jp / nside, ifm = jm / nside;
+		int face = ifp == ifm ? (ifp | 4) : (ifp < ifm ? ifp : ifm + 8);
+		return healpix_xyf2nest(nside, jm % nside, nside - jp % nside - 1, face);
+	}
+
+	if (scheme == HEALPIX_RING) {
+		ir = int64_t(jp) + jm + 1;	// 自最近极点起算的环号
+		ip = int64_t(tt * ir);		// [0, 4 * ir)
+		return south ? 12 * ns * ns - 2 * ir * (ir + 1) + ip : 2 * ir * (ir - 1) + ip;
+	}
+	int ntt = int(tt);
+	if (jp > nside - 1) jp = nside - 1;
+	if (jm > nside - 1) jm = nside - 1;
+	return south ? healpix_xyf2nest(nside, jp, jm, ntt + 8)
+			: healpix_xyf2nest(nside, nside - jm - 1, nside - jp - 1, ntt);
+}
+
+int64_t healpix_mas2pix(int nside, int scheme, uint32_t ra, uint32_t spd) {
+	int dec  = int(spd) - HP_MAS90;
+	int adec = dec < 0 ? -dec : dec;
+	double tt = double(int(ra >= HP_MAS360 ? ra - HP_MAS360 : ra)) / HP_MAS90;
+	double za = hp_sin(adec * HP_MAS2RAD);	// |sin(赤纬)|
+	double x1, x2;
+	bool eq = za <= 2. / 3.;
+
+	if (eq) {
+		double temp1 = nside * (0.5 + tt);
+		double temp2 = nside * (dec < 0 ? -za : za) * 0.75;
+		x1 = temp1 - temp2;
+		x2 = temp1 + temp2;
+	}
+	else {// 以sin(极距)代替sqrt(3 * (1 - |z|)), 极点附近不损失精度
+		double sth = hp_sin((HP_MAS90 - adec) * HP_MAS2RAD);
+		double tmp = nside * sth / sqrt((1. + za) / 3.);
+		double tp  = tt - floor(tt);
+		x1 = tp * tmp;
+		x2 = (1. - tp) * tmp;
+	}
+	return hp_loc2pix(nside, scheme, tt, int(x1), int(x2), eq, dec < 0);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline __m256d hp_sin_avx2(__m256d y) {
+	__m256d y2 = _mm256_mul_pd(y, y);
+	__m256d c  = _mm256_set1_pd(hp_sin_coef[0]);
+	for (int k = 1; k < HP_NCOEF; ++k) c = _mm256_add_pd(_mm256_mul_pd(c, y2), _mm256_set1_pd(hp_sin_coef[k]));
+	return _mm256_mul_pd(c, y);
+}
+
+/*!
+ * @brief AVX2实现: 每次4颗恒星, 浮点运算与标量实现逐项对应; 两种区域都计算后按|z|选择
+ */
+__attribute__((target("avx2")))
+static void mas2pix_avx2(int nside, int scheme, const uint32_t* ra, const uint32_t* spd, int n, int64_t* pix) {
+	const __m256d vns    = _mm256_set1_pd(double(nside));
+	const __m256d vmas90 = _mm256_set1_pd(double(HP_MAS90));
+	const __m256d vscale = _mm256_set1_pd(HP_MAS2RAD);
+	const __m256d vtwo3  = _mm256_set1_pd(2. / 3.);
+	const __m256d vhalf  = _mm256_set1_pd(0.5);
+	const __m256d v075   = _mm256_set1_pd(0.75);
+	const __m256d vone   = _mm256_set1_pd(1.);
+	const __m256d vthree = _mm256_set1_pd(3.);
+	const __m256d vzero  = _mm256_setzero_pd();
+	const __m256d vsign  = _mm256_set1_pd(-0.);
+	const __m128i imas90  = _mm_set1_epi32(HP_MAS90);
+	const __m128i imas360 = _mm_set1_epi32(HP_MAS360);
+	alignas(32) double tt[4];
+	alignas(16) int jp[4], jm[4];
+	int i, k, meq, msouth;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i r    = _mm_loadu_si128((const __m128i*) (ra + i));
+		__m128i dec  = _mm_sub_epi32(_mm_loadu_si128((const __m128i*) (spd + i)), imas90);
+		__m128i adec = _mm_abs_epi32(dec);
+		r = _mm_sub_epi32(r, _mm_and_si128(_mm_cmpgt_epi32(r, _mm_set1_epi32(HP_MAS360 - 1)), imas360));
+
+		__m256d vtt   = _mm256_div_pd(_mm256_cvtepi32_pd(r), vmas90);
+		__m256d za    = hp_sin_avx2(_mm256_mul_pd(_mm256_cvtepi32_pd(adec), vscale));
+		__m256d sth   = hp_sin_avx2(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm_sub_epi32(imas90, adec)), vscale));
+		__m256d south = _mm256_cmp_pd(_mm256_cvtepi32_pd(dec), vzero, _CMP_LT_OQ);
+		__m256d eq    = _mm256_cmp_pd(za, vtwo3, _CMP_LE_OQ);
+		__m256d z     = _mm256_blendv_pd(za, _mm256_xor_pd(za, vsign), south);
+		// 赤道带
+		__m256d temp1 = _mm256_mul_pd(vns, _mm256_add_pd(vhalf, vtt));
+		__m256d temp2 = _mm256_mul_pd(_mm256_mul_pd(vns, z), v075);
+		// 极冠
+		__m256d tmp = _mm256_div_pd(_mm256_mul_pd(vns, sth), _mm256_sqrt_pd(_mm256_div_pd(_mm256_add_pd(vone, za), vthree)));
+		__m256d tp  = _mm256_sub_pd(vtt, _mm256_floor_pd(vtt));
+		__m256d x1  = _mm256_blendv_pd(_mm256_mul_pd(tp, tmp), _mm256_sub_pd(temp1, temp2), eq);
+		__m256d x2  = _mm256_blendv_pd(_mm256_mul_pd(_mm256_sub_pd(vone, tp), tmp), _mm256_add_pd(temp1, temp2), eq);
+
+		_mm256_store_pd(tt, vtt);
+		_mm_store_si128((__m128i*) jp, _mm256_cvttpd_epi32(x1));
+		_mm_store_si128((__m128i*) jm, _mm256_cvttpd_epi32(x2));
+		meq    = _mm256_movemask_pd(eq);
+		msouth = _mm256_movemask_pd(south);
+		for (k = 0; k < 4; ++k)
+			pix[i + k] = hp_loc2pix(nside, scheme, tt[k], jp[k], jm[k], (meq >> k) & 1, (msouth >> k) & 1);
+	}
+	for (; i < n; ++i) pix[i] = healpix_mas2pix(nside, scheme, ra[i], spd[i]);
+}
+#endif
+
+static void mas2pix_scalar(int nside, int scheme, const uint32_t* ra, const uint32_t* spd, int n, int64_t* pix) {
+	for (int i = 0; i < n; ++i) pix[i] = healpix_mas2pix(nside, scheme, ra[i], spd[i]);
+}
+
+typedef void (*mas2pix_func)(int, int, const uint32_t*, const uint32_t*, int, int64_t*);
+
+static mas2pix_func select_mas2pix() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return mas2pix_avx2;
+#endif
+	return mas2pix_scalar;
+}
+
+void healpix_mas2pix_batch(int nside, int scheme, const uint32_t* ra, const uint32_t* spd, int n, int64_t* pix) {
+	static const mas2pix_func func = select_mas2pix();
+	func(nside, scheme, ra, spd, n, pix);
+}
+
+void healpix_pix2mas(int nside, int scheme, int64_t pix, uint32_t& ra, uint32_t& spd) {
+	int ix, iy, face;
+	double z, phi;
+
+	if (scheme == HEALPIX_RING) healpix_ring2xyf(nside, pix, ix, iy, face);
+	else healpix_nest2xyf(nside, pix, ix, iy, face);
+	healpix_xyf2loc((ix + 0.5) / nside, (iy + 0.5) / nside, face, z, phi);
+	ra  = uint32_t(nearbyint(phi / HP_MAS2RAD)) % HP_MAS360;
+	spd = uint32_t(nearbyint((asin(z) + HP_HALFPI) / HP_MAS2RAD));
+}
+
+void healpix_pix2mas_batch(int nside, int scheme, const int64_t* pix, int n, uint32_t* ra, uint32_t* spd) {
+	for (int i = 0; i < n; ++i) healpix_pix2mas(nside, scheme, pix[i], ra[i], spd[i]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 相邻像元 */
+static const int nb_xoffset[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+static const int nb_yoffset[8] = { 0, 1, 1, 1, 0, -1, -1, -1};
+static const int nb_facearray[9][12] = {// 越过面内坐标边界后所在的基础面, 行: (dx + 1) + 3 * (dy + 1)
+	{  8, 9,10,11,-1,-1,-1,-1,10,11, 8, 9 },	// S
+	{  5, 6, 7, 4, 8, 9,10,11, 9,10,11, 8 },	// SE
+	{ -1,-1,-1,-1, 5, 6, 7, 4,-1,-1,-1,-1 },	// E
+	{  4, 5, 6, 7,11, 8, 9,10,11, 8, 9,10 },	// SW
+	{  0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11 },	// 本面
+	{  1, 2, 3, 0, 0, 1, 2, 3, 5, 6, 7, 4 },	// NE
+	{ -1,-1,-1,-1, 7, 4, 5, 6,-1,-1,-1,-1 },	// W
+	{  3, 0, 1, 2, 3, 0, 1, 2, 4, 5, 6, 7 },	// NW
+	{  2, 3, 0, 1,-1,-1,-1,-1, 0, 1, 2, 3 }		// N
+};
+static const int nb_swaparray[9][3] = {// 进入相邻面后的坐标变换: 位0翻转x; 位1翻转y; 位2交换x与y. 列: 基础面/4
+	{ 0, 0, 3 },	// S
+	{ 0, 0, 6 },	// SE
+	{ 0, 0, 0 },	// E
+	{ 0, 0, 5 },	// SW
+	{ 0, 0, 0 },	// 本面
+	{ 5, 0, 0 },	// NE
+	{ 0, 0, 0 },	// W
+	{ 6, 0, 0 },	// NW
+	{ 3, 0, 0 }		// N
+};
+
+int healpix_neighbours(int nside, int scheme, int64_t pix, int64_t nb[8]) {
+	int ix, iy, face, x, y, f, k, bits, m, count(0);
+
+	if (scheme == HEALPIX_RING) healpix_ring2xyf(nside, pix, ix, iy, face);
+	else healpix_nest2xyf(nside, pix, ix, iy, face);
+
+	for (k = 0; k < 8; ++k) {
+		x = ix + nb_xoffset[k];
+		y = iy + nb_yoffset[k];
+		m = 4;
+		if (x < 0)            { x += nside; m -= 1; }
+		else if (x >= nside)  { x -= nside; m += 1; }
+		if (y < 0)            { y += nside; m -= 3; }
+		else if (y >= nside)  { y -= nside; m += 3; }
+
+		if ((f = nb_facearray[m][face]) < 0) {
+			nb[k] = -1;
+			continue;
+		}
+		bits = nb_swaparray[m][face >> 2];
+		if (bits & 1) x = nside - x - 1;
+		if (bits & 2) y = nside - y - 1;
+		if (bits & 4) std::swap(x, y);
+		nb[k] = scheme == HEALPIX_RING ? healpix_xyf2ring(nside, x, y, f) : healpix_xyf2nest(nside, x, y, f);
+		++count;
+	}
+	return count;
+}
+
+void healpix_neighbours_batch(int nside, int scheme, const int64_t* pix, int n, int64_t* nb) {
+	for (int i = 0; i < n; ++i, nb += 8) healpix_neighbours(nside, scheme, pix[i], nb);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 大像元及边缘区域 */
+#define HP_REGION_BLOCK	1024	//< 批量判定时每次处理的恒星数
+
+bool healpix_region::Contains(int64_t pix) const {
+	size_t k = std::upper_bound(lo.begin(), lo.end(), pix) - lo.begin();
+	return k > 0 && pix < hi[k - 1];
+}
+
+int healpix_region::Select(const uint32_t* ra, const uint32_t* spd, int n, uint8_t* mask) const {
+	int64_t pix[HP_REGION_BLOCK], big[HP_REGION_BLOCK];
+	size_t k(0);
+	int i, j, m, count(0);
+
+	for (i = 0; i < n; i += m, ra += m, spd += m, mask += m) {
+		m = n - i < HP_REGION_BLOCK ? n - i : HP_REGION_BLOCK;
+		if (scheme == HEALPIX_RING) healpix_mas2pix_batch(bignside, HEALPIX_NEST, ra, spd, m, big);
+		if (scheme == HEALPIX_NEST || !lo.empty()) healpix_mas2pix_batch(nside, scheme, ra, spd, m, pix);
+		for (j = 0; j < m; ++j) {
+			if (scheme == HEALPIX_RING && big[j] == bighp) mask[j] = 1;
+			else if (lo.empty()) mask[j] = 0;
+			else if (k < lo.size() && pix[j] >= lo[k] && pix[j] < hi[k]) mask[j] = 1;	// 相邻恒星多落在同一区间
+			else {
+				k = std::upper_bound(lo.begin(), lo.end(), pix[j]) - lo.begin();
+				mask[j] = k > 0 && pix[j] < hi[--k];
+			}
+			count += mask[j];
+		}
+	}
+	return count;
+}
+
+/*!
+ * @brief 将升序像元列表并入区间
+ */
+static void append_runs(const vector<int64_t>& pix, vector<int64_t>& lo, vector<int64_t>& hi) {
+	for (size_t i = 0, j; i < pix.size(); i = j) {
+		for (j = i + 1; j < pix.size() && pix[j] == pix[j - 1] + 1; ++j);
+		lo.push_back(pix[i]);
+		hi.push_back(pix[j - 1] + 1);
+	}
+}
+
+/*!
+ * @brief 区间按起点排序并合并相接的区间
+ */
+static void merge_runs(vector<int64_t>& lo, vector<int64_t>& hi) {
+	vector<std::pair<int64_t, int64_t> > runs(lo.size());
+	size_t i, k;
+
+	for (i = 0; i < lo.size(); ++i) runs[i] = std::make_pair(lo[i], hi[i]);
+	std::sort(runs.begin(), runs.end());
+	lo.clear();
+	hi.clear();
+	for (i = 0; i < runs.size(); i = k) {
+		int64_t end = runs[i].second;
+		for (k = i + 1; k < runs.size() && runs[k].first <= end; ++k) end = std::max(end, runs[k].second);
+		lo.push_back(runs[i].first);
+		hi.push_back(end);
+	}
+}
+
+/*!
+ * @brief 大像元内的细网格像元
+ * @param edge 输出: 大像元内位于边界的像元
+ * @note
+ * 各分辨率下基础面内的归一化坐标一致: 大像元(bx, by)覆盖[bx, bx + 1) / bignside, 细网格像元中心为
+ * (ix + 0.5) / nside. 中心落在大像元内的像元构成面内坐标的矩形[x0, x1) * [y0, y1).
+ * NESTED方案下矩形为单个编号区间; RING方案下同一环的像元位于面内同一反对角线, 编号连续
+ */
+static void region_inside(healpix_region& rgn, vector<int64_t>& edge) {
+	int64_t bn = rgn.bignside, ns = rgn.nside, lo, hi, pix;
+	int bx, by, face, x0, x1, y0, y1, d, x, xa, xb;
+	vector<int64_t> run;
+
+	// 最小的ix, 满足(2 * ix + 1) * bn >= 2 * b * ns
+	auto first_cell = [bn, ns](int64_t b) {
+		int64_t v = 2 * b * ns - bn;
+		return int(v <= 0 ? 0 : (v + 2 * bn - 1) / (2 * bn));
+	};
+	healpix_nest2xyf(rgn.bignside, rgn.bighp, bx, by, face);
+	x0 = first_cell(bx);
+	x1 = first_cell(bx + 1);
+	y0 = first_cell(by);
+	y1 = first_cell(by + 1);
+	if (x0 >= x1 || y0 >= y1) return;	// 没有中心落在大像元内的像元
+
+	if (rgn.scheme == HEALPIX_NEST) {
+		rgn.lo.push_back(rgn.bighp * (ns / bn) * (ns / bn));
+		rgn.hi.push_back((rgn.bighp + 1) * (ns / bn) * (ns / bn));
+	}
+	else {
+		for (d = x0 + y0; d <= x1 + y1 - 2; ++d) {
+			xa = std::max(x0, d - y1 + 1);
+			xb = std::min(x1 - 1, d - y0);
+			lo = healpix_xyf2ring(rgn.nside, xa, d - xa, face);
+			hi = healpix_xyf2ring(rgn.nside, xb, d - xb, face);
+			if (lo > hi) std::swap(lo, hi);
+			if (hi - lo == xb - xa) {
+				rgn.lo.push_back(lo);
+				rgn.hi.push_back(hi + 1);
+			}
+			else {// 跨越赤经0点的环
+				run.clear();
+				for (x = xa; x <= xb; ++x) run.push_back(healpix_xyf2ring(rgn.nside, x, d - x, face));
+				std::sort(run.begin(), run.end());
+				append_runs(run, rgn.lo, rgn.hi);
+			}
+		}
+		merge_runs(rgn.lo, rgn.hi);
+	}
+
+	for (x = x0; x < x1; ++x) {
+		for (d = y0; d < y1; d += (x == x0 || x == x1 - 1 || d == y1 - 1) ? 1 : y1 - 1 - y0) {
+			pix = rgn.scheme == HEALPIX_NEST ? healpix_xyf2nest(rgn.nside, x, d, face)
+					: healpix_xyf2ring(rgn.nside, x, d, face);
+			edge.push_back(pix);
+		}
+	}
+}
+
+static void region_build(healpix_region& rgn) {
+	vector<int64_t> edge, next, ring;
+	std::unordered_set<int64_t> seen;
+	int64_t nb[8];
+	int d, k;
+
+	if (rgn.scheme == HEALPIX_RING && rgn.margin == 0) return;	// 仅需判定是否落在大像元内
+	region_inside(rgn, edge);
+
+	// 自边界像元沿相邻关系向外扩展margin层
+	for (d = 0; d < rgn.margin && !edge.empty(); ++d) {
+		next.clear();
+		for (size_t i = 0; i < edge.size(); ++i) {
+			healpix_neighbours(rgn.nside, rgn.scheme, edge[i], nb);
+			for (k = 0; k < 8; ++k) {
+				if (nb[k] < 0 || rgn.Contains(nb[k]) || !seen.insert(nb[k]).second) continue;
+				next.push_back(nb[k]);
+			}
+		}
+		edge.swap(next);
+	}
+	ring.assign(seen.begin(), seen.end());
+	std::sort(ring.begin(), ring.end());
+	append_runs(ring, rgn.lo, rgn.hi);
+	merge_runs(rgn.lo, rgn.hi);
+}
+
+const healpix_region* healpix_region_get(int bignside, int64_t bighp, int nside, int margin) {
+	static std::mutex mtx;
+	static std::list<healpix_region> cache;
+	std::lock_guard<std::mutex> lck(mtx);
+	std::list<healpix_region>::iterator it;
+
+	if (margin < 0) margin = 0;
+	for (it = cache.begin(); it != cache.end(); ++it) {
+		if (it->bignside == bignside && it->bighp == bighp && it->nside == nside && it->margin == margin)
+			return &*it;
+	}
+
+	cache.push_back(healpix_region());
+	healpix_region& rgn = cache.back();
+	rgn.nside    = nside;
+	rgn.bignside = bignside;
+	rgn.bighp    = bighp;
+	rgn.margin   = margin;
+	rgn.scheme   = !(nside & (nside - 1)) && nside >= bignside ? HEALPIX_NEST : HEALPIX_RING;
+	region_build(rgn);
+	return &rgn;
+}
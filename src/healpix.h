@@ -0,0 +1,142 @@
+/**
+ * @file healpix.h 声明HEALPix像元几何接口
+ * @note
+ * - 像元编号采用RING或NESTED方案. NESTED方案要求nside为2的幂
+ * - 球面位置以z=sin(赤纬)与phi=赤经(弧度)表示, 或与CatStar相同, 以毫角秒整数表示赤经与南天极距离
+ * - 位置到像元的转换按HEALPix C++库的算法, 极冠区以sin(极距)计算, 在极点附近不损失精度
+ */
+
+#ifndef SRC_HEALPIX_H_
+#define SRC_HEALPIX_H_
+
+#include <stdint.h>
+#include <vector>
+
+/*!
+ * @brief 像元编号方案
+ */
+enum {
+	HEALPIX_RING,	///< RING
+	HEALPIX_NEST	///< NESTED
+};
+
+/*!
+ * @struct healpix_bound 像元在赤道坐标系中的外包范围
+ */
+typedef struct {
+	double declo, dechi;	//< 赤纬范围, 量纲: 弧度
+	double ralo, rahi;		//< 赤经范围, 量纲: 弧度. ralo > rahi时跨越赤经0点
+	bool allra;				//< 覆盖全部赤经
+} healpix_bound;
+
+/*!
+ * @brief 像元总数
+ */
+inline int64_t healpix_npix(int nside) {
+	return 12 * int64_t(nside) * nside;
+}
+/*!
+ * @brief NESTED编号转换为基础面编号及面内坐标
+ * @param ix, iy 面内坐标, [0, nside)
+ * @param face   基础面编号, [0, 11]
+ */
+void healpix_nest2xyf(int nside, int64_t pix, int& ix, int& iy, int& face);
+int64_t healpix_xyf2nest(int nside, int ix, int iy, int face);
+/*!
+ * @brief RING编号与基础面编号及面内坐标的相互转换
+ */
+void healpix_ring2xyf(int nside, int64_t pix, int& ix, int& iy, int& face);
+int64_t healpix_xyf2ring(int nside, int ix, int iy, int face);
+int64_t healpix_nest2ring(int nside, int64_t pix);
+int64_t healpix_ring2nest(int nside, int64_t pix);
+/*!
+ * @brief 由位置计算所在像元
+ * @param scheme 编号方案, HEALPIX_RING或HEALPIX_NEST
+ * @param ra     赤经, [0, 360°), 量纲: 毫角秒
+ * @param spd    南天极距离, [0, 180°], 量纲: 毫角秒
+ * @note
+ * nside不大于2^28
+ */
+int64_t healpix_mas2pix(int nside, int scheme, uint32_t ra, uint32_t spd);
+/*!
+ * @brief 批量计算n颗恒星所在像元
+ * @param pix 输出: 像元编号
+ * @note
+ * 运行时按CPU能力选择AVX2/标量实现, 两者结果逐位一致
+ */
+void healpix_mas2pix_batch(int nside, int scheme, const uint32_t* ra, const uint32_t* spd, int n, int64_t* pix);
+/*!
+ * @brief 计算像元中心位置
+ * @param ra  输出: 赤经, 量纲: 毫角秒
+ * @param spd 输出: 南天极距离, 量纲: 毫角秒
+ */
+void healpix_pix2mas(int nside, int scheme, int64_t pix, uint32_t& ra, uint32_t& spd);
+void healpix_pix2mas_batch(int nside, int scheme, const int64_t* pix, int n, uint32_t* ra, uint32_t* spd);
+/*!
+ * @brief 查找相邻像元
+ * @param nb 输出: 依次为西南、西、西北、北、东北、东、东南、南方向的相邻像元(HEALPix约定).
+ *           基础面顶点处仅有7个相邻像元, 缺少的方向为-1
+ * @return
+ * 相邻像元数量
+ */
+int healpix_neighbours(int nside, int scheme, int64_t pix, int64_t nb[8]);
+/*!
+ * @brief 批量查找相邻像元
+ * @param nb 输出: n * 8个像元编号, 第i个像元的相邻像元为nb[8 * i, 8 * i + 8)
+ */
+void healpix_neighbours_batch(int nside, int scheme, const int64_t* pix, int n, int64_t* nb);
+/*!
+ * @brief 由基础面内的归一化坐标计算球面位置
+ * @param x, y  归一化面内坐标, [0, 1]
+ * @param z     输出: sin(赤纬)
+ * @param phi   输出: 赤经, [0, 2π), 量纲: 弧度
+ */
+void healpix_xyf2loc(double x, double y, int face, double& z, double& phi);
+/*!
+ * @brief 计算NESTED像元向外扩展pad后的赤纬/赤经范围
+ * @param pad 扩展角距, 量纲: 弧度
+ * @note
+ * 由沿像元边界的采样点计算, 结果为保守估计
+ */
+void healpix_nest_bound(int nside, int64_t pix, double pad, healpix_bound& bound);
+/*!
+ * @struct healpix_region 大像元及其边缘在细网格中覆盖的像元
+ * - 恒星属于区域: 落在大像元内, 或所在像元与某个中心落在大像元内的像元相距不超过margin个像元
+ * - 像元集合以升序排列的不相交区间[lo, hi)表示. nside为2的幂且不小于bignside时采用NESTED编号,
+ *   大像元内的像元为单个区间, 判定只需一次二分查找; 否则采用RING编号, 并另行判定是否落在大像元内
+ */
+struct healpix_region {
+	int nside;		//< 细网格
+	int scheme;		//< 区间的编号方案
+	int bignside;	//< 大像元, NESTED编号
+	int64_t bighp;
+	int margin;		//< 边缘扩展的像元数
+	std::vector<int64_t> lo, hi;	//< 像元区间[lo, hi)
+
+public:
+	/*!
+	 * @brief 细网格像元是否在区间内
+	 */
+	bool Contains(int64_t pix) const;
+	/*!
+	 * @brief 批量判定恒星是否属于区域
+	 * @param mask 输出: 1表示属于区域
+	 * @return
+	 * 属于区域的恒星数
+	 */
+	int Select(const uint32_t* ra, const uint32_t* spd, int n, uint8_t* mask) const;
+};
+
+/*!
+ * @brief 取得大像元及其边缘的像元区间
+ * @param bignside 大像元网格, 2的幂
+ * @param nside    细网格
+ * @return
+ * 按(bignside, bighp, nside, margin)缓存, 进程内只计算一次. 调用者不应释放
+ * @note
+ * 线程安全. 大像元内的像元由基础面内坐标直接得出, 边缘由大像元边界上的像元沿相邻关系扩展margin层
+ * 得出. 计算量与大像元的周长及margin成正比
+ */
+const healpix_region* healpix_region_get(int bignside, int64_t bighp, int nside, int margin);
+
+#endif /* SRC_HEALPIX_H_ */
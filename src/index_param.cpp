@@ -0,0 +1,38 @@
+/**
+ * @file index_param.cpp 索引构建参数的初始化与解析
+ * @note
+ * 不依赖索引文件的读写, 星表导入及性能评估程序可单独链接
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "build_index.h"
+#include "cat_index.h"
+
+void init_index_param(index_param& param) {
+	memset(&param, 0, sizeof(index_param));
+	param.filter_band = 1;
+	param.jitter    = 1.0;
+	param.sweeps	= 10;
+	param.passes	= 16;
+	param.Nreuse	= 8;
+	param.Nloosen	= 20;
+	param.dimquads	= 4;
+	param.brightcut	= 0.1;
+	param.bighp		= -1;
+	param.nthread	= 1;
+	param.reader	= UCAC4_READ_MMAP;
+	param.usecache	= true;
+	param.writebatch = CAT_WRITE_BATCH;
+}
+
+long long parse_size(const char* str) {
+	char* end;
+	long long val = strtoll(str, &end, 10);
+
+	if (end == str || val < 0) return -1;
+	if (*end == 'k' || *end == 'K') val <<= 10, ++end;
+	else if (*end == 'm' || *end == 'M') val <<= 20, ++end;
+	else if (*end == 'g' || *end == 'G') val <<= 30, ++end;
+	return *end ? -1 : val;
+}
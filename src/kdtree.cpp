@@ -2,6 +2,552 @@
  * @file kdtree.cpp 定义K-D树接口
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "kdtree.h"
+#include "kdtree_kernel.h"
 
+using namespace std;
 
+/*!
+ * @struct kd_task 构建任务: 以节点nodeid为根, 包含树序[lo, hi)数据点的子树
+ */
+typedef struct {
+	int nodeid;
+	int lo, hi;
+} kd_task;
+
+/*!
+ * @struct kd_builder 构建过程的共享状态
+ */
+typedef struct kd_builder {
+	kdtree_t* kd;
+	double* data;		//< 数据点, 构建过程中按树序重排
+	unsigned int options;
+	bool spawn;			//< 是否将大子树作为任务
+
+	mutex mtx;
+	condition_variable cv;
+	vector<kd_task> tasks;	//< 待构建的子树
+	int busy;				//< 正在构建子树的线程数
+} kd_builder;
+
+int kdtree_compute_levels(int N, int Nleaf) {
+	int nlevels = 1;
+
+	if (Nleaf < 1) Nleaf = 1;
+	for (N /= Nleaf; N > 1; N >>= 1) ++nlevels;
+	return nlevels;
+}
+
+/*!
+ * @brief 提交子树任务
+ */
+static void push_task(kd_builder* b, int nodeid, int lo, int hi) {
+	kd_task task;
+
+	task.nodeid = nodeid;
+	task.lo     = lo;
+	task.hi     = hi;
+	lock_guard<mutex> lck(b->mtx);
+	b->tasks.push_back(task);
+	b->cv.notify_one();
+}
+
+/*!
+ * @struct kd_build 构建过程. ND > 0时维数为编译期常量
+ */
+template<int ND>
+struct kd_build {
+	enum {
+		NDIM = ND ? ND : KDTREE_MAX_DIM
+	};
+
+	/*!
+	 * @brief 交换树序i与j的数据点及其原始序号
+	 */
+	static inline void swap_rows(double* data, uint32_t* perm, int D, int i, int j) {
+		double* a = data + size_t(i) * D;
+		double* b = data + size_t(j) * D;
+		for (int d = 0; d < D; ++d) swap(a[d], b[d]);
+		swap(perm[i], perm[j]);
+	}
+
+	/*!
+	 * @brief 选择: 重排[lo, hi)的数据点, 使m处为维度dim上的第(m - lo)小值, 之前不大于它, 之后不小于它
+	 * @note
+	 * 三数取中为枢轴的Hoare划分, 只在包含m的一侧继续. 数据点与perm同步交换, 访问连续
+	 */
+	static void select_rows(double* data, uint32_t* perm, int D, int dim, int lo, int hi, int m) {
+		int i, j;
+		double a, b, c, pivot;
+
+#define KD_VAL(k)	data[size_t(k) * D + dim]
+		while (hi - lo > 1) {
+			a = KD_VAL(lo), b = KD_VAL(lo + (hi - lo) / 2), c = KD_VAL(hi - 1);
+			pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+			i = lo, j = hi - 1;
+			while (i <= j) {
+				while (KD_VAL(i) < pivot) ++i;
+				while (KD_VAL(j) > pivot) --j;
+				if (i <= j) swap_rows(data, perm, D, i++, j--);
+			}
+			// [lo, j]不大于枢轴, [i, hi)不小于枢轴, (j, i)等于枢轴
+			if (m <= j) hi = j + 1;
+			else if (m >= i) lo = i;
+			else break;
+		}
+#undef KD_VAL
+	}
+
+	/*!
+	 * @brief 计算树序[lo, hi)数据点的包围盒. step > 1时按步长抽样估计
+	 */
+	static void bound_rows(const double* data, int D, int lo, int hi, int step, double* lower, double* upper) {
+		int i, d;
+
+		for (d = 0; d < D; ++d) lower[d] = DBL_MAX, upper[d] = -DBL_MAX;
+		for (i = lo; i < hi; i += step) {
+			const double* pt = data + size_t(i) * D;
+			for (d = 0; d < D; ++d) {
+				lower[d] = min(lower[d], pt[d]);
+				upper[d] = max(upper[d], pt[d]);
+			}
+		}
+	}
+
+	/*!
+	 * @brief 构建以nodeid为根的子树. 左子树就地继续, 较大的右子树提交为任务
+	 * @note
+	 * 分割维只需范围的相对大小, 点数较多的节点由抽样估计; 叶节点计算精确的包围盒,
+	 * 内部节点的包围盒最后由子节点合并
+	 */
+	static void build_subtree(kd_builder* b, int nodeid, int lo, int hi) {
+		kdtree_t* kd = b->kd;
+		double* data = b->data;
+		uint32_t* perm = kd->perm;
+		const int D = ND ? ND : kd->ndim;
+		double lower[NDIM], upper[NDIM], extent;
+		int d, dim, m;
+
+		while (nodeid < kd->ninterior) {
+			// 沿范围最大的维度以中位点分割
+			bound_rows(data, D, lo, hi, (hi - lo) / KD_BUILD_SAMPLE + 1, lower, upper);
+			for (d = 1, dim = 0, extent = upper[0] - lower[0]; d < D; ++d) {
+				if (upper[d] - lower[d] > extent) extent = upper[d] - lower[d], dim = d;
+			}
+			m = lo + (hi - lo) / 2;
+			select_rows(data, perm, D, dim, lo, hi, m);
+			if (b->options & KD_BUILD_SPLIT) {
+				kd->split.d[nodeid]  = m < hi ? data[size_t(m) * D + dim] : lower[dim];
+				kd->splitdim[nodeid] = uint8_t(dim);
+			}
+
+			if (b->spawn && hi - m > KD_BUILD_TASK_MIN) push_task(b, 2 * nodeid + 2, m, hi);
+			else build_subtree(b, 2 * nodeid + 2, m, hi);
+			nodeid = 2 * nodeid + 1;
+			hi = m;
+		}
+		// 叶节点
+		kd->lr[nodeid - kd->ninterior] = hi - 1;
+		if (b->options & KD_BUILD_BBOX)
+			bound_rows(data, D, lo, hi, 1, kd->bb.d + size_t(2 * nodeid) * D, kd->bb.d + size_t(2 * nodeid + 1) * D);
+	}
+
+	/*!
+	 * @brief 工作线程: 取出任务构建, 直至队列为空且没有线程仍在构建
+	 */
+	static void build_worker(kd_builder* b) {
+		kd_task task;
+
+		while (1) {
+			unique_lock<mutex> lck(b->mtx);
+			while (b->tasks.empty() && b->busy > 0) b->cv.wait(lck);
+			if (b->tasks.empty()) break;
+			task = b->tasks.back();
+			b->tasks.pop_back();
+			++b->busy;
+			lck.unlock();
+
+			build_subtree(b, task.nodeid, task.lo, task.hi);
+
+			lck.lock();
+			if (--b->busy == 0 && b->tasks.empty()) b->cv.notify_all();
+		}
+	}
+
+	static void run(kd_builder* b, int nthread) {
+		vector<thread> workers;
+		int t;
+
+		b->spawn = nthread > 1;
+		if (nthread <= 1) build_subtree(b, 0, 0, b->kd->ndata);
+		else {
+			push_task(b, 0, 0, b->kd->ndata);
+			for (t = 0; t < nthread; ++t) workers.push_back(thread(build_worker, b));
+			for (t = 0; t < nthread; ++t) workers[t].join();
+		}
+	}
+};
+
+/*!
+ * @brief vEB排列的逐层参数: 将深度[d0, d0 + h)的子树分为高h / 2的顶部子树与其下的底部子树, 递归处理
+ */
+static void veb_split(kdtree_veb* veb, int d0, int h) {
+	if (h <= 1) return;
+	int ht = h / 2, hb = h - ht, d = d0 + ht;
+
+	veb->top[d]       = (1 << ht) - 1;
+	veb->bottom[d]    = (1 << hb) - 1;
+	veb->rootdepth[d] = int8_t(d0);
+	veb_split(veb, d0, ht);
+	veb_split(veb, d, hb);
+}
+
+/*!
+ * @brief 层数为nlevels的完全树中各节点的位置. veb为NULL时为堆序
+ */
+static void layout_slots(const kdtree_veb* veb, int nlevels, vector<int32_t>& slot) {
+	int nnodes = (1 << nlevels) - 1, nodeid, depth;
+
+	slot.resize(nnodes);
+	for (nodeid = 0; nodeid < nnodes; ++nodeid) {
+		if (!veb || !nodeid) slot[nodeid] = nodeid;
+		else {// 祖先编号小于nodeid, 其位置已确定
+			depth = kd_depth(nodeid);
+			int anc = ((nodeid + 1) >> (depth - veb->rootdepth[depth])) - 1;
+			slot[nodeid] = slot[anc] + veb->top[depth] + ((nodeid + 1) & veb->top[depth]) * veb->bottom[depth];
+		}
+	}
+}
+
+/*!
+ * @brief 按位置重排节点数组: 节点nodeid的size字节由from[nodeid]处移到to[nodeid]处
+ */
+static void* permute_nodes(void* array, size_t size, const vector<int32_t>& from, const vector<int32_t>& to) {
+	char* dst = (char*) malloc(size * from.size());
+	const char* src = (const char*) array;
+
+	for (size_t k = 0; k < from.size(); ++k) memcpy(dst + size * to[k], src + size * from[k], size);
+	free(array);
+	return dst;
+}
+
+int kdtree_node_slot(const kdtree_t* kd, int nodeid, int inner) {
+	int32_t path[KDTREE_MAX_LEVELS];
+	int depth, d;
+
+	if (!kd->veb) return nodeid;
+	depth   = kd_depth(nodeid);
+	path[0] = 0;
+	for (d = 1; d <= depth; ++d) path[d] = kd_path_slot(kd, path, ((nodeid + 1) >> (depth - d)) - 1, d, inner);
+	return path[depth];
+}
+
+void kdtree_set_layout(kdtree_t* kd, int layout) {
+	kdtree_veb* veb = NULL;
+	vector<int32_t> from, to;
+	size_t size = kd->type == KDTT_DUU ? sizeof(uint32_t) : (kd->type == KDTT_DSS ? sizeof(uint16_t) : sizeof(double));
+
+	if ((layout == KD_LAYOUT_VEB) == (kd->veb != NULL)) return;
+	if (layout == KD_LAYOUT_VEB) {
+		veb = (kdtree_veb*) calloc(2, sizeof(kdtree_veb));
+		veb_split(veb, 0, kd->nlevels);
+		veb_split(veb + 1, 0, kd->nlevels - 1);
+	}
+	if (kd->bb.any) {
+		layout_slots(kd->veb, kd->nlevels, from);
+		layout_slots(veb, kd->nlevels, to);
+		kd->bb.any = permute_nodes(kd->bb.any, size * 2 * kd->ndim, from, to);
+	}
+	if (kd->split.any && kd->ninterior) {
+		layout_slots(kd->veb ? kd->veb + 1 : NULL, kd->nlevels - 1, from);
+		layout_slots(veb ? veb + 1 : NULL, kd->nlevels - 1, to);
+		kd->split.any = permute_nodes(kd->split.any, size, from, to);
+		kd->splitdim  = (uint8_t*) permute_nodes(kd->splitdim, sizeof(uint8_t), from, to);
+	}
+	free(kd->veb);
+	kd->veb = veb;
+}
+
+/*!
+ * @brief 按维数选择查询实例
+ */
+template<typename etype, typename ttype, typename dtype>
+static void install_funcs(kdtree_t* kd) {
+	switch (kd->ndim) {
+	case 2: kdtree_kernel<etype, ttype, dtype, 2>::install(kd->funcs);
+		break;
+	case 3: kdtree_kernel<etype, ttype, dtype, 3>::install(kd->funcs);
+		break;
+	case 4: kdtree_kernel<etype, ttype, dtype, 4>::install(kd->funcs);
+		break;
+	case 6: kdtree_kernel<etype, ttype, dtype, 6>::install(kd->funcs);
+		break;
+	default: kdtree_kernel<etype, ttype, dtype, 0>::install(kd->funcs);
+		break;
+	}
+}
+
+int kdtree_update_funcs(kdtree_t* kd) {
+	switch (kd->type) {
+	case KDTT_DOUBLE: install_funcs<double, double, double>(kd);
+		return 0;
+	case KDTT_DUU: install_funcs<double, uint32_t, uint32_t>(kd);
+		return 0;
+	case KDTT_DSS: install_funcs<double, uint16_t, uint16_t>(kd);
+		return 0;
+	default:
+		memset(&kd->funcs, 0, sizeof(kd->funcs));
+		return -1;
+	}
+}
+
+/*!
+ * @brief 量化比例尺: 各维的最大范围映射到类型T的上限
+ */
+template<typename T>
+static double quantize_scale(const kdtree_t* kd) {
+	double range(0.0);
+
+	for (int d = 0; d < kd->ndim; ++d) range = max(range, kd->maxval[d] - kd->minval[d]);
+	return range > 0.0 ? double(numeric_limits<T>::max()) / range : 1.0;
+}
+
+template<typename T>
+static inline T quantize_value(const kdtree_t* kd, double v, int d) {
+	double q = floor((v - kd->minval[d]) * kd->scale + 0.5);
+	return T(q < 0.0 ? 0.0 : min(q, double(numeric_limits<T>::max())));
+}
+
+/*!
+ * @brief 将双精度树量化为类型T: 数据点与分割值按同一单调映射取整, 保持分割关系; 包围盒由量化后的
+ * 数据点重新计算
+ */
+template<typename T>
+static void quantize_tree(kdtree_t* kd, uint32_t treetype) {
+	const int D = kd->ndim;
+	const size_t n = size_t(kd->ndata) * D;
+	T* data = (T*) malloc(sizeof(T) * n);
+	size_t k;
+	int i;
+
+	kd->scale    = quantize_scale<T>(kd);
+	kd->invscale = 1.0 / kd->scale;
+	for (k = 0; k < n; ++k) data[k] = quantize_value<T>(kd, kd->data.d[k], int(k % D));
+	if (kd->free_data) free(kd->data.any);
+	kd->data.any  = data;
+	kd->free_data = 1;
+	if (kd->split.any) {
+		T* split = (T*) malloc(sizeof(T) * kd->ninterior);
+		for (i = 0; i < kd->ninterior; ++i) split[i] = quantize_value<T>(kd, kd->split.d[i], kd->splitdim[i]);
+		free(kd->split.any);
+		kd->split.any = split;
+	}
+	if (kd->bb.any) {
+		free(kd->bb.any);
+		kd->bb.any = malloc(sizeof(T) * 2 * D * kd->nnodes);
+	}
+	kd->type = treetype;
+	kdtree_update_funcs(kd);
+	kd->funcs.fix_bounding_boxes(kd);
+}
+
+kdtree_t* kdtree_build(double* data, int N, int ndim, int Nleaf, uint32_t treetype, unsigned int options,
+		int nthread) {
+	kdtree_t* kd;
+	int i, d;
+
+	if (!data || N < 1 || ndim < 1 || ndim > KDTREE_MAX_DIM) return NULL;
+	if (treetype != KDTT_DOUBLE && treetype != KDTT_DUU && treetype != KDTT_DSS) return NULL;
+	if (nthread < 1) nthread = 1;
+
+	kd = (kdtree_t*) calloc(1, sizeof(kdtree_t));
+	kd->type      = KDTT_DOUBLE;
+	kd->ndata     = N;
+	kd->ndim      = ndim;
+	kd->nlevels   = kdtree_compute_levels(N, Nleaf);
+	kd->nbottom   = 1 << (kd->nlevels - 1);
+	kd->nnodes    = (1 << kd->nlevels) - 1;
+	kd->ninterior = kd->nbottom - 1;
+	kd->scale     = 1.0;
+	kd->invscale  = 1.0;
+	kd->lr   = (int32_t*) malloc(sizeof(int32_t) * kd->nbottom);
+	kd->perm = (uint32_t*) malloc(sizeof(uint32_t) * N);
+	if (options & KD_BUILD_BBOX) {
+		kd->n_bb = kd->nnodes;
+		kd->bb.d = (double*) malloc(sizeof(double) * 2 * ndim * kd->nnodes);
+	}
+	if (options & KD_BUILD_SPLIT) {
+		kd->split.d  = (double*) malloc(sizeof(double) * kd->ninterior);
+		kd->splitdim = (uint8_t*) malloc(kd->ninterior);
+	}
+	for (i = 0; i < N; ++i) kd->perm[i] = uint32_t(i);
+
+	kd_builder b;
+	b.kd      = kd;
+	b.data    = data;
+	b.options = options;
+	b.busy    = 0;
+	switch (ndim) {
+	case 2: kd_build<2>::run(&b, nthread);
+		break;
+	case 3: kd_build<3>::run(&b, nthread);
+		break;
+	case 4: kd_build<4>::run(&b, nthread);
+		break;
+	case 6: kd_build<6>::run(&b, nthread);
+		break;
+	default: kd_build<0>::run(&b, nthread);
+		break;
+	}
+	if (options & KD_BUILD_BBOX) {// 内部节点的包围盒: 合并子节点
+		for (i = kd->ninterior - 1; i >= 0; --i) {
+			double* bb = kd->bb.d;
+			size_t self = size_t(2 * i) * ndim, left = size_t(2 * (2 * i + 1)) * ndim, right = size_t(2 * (2 * i + 2)) * ndim;
+			for (d = 0; d < ndim; ++d) {
+				bb[self + d] = min(bb[left + d], bb[right + d]);
+				bb[self + ndim + d] = max(bb[left + ndim + d], bb[right + ndim + d]);
+			}
+		}
+	}
+
+	kd->data.d = data;
+	kd->minval = (double*) malloc(sizeof(double) * ndim);
+	kd->maxval = (double*) malloc(sizeof(double) * ndim);
+	if (kd->bb.any) {// 根节点的包围盒
+		memcpy(kd->minval, kd->bb.d, sizeof(double) * ndim);
+		memcpy(kd->maxval, kd->bb.d + ndim, sizeof(double) * ndim);
+	}
+	else {
+		for (d = 0; d < ndim; ++d) kd->minval[d] = DBL_MAX, kd->maxval[d] = -DBL_MAX;
+		for (i = 0; i < N; ++i) {
+			for (d = 0; d < ndim; ++d) {
+				double v = data[size_t(i) * ndim + d];
+				kd->minval[d] = min(kd->minval[d], v);
+				kd->maxval[d] = max(kd->maxval[d], v);
+			}
+		}
+	}
+	if (treetype == KDTT_DUU) quantize_tree<uint32_t>(kd, treetype);
+	else if (treetype == KDTT_DSS) quantize_tree<uint16_t>(kd, treetype);
+	else kdtree_update_funcs(kd);
+	if (options & KD_BUILD_VEB) kdtree_set_layout(kd, KD_LAYOUT_VEB);
+	return kd;
+}
+
+kdtree_t* kdtree_build_quantized(double* data, int N, int ndim, int Nleaf, double maxerr, unsigned int options,
+		int nthread) {
+	kdtree_t* kd = kdtree_build(data, N, ndim, Nleaf, KDTT_DOUBLE, options, nthread);
+	double half = 0.5 * sqrt(double(ndim));
+
+	if (!kd) return NULL;
+	if (half / quantize_scale<uint16_t>(kd) <= maxerr) quantize_tree<uint16_t>(kd, KDTT_DSS);
+	else if (half / quantize_scale<uint32_t>(kd) <= maxerr) quantize_tree<uint32_t>(kd, KDTT_DUU);
+	return kd;
+}
+
+double kdtree_quantization_error(const kdtree_t* kd) {
+	return kd->type == KDTT_DOUBLE ? 0.0 : 0.5 * kd->invscale * sqrt(double(kd->ndim));
+}
+
+size_t kdtree_bytes(const kdtree_t* kd) {
+	size_t size = kd->type == KDTT_DUU ? sizeof(uint32_t) : (kd->type == KDTT_DSS ? sizeof(uint16_t) : sizeof(double));
+	size_t bytes = size * kd->ndata * kd->ndim;
+
+	if (kd->bb.any) bytes += size * 2 * kd->ndim * kd->nnodes;
+	if (kd->split.any) bytes += (size + sizeof(uint8_t)) * kd->ninterior;
+	return bytes;
+}
+
+void kdtree_free(kdtree_t* kd) {
+	if (!kd) return;
+	free(kd->lr);
+	free(kd->perm);
+	free(kd->bb.any);
+	free(kd->split.any);
+	free(kd->splitdim);
+	if (kd->free_data) free(kd->data.any);
+	free(kd->minval);
+	free(kd->maxval);
+	free(kd->name);
+	free(kd->veb);
+	free(kd);
+}
+
+bool kdtree_is_leaf(const kdtree_t* kd, int nodeid) {
+	return nodeid >= kd->ninterior;
+}
+
+int kdtree_left(const kdtree_t* kd, int nodeid) {
+	while (nodeid < kd->ninterior) nodeid = 2 * nodeid + 1;
+	nodeid -= kd->ninterior;
+	return nodeid ? kd->lr[nodeid - 1] + 1 : 0;
+}
+
+int kdtree_right(const kdtree_t* kd, int nodeid) {
+	while (nodeid < kd->ninterior) nodeid = 2 * nodeid + 2;
+	return kd->lr[nodeid - kd->ninterior];
+}
+
+int kdtree_npoints(const kdtree_t* kd, int nodeid) {
+	return kdtree_right(kd, nodeid) - kdtree_left(kd, nodeid) + 1;
+}
+
+int kdtree_check(const kdtree_t* kd) {
+	return kd->funcs.check(kd);
+}
+
+kdtree_qres_t* kdtree_rangesearch_options_reuse(const kdtree_t* kd, kdtree_qres_t* res, const double* pt,
+		double maxd2, int options) {
+	return kd->funcs.rangesearch(kd, res, pt, maxd2, options);
+}
+
+kdtree_qres_t* kdtree_rangesearch(const kdtree_t* kd, const double* pt, double maxd2) {
+	return kd->funcs.rangesearch(kd, NULL, pt, maxd2, KD_OPTIONS_COMPUTE_DISTS | KD_OPTIONS_SORT_DISTS);
+}
+
+void kdtree_free_query(kdtree_qres_t* res) {
+	if (!res) return;
+	free(res->results.any);
+	free(res->sdists);
+	free(res->inds);
+	free(res);
+}
+
+int kdtree_nearest_neighbour(const kdtree_t* kd, const double* pt, double* p_mindist2) {
+	double bestd2 = HUGE_VAL;
+	int ibest = -1;
+
+	kd->funcs.nearest_neighbour_internal(kd, pt, &bestd2, &ibest);
+	if (p_mindist2) *p_mindist2 = bestd2;
+	return ibest < 0 ? -1 : (kd->perm ? int(kd->perm[ibest]) : ibest);
+}
+
+bool kdtree_get_bboxes(const kdtree_t* kd, int nodeid, double* bblo, double* bbhi) {
+	return kd->funcs.get_bboxes(kd, nodeid, bblo, bbhi) != 0;
+}
+
+double kdtree_get_splitval(const kdtree_t* kd, int nodeid) {
+	return kd->funcs.get_splitval(kd, nodeid);
+}
+
+int kdtree_get_splitdim(const kdtree_t* kd, int nodeid) {
+	return kd->splitdim[kdtree_node_slot(kd, nodeid, 1)];
+}
+
+void kdtree_nodes_contained(const kdtree_t* kd, const double* querylow, const double* queryhi,
+		void (*callback_contained)(const kdtree_t* kd, int node, void* extra),
+		void (*callback_overlap)(const kdtree_t* kd, int node, void* extra),
+		void* cb_extra) {
+	kd->funcs.nodes_contained(kd, querylow, queryhi, callback_contained, callback_overlap, cb_extra);
+}
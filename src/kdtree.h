@@ -1,5 +1,18 @@
 /**
  * @file kdtree.h 声明K-D树数据结构和接口
+ * @note
+ * - 完全二叉树: 节点i的子节点为2i+1和2i+2, 共nlevels层, 底层nbottom = 2^(nlevels-1)个叶节点
+ * - lr[k]为第k个叶节点最后一个数据点的序号. 数据点按树序存储, perm将树序映射为原始序号
+ * - bb: 节点i的包围盒下限为bb[2i*ndim], 上限为bb[(2i+1)*ndim]
+ * - split/splitdim: 内部节点的分割值与分割维. 左子树各点在分割维上不大于分割值, 右子树不小于分割值
+ * - 查询由kdtree_kernel.h中按类型与维数特化的模板实现, kdtree_funcs及kdtree_xxx()函数为其外层接口
+ * - 节点数组的排列: 默认为堆序, bb以节点编号i, split/splitdim以内部节点编号i为下标. vEB排列下
+ *   (kdtree_set_layout()), bb按nlevels层完全树的van Emde Boas递归排列, split/splitdim按nlevels-1层
+ *   内部节点树的vEB排列, 深层查询沿路径访问的节点集中于少数缓存行与页面. 编号与位置的换算见
+ *   kdtree_node_slot(). 磁盘格式为堆序, 写出前以kdtree_set_layout(kd, KD_LAYOUT_HEAP)还原
+ * - 量化树(KDTT_DUU, KDTT_DSS): 数据点、包围盒与分割值以minval为原点, 按比例尺scale取整为uint32_t或
+ *   uint16_t. 各维共用scale, 由最大范围映射到整数上限. 外部坐标v对应round((v - minval) * scale),
+ *   数据点的量化位置与原位置的距离不大于kdtree_quantization_error(). 查询作用于量化位置
  */
 
 #ifndef SRC_KDTREE_H_
@@ -7,6 +20,41 @@
 
 #include <stdint.h>
 
+/* 数据、树节点(包围盒与分割值)及外部坐标的存储类型 */
+#define KDT_DATA_DOUBLE		0x1
+#define KDT_DATA_FLOAT		0x2
+#define KDT_DATA_U32		0x4
+#define KDT_DATA_U16		0x8
+#define KDT_TREE_DOUBLE		0x100
+#define KDT_TREE_FLOAT		0x200
+#define KDT_TREE_U32		0x400
+#define KDT_TREE_U16		0x800
+#define KDT_EXT_DOUBLE		0x10000
+#define KDT_EXT_FLOAT		0x20000
+#define KDTT_DOUBLE			(KDT_EXT_DOUBLE | KDT_DATA_DOUBLE | KDT_TREE_DOUBLE)
+#define KDTT_DUU			(KDT_EXT_DOUBLE | KDT_DATA_U32 | KDT_TREE_U32)
+#define KDTT_DSS			(KDT_EXT_DOUBLE | KDT_DATA_U16 | KDT_TREE_U16)
+
+/* 构建选项 */
+#define KD_BUILD_BBOX		0x1	//< 存储各节点的包围盒
+#define KD_BUILD_SPLIT		0x2	//< 存储内部节点的分割值与分割维
+#define KD_BUILD_VEB		0x4	//< 构建完成后将节点数组转换为vEB排列
+
+/* 节点数组的排列 */
+#define KD_LAYOUT_HEAP		0	//< 堆序(层序)
+#define KD_LAYOUT_VEB		1	//< van Emde Boas递归排列
+
+/* 查询选项 */
+#define KD_OPTIONS_COMPUTE_DISTS	0x1	//< 返回距离平方
+#define KD_OPTIONS_RETURN_POINTS	0x2	//< 返回数据点坐标
+#define KD_OPTIONS_SORT_DISTS		0x4	//< 按距离排序, 隐含KD_OPTIONS_COMPUTE_DISTS
+
+#define KDTREE_MAX_DIM		32	//< 维数上限
+#define KDTREE_MAX_LEVELS	32	//< 层数上限
+
+#define KD_BUILD_TASK_MIN	65536	//< 多线程构建时点数超过该值的子树作为独立任务
+#define KD_BUILD_SAMPLE		1024	//< 选择分割维时抽样估计范围的点数
+
 struct kdtree;
 typedef struct kdtree	kdtree_t;
 
@@ -44,6 +92,16 @@ struct kdtree_funcs {
 };
 typedef struct kdtree_funcs kdtree_funcs;
 
+/*!
+ * @struct kdtree_veb vEB排列的逐层参数(Brodal, Fagerberg & Jacob). 深度为d、层序编号为i(根为1)的节点位置:
+ * pos[d] = pos[rootdepth[d]] + top[d] + (i & top[d]) * bottom[d], pos[0] = 0
+ */
+typedef struct {
+	int32_t	top[KDTREE_MAX_LEVELS];		//< 以深度d为根的底部子树所在递归层的顶部子树节点数
+	int32_t	bottom[KDTREE_MAX_LEVELS];	//< 该底部子树的节点数
+	int8_t	rootdepth[KDTREE_MAX_LEVELS];	//< 顶部子树的根深度
+} kdtree_veb;
+
 struct kdtree {
 	uint32_t	type;	// kd树类型
 	int32_t*	lr;		// 叶节点
@@ -92,6 +150,7 @@ struct kdtree {
 	int		ninterior;
 	int		nlevels;
 	int		has_linear_lr;
+	kdtree_veb*	veb;	// 非空时节点数组为vEB排列: veb[0]用于bb, veb[1]用于split/splitdim
 
 	char*	name;
 	void*	io;
@@ -113,4 +172,107 @@ struct kdtree_qres {
     uint32_t*	inds;    /* Indexes into original data set */
 };
 
+/*!
+ * @brief 计算叶节点平均不多于Nleaf个点时的层数
+ */
+int kdtree_compute_levels(int N, int Nleaf);
+/*!
+ * @brief 构建K-D树
+ * @param data    N个ndim维数据点, 按点连续存储. 构建完成后按树序重排. KDTT_DOUBLE树引用但不释放;
+ *                量化树另存量化后的数据点
+ * @param Nleaf   叶节点平均点数上限
+ * @param ndim    维数, 不大于KDTREE_MAX_DIM
+ * @param treetype 类型: KDTT_DOUBLE, KDTT_DUU或KDTT_DSS
+ * @param options KD_BUILD_BBOX, KD_BUILD_SPLIT及KD_BUILD_VEB的组合
+ * @param nthread 线程数
+ * @return
+ * K-D树. 参数无效时返回NULL
+ * @note
+ * - 原位构建: 数据点与排列数组perm同步交换. 各节点沿范围最大的维度以选择算法取中位点分割
+ * - 点数超过KD_BUILD_TASK_MIN的子树作为任务由线程池并行构建
+ * - 量化树先以双精度构建, 再量化数据点与分割值, 由量化后的数据点重新计算包围盒
+ */
+kdtree_t* kdtree_build(double* data, int N, int ndim, int Nleaf, uint32_t treetype, unsigned int options,
+		int nthread = 1);
+/*!
+ * @brief 构建误差不超过maxerr的最紧凑K-D树: 依次尝试KDTT_DSS, KDTT_DUU, 均不满足时为KDTT_DOUBLE
+ * @param maxerr 数据点量化位置与原位置距离的上限, 外部坐标
+ */
+kdtree_t* kdtree_build_quantized(double* data, int N, int ndim, int Nleaf, double maxerr, unsigned int options,
+		int nthread = 1);
+/*!
+ * @brief 量化误差上限: 0.5 * invscale * sqrt(ndim). 双精度树返回0
+ */
+double kdtree_quantization_error(const kdtree_t* kd);
+/*!
+ * @brief 数据点、包围盒与分割值占用的字节数
+ */
+size_t kdtree_bytes(const kdtree_t* kd);
+/*!
+ * @brief 释放K-D树
+ */
+void kdtree_free(kdtree_t* kd);
+bool kdtree_is_leaf(const kdtree_t* kd, int nodeid);
+/*!
+ * @brief 节点包含的首个/最后一个数据点的树序
+ */
+int kdtree_left(const kdtree_t* kd, int nodeid);
+int kdtree_right(const kdtree_t* kd, int nodeid);
+int kdtree_npoints(const kdtree_t* kd, int nodeid);
+/*!
+ * @brief 节点在节点数组中的位置
+ * @param inner 0: bb的位置; 1: split/splitdim的位置, nodeid须为内部节点
+ */
+int kdtree_node_slot(const kdtree_t* kd, int nodeid, int inner);
+/*!
+ * @brief 转换节点数组的排列. 仅置换bb、split与splitdim, 可无损往返
+ * @param layout KD_LAYOUT_HEAP或KD_LAYOUT_VEB
+ */
+void kdtree_set_layout(kdtree_t* kd, int layout);
+/*!
+ * @brief 按树类型与维数设置kd->funcs. 维数为2, 3, 4, 6时使用定维实例
+ * @return
+ * 成功时返回0, 不支持的类型返回-1
+ */
+int kdtree_update_funcs(kdtree_t* kd);
+/*!
+ * @brief 检查K-D树: 排列, 叶节点区间, 包围盒与分割值
+ * @return
+ * 通过时返回0, 否则打印首个错误并返回-1
+ */
+int kdtree_check(const kdtree_t* kd);
+/*!
+ * @brief 查找与pt距离平方不大于maxd2的数据点
+ * @param res     可复用的查询结果. NULL时新分配
+ * @param options KD_OPTIONS_xxx的组合
+ * @return
+ * 查询结果. inds为数据点的原始序号. 由kdtree_free_query()释放
+ */
+kdtree_qres_t* kdtree_rangesearch_options_reuse(const kdtree_t* kd, kdtree_qres_t* res, const double* pt,
+		double maxd2, int options);
+kdtree_qres_t* kdtree_rangesearch(const kdtree_t* kd, const double* pt, double maxd2);
+void kdtree_free_query(kdtree_qres_t* res);
+/*!
+ * @brief 最近邻
+ * @param p_mindist2 输出: 距离平方. 可为NULL
+ * @return
+ * 最近数据点的原始序号
+ */
+int kdtree_nearest_neighbour(const kdtree_t* kd, const double* pt, double* p_mindist2);
+/*!
+ * @brief 节点的包围盒, 外部坐标
+ * @return
+ * 树包含包围盒时返回true
+ */
+bool kdtree_get_bboxes(const kdtree_t* kd, int nodeid, double* bblo, double* bbhi);
+double kdtree_get_splitval(const kdtree_t* kd, int nodeid);
+int kdtree_get_splitdim(const kdtree_t* kd, int nodeid);
+/*!
+ * @brief 遍历与查询框相交的节点, 见kdtree_funcs::nodes_contained
+ */
+void kdtree_nodes_contained(const kdtree_t* kd, const double* querylow, const double* queryhi,
+		void (*callback_contained)(const kdtree_t* kd, int node, void* extra),
+		void (*callback_overlap)(const kdtree_t* kd, int node, void* extra),
+		void* cb_extra);
+
 #endif /* SRC_KDTREE_H_ */
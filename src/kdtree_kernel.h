@@ -0,0 +1,496 @@
+/**
+ * @file kdtree_kernel.h K-D树查询的模板实现: 按外部坐标、树节点、数据点类型及维数特化
+ * @note
+ * - etype: 外部坐标(查询点及返回的数据点)类型; ttype: 包围盒与分割值类型; dtype: 数据点类型
+ * - ND > 0时维数为编译期常量, 内层循环可完全展开; ND = 0时使用kd->ndim
+ * - 整数类型(uint32_t, uint16_t)以minval为原点、scale为比例尺量化. 查询点一次换算到树坐标,
+ *   距离在树坐标下比较
+ * - kdtree_update_funcs()按树类型与维数选择实例填入kdtree_funcs, 每次查询仅经过一次间接调用
+ * - 遍历记录当前路径上各深度节点的位置, vEB排列下子节点位置由kd_path_slot()以O(1)递推
+ * - 由kdtree.cpp及性能评估程序包含
+ */
+
+#ifndef SRC_KDTREE_KERNEL_H_
+#define SRC_KDTREE_KERNEL_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include "kdtree.h"
+
+/*!
+ * @struct kd_traits 存储类型的属性: 整数类型需量化
+ */
+template<typename T> struct kd_traits {
+	static const bool quantized = false;
+};
+
+template<> struct kd_traits<uint32_t> {
+	static const bool quantized = true;
+};
+
+template<> struct kd_traits<uint16_t> {
+	static const bool quantized = true;
+};
+
+/*!
+ * @brief 节点深度, 根为0
+ */
+static inline int kd_depth(int nodeid) {
+	return 31 - __builtin_clz(uint32_t(nodeid + 1));
+}
+
+/*!
+ * @brief 由当前路径上祖先的位置递推节点位置. 堆序下即为节点编号
+ * @param path  path[k]为路径上深度k的节点位置, k < depth
+ * @param inner 0: bb的位置; 1: split/splitdim的位置
+ */
+static inline int32_t kd_path_slot(const kdtree_t* kd, const int32_t* path, int nodeid, int depth, int inner) {
+	if (!kd->veb) return nodeid;
+	if (!depth) return 0;
+	const kdtree_veb& v = kd->veb[inner];
+	return path[v.rootdepth[depth]] + v.top[depth] + ((nodeid + 1) & v.top[depth]) * v.bottom[depth];
+}
+
+template<typename etype, typename ttype, typename dtype, int ND>
+struct kdtree_kernel {
+	/* 维数上限, 用于栈上的查询点数组 */
+	enum {
+		NDIM = ND ? ND : KDTREE_MAX_DIM,
+		NSTACK = 64
+	};
+
+	static inline int dims(const kdtree_t* kd) {
+		return ND ? ND : kd->ndim;
+	}
+
+	static inline const dtype* row(const kdtree_t* kd, int i) {
+		return (const dtype*) kd->data.any + size_t(i) * dims(kd);
+	}
+
+	/*!
+	 * @brief 位置slot处的包围盒. slot见kd_path_slot()与kdtree_node_slot()
+	 */
+	static inline const ttype* lower(const kdtree_t* kd, int slot) {
+		return (const ttype*) kd->bb.any + size_t(2 * slot) * dims(kd);
+	}
+
+	static inline const ttype* upper(const kdtree_t* kd, int slot) {
+		return (const ttype*) kd->bb.any + size_t(2 * slot + 1) * dims(kd);
+	}
+
+	static inline double split_at(const kdtree_t* kd, int slot) {
+		return double(((const ttype*) kd->split.any)[slot]);
+	}
+
+	/*!
+	 * @brief 外部坐标换算为树坐标
+	 */
+	static inline double to_tree(const kdtree_t* kd, double v, int d) {
+		return kd_traits<dtype>::quantized ? (v - kd->minval[d]) * kd->scale : v;
+	}
+
+	/*!
+	 * @brief 树坐标换算为外部坐标
+	 */
+	static inline double to_ext(const kdtree_t* kd, double v, int d) {
+		return kd_traits<dtype>::quantized ? kd->minval[d] + v * kd->invscale : v;
+	}
+
+	/*!
+	 * @brief 外部距离平方换算为树坐标下的距离平方
+	 */
+	static inline double d2_to_tree(const kdtree_t* kd, double d2) {
+		return kd_traits<dtype>::quantized ? d2 * kd->scale * kd->scale : d2;
+	}
+
+	static inline double d2_to_ext(const kdtree_t* kd, double d2) {
+		return kd_traits<dtype>::quantized ? d2 * kd->invscale * kd->invscale : d2;
+	}
+
+	static inline void query_to_tree(const kdtree_t* kd, const etype* pt, double* q) {
+		for (int d = 0; d < dims(kd); ++d) q[d] = to_tree(kd, pt[d], d);
+	}
+
+	static inline double dist2(const double* q, const dtype* p, int D) {
+		double d2(0.0), delta;
+		for (int d = 0; d < D; ++d) {
+			delta = double(p[d]) - q[d];
+			d2 += delta * delta;
+		}
+		return d2;
+	}
+
+	/*!
+	 * @brief 查询点到节点包围盒的最小距离平方
+	 */
+	static inline double mindist2(const kdtree_t* kd, const double* q, int slot) {
+		const ttype* lo = lower(kd, slot);
+		const ttype* hi = upper(kd, slot);
+		double d2(0.0), delta;
+
+		for (int d = 0; d < dims(kd); ++d) {
+			if (q[d] < double(lo[d])) delta = double(lo[d]) - q[d];
+			else if (q[d] > double(hi[d])) delta = q[d] - double(hi[d]);
+			else continue;
+			d2 += delta * delta;
+		}
+		return d2;
+	}
+
+	/*!
+	 * @brief 查询点到节点包围盒的最大距离平方
+	 */
+	static inline double maxdist2(const kdtree_t* kd, const double* q, int slot) {
+		const ttype* lo = lower(kd, slot);
+		const ttype* hi = upper(kd, slot);
+		double d2(0.0), delta;
+
+		for (int d = 0; d < dims(kd); ++d) {
+			delta = std::max(q[d] - double(lo[d]), double(hi[d]) - q[d]);
+			d2 += delta * delta;
+		}
+		return d2;
+	}
+
+	/*!
+	 * @brief 加入查询结果. d2为树坐标下的距离平方, 负值表示未计算
+	 */
+	static void add_result(const kdtree_t* kd, kdtree_qres_t* res, int i, double d2, int options) {
+		const int D = dims(kd);
+
+		if (res->nres == res->capacity) {
+			res->capacity = res->capacity ? res->capacity * 2 : 64;
+			res->inds = (uint32_t*) realloc(res->inds, sizeof(uint32_t) * res->capacity);
+			if (options & KD_OPTIONS_COMPUTE_DISTS)
+				res->sdists = (double*) realloc(res->sdists, sizeof(double) * res->capacity);
+			if (options & KD_OPTIONS_RETURN_POINTS)
+				res->results.any = realloc(res->results.any, sizeof(etype) * D * res->capacity);
+		}
+		res->inds[res->nres] = kd->perm ? kd->perm[i] : uint32_t(i);
+		if (options & KD_OPTIONS_COMPUTE_DISTS) res->sdists[res->nres] = d2_to_ext(kd, d2);
+		if (options & KD_OPTIONS_RETURN_POINTS) {
+			etype* pt = (etype*) res->results.any + size_t(res->nres) * D;
+			const dtype* p = row(kd, i);
+			for (int d = 0; d < D; ++d) pt[d] = etype(to_ext(kd, p[d], d));
+		}
+		++res->nres;
+	}
+
+	/*!
+	 * @brief 按距离排序查询结果
+	 */
+	static void sort_results(const kdtree_t* kd, kdtree_qres_t* res, int options) {
+		const int D = dims(kd);
+		std::vector<unsigned int> order(res->nres);
+		std::vector<uint32_t> inds(res->inds, res->inds + res->nres);
+		std::vector<double> sdists(res->sdists, res->sdists + res->nres);
+		std::vector<etype> pts;
+		unsigned int k;
+
+		for (k = 0; k < res->nres; ++k) order[k] = k;
+		std::sort(order.begin(), order.end(), [&sdists](unsigned int a, unsigned int b) {
+			return sdists[a] < sdists[b];
+		});
+		if (options & KD_OPTIONS_RETURN_POINTS)
+			pts.assign((etype*) res->results.any, (etype*) res->results.any + size_t(res->nres) * D);
+		for (k = 0; k < res->nres; ++k) {
+			res->inds[k]   = inds[order[k]];
+			res->sdists[k] = sdists[order[k]];
+			if (options & KD_OPTIONS_RETURN_POINTS)
+				memcpy((etype*) res->results.any + size_t(k) * D, &pts[size_t(order[k]) * D], sizeof(etype) * D);
+		}
+	}
+
+	static void* get_data(const kdtree_t* kd, int i) {
+		return (void*) row(kd, i);
+	}
+
+	static void copy_data_double(const kdtree_t* kd, int start, int N, double* dest) {
+		const int D = dims(kd);
+		const dtype* p = row(kd, start);
+
+		for (size_t k = 0; k < size_t(N) * D; ++k) dest[k] = to_ext(kd, p[k], int(k % D));
+	}
+
+	static double get_splitval(const kdtree_t* kd, int nodeid) {
+		int slot = kdtree_node_slot(kd, nodeid, 1);
+		return to_ext(kd, split_at(kd, slot), kd->splitdim[slot]);
+	}
+
+	static int get_bboxes(const kdtree_t* kd, int nodeid, void* bblo, void* bbhi) {
+		if (!kd->bb.any) return 0;
+
+		int slot = kdtree_node_slot(kd, nodeid, 0);
+		const ttype* lo = lower(kd, slot);
+		const ttype* hi = upper(kd, slot);
+		for (int d = 0; d < dims(kd); ++d) {
+			((etype*) bblo)[d] = etype(to_ext(kd, lo[d], d));
+			((etype*) bbhi)[d] = etype(to_ext(kd, hi[d], d));
+		}
+		return 1;
+	}
+
+	static int check(const kdtree_t* kd) {
+		const int N = kd->ndata, D = dims(kd);
+		std::vector<bool> seen(N);
+		int i, d, k, nodeid, l, r, m;
+
+		for (i = 0; i < N && kd->perm; ++i) {
+			if (kd->perm[i] >= uint32_t(N) || seen[kd->perm[i]]) {
+				printf ("kdtree: perm[%d] = %u is not a permutation\n", i, kd->perm[i]);
+				return -1;
+			}
+			seen[kd->perm[i]] = true;
+		}
+		for (k = 0; k < kd->nbottom; ++k) {
+			if (kd->lr[k] < (k ? kd->lr[k - 1] : -1) || kd->lr[k] >= N) {
+				printf ("kdtree: leaf %d ends at %d\n", k, kd->lr[k]);
+				return -1;
+			}
+		}
+		if (kd->lr[kd->nbottom - 1] != N - 1) {
+			printf ("kdtree: leaves cover %d of %d points\n", kd->lr[kd->nbottom - 1] + 1, N);
+			return -1;
+		}
+
+		for (nodeid = 0; nodeid < kd->nnodes; ++nodeid) {
+			l = kdtree_left(kd, nodeid);
+			r = kdtree_right(kd, nodeid);
+			if (kd->bb.any) {
+				const ttype* lo = lower(kd, kdtree_node_slot(kd, nodeid, 0));
+				const ttype* hi = upper(kd, kdtree_node_slot(kd, nodeid, 0));
+				for (i = l; i <= r; ++i) {
+					const dtype* p = row(kd, i);
+					for (d = 0; d < D; ++d) {
+						if (double(p[d]) < double(lo[d]) || double(p[d]) > double(hi[d])) {
+							printf ("kdtree: point %d lies outside the bounding box of node %d\n", i, nodeid);
+							return -1;
+						}
+					}
+				}
+			}
+			if (kd->split.any && nodeid < kd->ninterior) {
+				double split = split_at(kd, kdtree_node_slot(kd, nodeid, 1));
+				m = kdtree_right(kd, 2 * nodeid + 1);
+				d = kd->splitdim[kdtree_node_slot(kd, nodeid, 1)];
+				for (i = l; i <= r; ++i) {
+					double v = double(row(kd, i)[d]);
+					if (i <= m ? v > split : v < split) {
+						printf ("kdtree: point %d lies on the wrong side of node %d\n", i, nodeid);
+						return -1;
+					}
+				}
+			}
+		}
+		return 0;
+	}
+
+	/*!
+	 * @brief 由数据点计算叶节点的包围盒, 再逐层合并为内部节点的包围盒
+	 */
+	static void fix_bounding_boxes(kdtree_t* kd) {
+		const int D = dims(kd);
+		ttype* bb = (ttype*) kd->bb.any;
+		int nodeid, i, d;
+
+		if (!bb) return;
+		for (nodeid = kd->ninterior; nodeid < kd->nnodes; ++nodeid) {
+			ttype* lo = bb + size_t(2 * kdtree_node_slot(kd, nodeid, 0)) * D;
+			ttype* hi = lo + D;
+			int l = kdtree_left(kd, nodeid), r = kdtree_right(kd, nodeid);
+			for (d = 0; d < D; ++d) lo[d] = hi[d] = ttype(row(kd, l)[d]);
+			for (i = l + 1; i <= r; ++i) {
+				const dtype* p = row(kd, i);
+				for (d = 0; d < D; ++d) {
+					lo[d] = std::min(lo[d], ttype(p[d]));
+					hi[d] = std::max(hi[d], ttype(p[d]));
+				}
+			}
+		}
+		for (nodeid = kd->ninterior - 1; nodeid >= 0; --nodeid) {
+			ttype* self = bb + size_t(2 * kdtree_node_slot(kd, nodeid, 0)) * D;
+			const ttype* left = bb + size_t(2 * kdtree_node_slot(kd, 2 * nodeid + 1, 0)) * D;
+			const ttype* right = bb + size_t(2 * kdtree_node_slot(kd, 2 * nodeid + 2, 0)) * D;
+			for (d = 0; d < D; ++d) {
+				self[d] = std::min(left[d], right[d]);
+				self[D + d] = std::max(left[D + d], right[D + d]);
+			}
+		}
+	}
+
+	/*!
+	 * @brief 最近邻. 有包围盒时以包围盒剪枝, 否则以分割面剪枝
+	 * @param bestd2 输入: 搜索半径的平方; 输出: 最近点的距离平方. 外部坐标
+	 * @param pbest  输出: 最近点的树序. 半径内没有数据点时不变
+	 */
+	static void nearest_neighbour_internal(const kdtree_t* kd, const void* query, double* bestd2, int* pbest) {
+		const int D = dims(kd);
+		double q[NDIM], best = d2_to_tree(kd, *bestd2), d2, d2near, d2far, delta;
+		int stack[NSTACK];
+		double stackd2[NSTACK];
+		int32_t path[KDTREE_MAX_LEVELS], ipath[KDTREE_MAX_LEVELS];
+		int n(0), nodeid, depth, i, r, ibest(-1), near;
+
+		query_to_tree(kd, (const etype*) query, q);
+		stack[n] = 0;
+		stackd2[n++] = kd->bb.any ? mindist2(kd, q, 0) : 0.0;
+		while (n) {
+			nodeid = stack[--n];
+			if (stackd2[n] > best) continue;
+			if (nodeid >= kd->ninterior) {
+				for (i = kdtree_left(kd, nodeid), r = kdtree_right(kd, nodeid); i <= r; ++i) {
+					if ((d2 = dist2(q, row(kd, i), D)) <= best) best = d2, ibest = i;
+				}
+				continue;
+			}
+			depth = kd_depth(nodeid);
+			// 先搜索较近的子节点: 入栈顺序为远, 近
+			if (kd->bb.any) {
+				path[depth] = kd_path_slot(kd, path, nodeid, depth, 0);
+				d2near = mindist2(kd, q, kd_path_slot(kd, path, 2 * nodeid + 1, depth + 1, 0));
+				d2far  = mindist2(kd, q, kd_path_slot(kd, path, 2 * nodeid + 2, depth + 1, 0));
+				near   = 2 * nodeid + 1;
+				if (d2far < d2near) std::swap(d2near, d2far), near = 2 * nodeid + 2;
+			}
+			else {
+				ipath[depth] = kd_path_slot(kd, ipath, nodeid, depth, 1);
+				delta  = q[kd->splitdim[ipath[depth]]] - split_at(kd, ipath[depth]);
+				near   = delta <= 0.0 ? 2 * nodeid + 1 : 2 * nodeid + 2;
+				d2near = stackd2[n];
+				d2far  = std::max(d2near, delta * delta);
+			}
+			if (d2far <= best) {
+				stack[n] = near == 2 * nodeid + 1 ? 2 * nodeid + 2 : 2 * nodeid + 1;
+				stackd2[n++] = d2far;
+			}
+			if (d2near <= best) {
+				stack[n] = near;
+				stackd2[n++] = d2near;
+			}
+		}
+		if (ibest >= 0) {
+			*bestd2 = d2_to_ext(kd, best);
+			*pbest  = ibest;
+		}
+	}
+
+	/*!
+	 * @brief 查找与pt距离平方不大于maxd2的数据点
+	 * @note
+	 * 节点包围盒整体位于半径内且无需距离时直接加入其全部数据点
+	 */
+	static kdtree_qres_t* rangesearch(const kdtree_t* kd, kdtree_qres_t* res, const void* pt, double maxd2,
+			int options) {
+		const int D = dims(kd);
+		double q[NDIM], r2 = d2_to_tree(kd, maxd2), d2, delta;
+		int stack[NSTACK];
+		int32_t path[KDTREE_MAX_LEVELS], ipath[KDTREE_MAX_LEVELS];
+		int n(0), nodeid, depth, i, r;
+		bool inside;
+
+		if (!res) res = (kdtree_qres_t*) calloc(1, sizeof(kdtree_qres_t));
+		res->nres = 0;
+		if (options & KD_OPTIONS_SORT_DISTS) options |= KD_OPTIONS_COMPUTE_DISTS;
+		if ((options & KD_OPTIONS_COMPUTE_DISTS) && !res->sdists && res->capacity)
+			res->sdists = (double*) malloc(sizeof(double) * res->capacity);
+		if ((options & KD_OPTIONS_RETURN_POINTS) && !res->results.any && res->capacity)
+			res->results.any = malloc(sizeof(etype) * D * res->capacity);
+
+		query_to_tree(kd, (const etype*) pt, q);
+		stack[n++] = 0;
+		while (n) {
+			nodeid = stack[--n];
+			depth  = kd_depth(nodeid);
+			inside = false;
+			if (kd->bb.any) {
+				path[depth] = kd_path_slot(kd, path, nodeid, depth, 0);
+				if (mindist2(kd, q, path[depth]) > r2) continue;
+				inside = !(options & KD_OPTIONS_COMPUTE_DISTS) && maxdist2(kd, q, path[depth]) <= r2;
+			}
+			if (inside || nodeid >= kd->ninterior) {
+				for (i = kdtree_left(kd, nodeid), r = kdtree_right(kd, nodeid); i <= r; ++i) {
+					if (inside) add_result(kd, res, i, -1.0, options);
+					else if ((d2 = dist2(q, row(kd, i), D)) <= r2) add_result(kd, res, i, d2, options);
+				}
+				continue;
+			}
+			if (kd->bb.any) {
+				stack[n++] = 2 * nodeid + 2;
+				stack[n++] = 2 * nodeid + 1;
+			}
+			else {
+				ipath[depth] = kd_path_slot(kd, ipath, nodeid, depth, 1);
+				delta = q[kd->splitdim[ipath[depth]]] - split_at(kd, ipath[depth]);
+				if (delta >= 0.0 || delta * delta <= r2) stack[n++] = 2 * nodeid + 2;
+				if (delta <= 0.0 || delta * delta <= r2) stack[n++] = 2 * nodeid + 1;
+			}
+		}
+		if ((options & KD_OPTIONS_SORT_DISTS) && res->nres > 1) sort_results(kd, res, options);
+		return res;
+	}
+
+	/*!
+	 * @brief 遍历与查询框[querylow, queryhigh]相交的节点: 完全包含于查询框的节点调用callback_contained,
+	 * 部分相交的叶节点调用callback_overlap. 需要包围盒
+	 */
+	static void nodes_contained(const kdtree_t* kd, const void* querylow, const void* queryhi,
+			void (*callback_contained)(const kdtree_t* kd, int node, void* extra),
+			void (*callback_overlap)(const kdtree_t* kd, int node, void* extra),
+			void* cb_extra) {
+		const int D = dims(kd);
+		double qlo[NDIM], qhi[NDIM];
+		int stack[NSTACK];
+		int32_t path[KDTREE_MAX_LEVELS];
+		int n(0), nodeid, depth, d;
+		bool contained;
+
+		if (!kd->bb.any) return;
+		query_to_tree(kd, (const etype*) querylow, qlo);
+		query_to_tree(kd, (const etype*) queryhi, qhi);
+		stack[n++] = 0;
+		while (n) {
+			nodeid = stack[--n];
+			depth  = kd_depth(nodeid);
+			path[depth] = kd_path_slot(kd, path, nodeid, depth, 0);
+			const ttype* lo = lower(kd, path[depth]);
+			const ttype* hi = upper(kd, path[depth]);
+			for (d = 0, contained = true; d < D; ++d) {
+				if (double(hi[d]) < qlo[d] || double(lo[d]) > qhi[d]) break;
+				contained = contained && double(lo[d]) >= qlo[d] && double(hi[d]) <= qhi[d];
+			}
+			if (d < D) continue;
+			if (contained) {
+				if (callback_contained) callback_contained(kd, nodeid, cb_extra);
+			}
+			else if (nodeid >= kd->ninterior) {
+				if (callback_overlap) callback_overlap(kd, nodeid, cb_extra);
+			}
+			else {
+				stack[n++] = 2 * nodeid + 2;
+				stack[n++] = 2 * nodeid + 1;
+			}
+		}
+	}
+
+	/*!
+	 * @brief 将本实例填入kdtree_funcs
+	 */
+	static void install(kdtree_funcs& funcs) {
+		memset(&funcs, 0, sizeof(funcs));
+		funcs.get_data            = get_data;
+		funcs.copy_data_double    = copy_data_double;
+		funcs.get_splitval        = get_splitval;
+		funcs.get_bboxes          = get_bboxes;
+		funcs.check               = check;
+		funcs.fix_bounding_boxes  = fix_bounding_boxes;
+		funcs.nearest_neighbour_internal = nearest_neighbour_internal;
+		funcs.rangesearch         = rangesearch;
+		funcs.nodes_contained     = nodes_contained;
+	}
+};
+
+#endif /* SRC_KDTREE_KERNEL_H_ */
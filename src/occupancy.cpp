@@ -0,0 +1,254 @@
+/**
+ * @file occupancy.cpp 定义HEALPix像元占用位图
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "occupancy.h"
+#include "healpix.h"
+
+using namespace std;
+
+#define OCC_BLOCK	4096	//< 批量计算像元时每次处理的恒星数
+
+OccupancyMap::OccupancyMap() {
+	nside  = 0;
+	scheme = HEALPIX_RING;
+}
+
+void OccupancyMap::Reset(int nside) {
+	this->nside  = nside;
+	this->scheme = occupancy_scheme(nside);
+	cont.clear();
+}
+
+void OccupancyMap::swap(OccupancyMap& other) {
+	std::swap(nside, other.nside);
+	std::swap(scheme, other.scheme);
+	cont.swap(other.cont);
+}
+
+occupancy_container& OccupancyMap::Container(uint64_t key) {
+	size_t l = 0, r = cont.size(), m;
+
+	while (l < r) {
+		m = (l + r) / 2;
+		if (cont[m].key < key) l = m + 1;
+		else r = m;
+	}
+	if (l == cont.size() || cont[l].key != key) {
+		occupancy_container c;
+		c.key  = key;
+		c.card = 0;
+		cont.insert(cont.begin() + l, c);
+	}
+	return cont[l];
+}
+
+void OccupancyMap::AddLow(occupancy_container& c, const uint16_t* low, int n) {
+	int i;
+
+	if (c.bits.empty() && c.card + n <= OCC_ARRAY_MAX) {// 数组容器: 归并
+		vector<uint16_t> merged(c.card + n);
+		merged.resize(set_union(c.array.begin(), c.array.end(), low, low + n, merged.begin()) - merged.begin());
+		c.array.swap(merged);
+		c.card = uint32_t(c.array.size());
+		return;
+	}
+	if (c.bits.empty()) {// 转换为位图容器
+		c.bits.assign(OCC_WORDS, 0);
+		for (i = 0; i < int(c.card); ++i) c.bits[c.array[i] >> 6] |= 1ULL << (c.array[i] & 63);
+		vector<uint16_t>().swap(c.array);
+	}
+	for (i = 0; i < n; ++i) {
+		uint64_t& word = c.bits[low[i] >> 6];
+		uint64_t bit = 1ULL << (low[i] & 63);
+		c.card += !(word & bit);
+		word |= bit;
+	}
+}
+
+void OccupancyMap::Add(const int64_t* pix, int n) {
+	vector<int64_t> sorted(pix, pix + n);
+	vector<uint16_t> low;
+	int i, j;
+
+	sort(sorted.begin(), sorted.end());
+	sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+	for (i = 0; i < int(sorted.size()); i = j) {
+		uint64_t key = uint64_t(sorted[i]) >> 16;
+		low.clear();
+		for (j = i; j < int(sorted.size()) && uint64_t(sorted[j]) >> 16 == key; ++j)
+			low.push_back(uint16_t(sorted[j] & 0xFFFF));
+		AddLow(Container(key), &low[0], int(low.size()));
+	}
+}
+
+void OccupancyMap::AddStars(const uint32_t* ra, const uint32_t* spd, int n) {
+	int64_t pix[OCC_BLOCK];
+	int i, m;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < OCC_BLOCK ? n - i : OCC_BLOCK;
+		healpix_mas2pix_batch(nside, scheme, ra + i, spd + i, m, pix);
+		Add(pix, m);
+	}
+}
+
+void OccupancyMap::Merge(const OccupancyMap& other) {
+	vector<uint16_t> low;
+	int w;
+
+	for (size_t k = 0; k < other.cont.size(); ++k) {
+		const occupancy_container& src = other.cont[k];
+		occupancy_container& dst = Container(src.key);
+
+		if (src.bits.empty()) AddLow(dst, &src.array[0], int(src.card));
+		else {// 位图容器: 按字合并
+			if (dst.bits.empty()) {
+				low.swap(dst.array);
+				dst.bits.assign(src.bits.begin(), src.bits.end());
+				dst.card = src.card;
+				AddLow(dst, low.empty() ? NULL : &low[0], int(low.size()));
+				low.clear();
+				continue;
+			}
+			for (w = 0, dst.card = 0; w < OCC_WORDS; ++w) {
+				dst.bits[w] |= src.bits[w];
+				dst.card += __builtin_popcountll(dst.bits[w]);
+			}
+		}
+	}
+}
+
+bool OccupancyMap::Contains(int64_t pix) const {
+	return pix >= 0 && Next(pix) == pix;
+}
+
+int64_t OccupancyMap::Next(int64_t pix) const {
+	uint64_t key = uint64_t(pix) >> 16;
+	size_t l = 0, r = cont.size(), m;
+	int low = int(pix & 0xFFFF), w;
+	uint64_t word;
+
+	if (pix < 0) key = 0, low = 0;
+	while (l < r) {
+		m = (l + r) / 2;
+		if (cont[m].key < key) l = m + 1;
+		else r = m;
+	}
+	for (; l < cont.size(); ++l, low = 0) {
+		const occupancy_container& c = cont[l];
+		if (c.key != key) low = 0;
+		if (c.bits.empty()) {
+			vector<uint16_t>::const_iterator it = lower_bound(c.array.begin(), c.array.end(), uint16_t(low));
+			if (it != c.array.end()) return int64_t(c.key << 16) + *it;
+		}
+		else {
+			w = low >> 6;
+			word = c.bits[w] & (~0ULL << (low & 63));
+			while (!word && ++w < OCC_WORDS) word = c.bits[w];
+			if (word) return int64_t(c.key << 16) + w * 64 + __builtin_ctzll(word);
+		}
+	}
+	return -1;
+}
+
+int64_t OccupancyMap::Count() const {
+	int64_t count(0);
+	for (size_t k = 0; k < cont.size(); ++k) count += cont[k].card;
+	return count;
+}
+
+int64_t OccupancyMap::Bytes() const {
+	int64_t bytes(0);
+	for (size_t k = 0; k < cont.size(); ++k)
+		bytes += cont[k].bits.empty() ? cont[k].card * sizeof(uint16_t) : OCC_WORDS * sizeof(uint64_t);
+	return bytes;
+}
+
+bool OccupancyMap::Save(const char* filepath, uint64_t catkey) const {
+	occupancy_header hdr;
+	char pathtmp[PATH_MAX + 8];
+	FILE* fp;
+	bool rslt;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, OCC_MAGIC, sizeof(hdr.magic));
+	hdr.version   = OCC_VERSION;
+	hdr.byteorder = 0x01020304;
+	hdr.nside     = nside;
+	hdr.scheme    = scheme;
+	hdr.catkey    = catkey;
+	hdr.ncont     = int64_t(cont.size());
+	hdr.count     = Count();
+
+	snprintf(pathtmp, sizeof(pathtmp), "%s.tmp", filepath);
+	if (!(fp = fopen(pathtmp, "wb"))) return false;
+	rslt = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+	for (size_t k = 0; k < cont.size() && rslt; ++k) {
+		const occupancy_container& c = cont[k];
+		const uint16_t* array = c.bits.empty() ? &c.array[0] : NULL;
+		vector<uint16_t> low;
+
+		if (array == NULL && c.card <= OCC_ARRAY_MAX) {// 合并后像元数较少的位图容器以数组写出
+			for (int v = 0; v < 65536; ++v) {
+				if ((c.bits[v >> 6] >> (v & 63)) & 1) low.push_back(uint16_t(v));
+			}
+			array = &low[0];
+		}
+		rslt = fwrite(&c.key, sizeof(c.key), 1, fp) == 1 && fwrite(&c.card, sizeof(c.card), 1, fp) == 1
+				&& (array ? fwrite(array, sizeof(uint16_t), c.card, fp) == c.card
+						: fwrite(&c.bits[0], sizeof(uint64_t), OCC_WORDS, fp) == OCC_WORDS);
+	}
+	rslt = !fclose(fp) && rslt && !rename(pathtmp, filepath);
+	if (!rslt) remove(pathtmp);
+	return rslt;
+}
+
+bool OccupancyMap::Load(const char* filepath, int nside, uint64_t& catkey) {
+	occupancy_header hdr;
+	FILE* fp;
+	bool rslt;
+
+	Reset(nside);
+	if (!(fp = fopen(filepath, "rb"))) return false;
+	rslt = fread(&hdr, sizeof(hdr), 1, fp) == 1
+			&& !memcmp(hdr.magic, OCC_MAGIC, sizeof(hdr.magic)) && hdr.version == OCC_VERSION
+			&& hdr.byteorder == 0x01020304 && hdr.nside == nside && hdr.scheme == scheme && hdr.ncont >= 0;
+	for (int64_t k = 0; k < hdr.ncont && rslt; ++k) {
+		occupancy_container c;
+		rslt = fread(&c.key, sizeof(c.key), 1, fp) == 1 && fread(&c.card, sizeof(c.card), 1, fp) == 1
+				&& c.card > 0 && c.card <= 65536 && (cont.empty() || c.key > cont.back().key);
+		if (!rslt) break;
+		if (c.card <= OCC_ARRAY_MAX) {
+			c.array.resize(c.card);
+			rslt = fread(&c.array[0], sizeof(uint16_t), c.card, fp) == c.card;
+		}
+		else {
+			c.bits.resize(OCC_WORDS);
+			rslt = fread(&c.bits[0], sizeof(uint64_t), OCC_WORDS, fp) == OCC_WORDS;
+		}
+		cont.push_back(c);
+	}
+	fclose(fp);
+	if (rslt && Count() == hdr.count) catkey = hdr.catkey;
+	else {
+		cont.clear();
+		rslt = false;
+	}
+	return rslt;
+}
+
+int occupancy_scheme(int nside) {
+	return nside > 0 && !(nside & (nside - 1)) ? HEALPIX_NEST : HEALPIX_RING;
+}
+
+bool occupancy_path(const char* pathcat, int nside, char* filepath) {
+	const char* slash = strrchr(pathcat, '/');
+	const char* dot = strrchr(slash ? slash : pathcat, '.');
+	int len = dot && !strcmp(dot, ".fit") ? int(dot - pathcat) : int(strlen(pathcat));
+
+	return snprintf(filepath, PATH_MAX, "%.*s.occ%d", len, pathcat, nside) < PATH_MAX;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file occupancy.h 声明HEALPix像元占用位图
+ * @note
+ * - 按Roaring位图组织: 像元编号右移16位为容器键值, 低16位存入容器. 容器内不多于OCC_ARRAY_MAX个
+ *   像元时为升序数组, 否则为65536位的位图
+ * - nside为2的幂时采用NESTED编号, 天区内相邻的像元集中于少数容器; 否则采用RING编号
+ * - 文件格式: occupancy_header, 之后依次为各容器: 键值(uint64_t), 像元数(uint32_t), 升序数组(像元数
+ *   不多于OCC_ARRAY_MAX)或位图. 以本机字节序存储
+ */
+
+#ifndef SRC_OCCUPANCY_H_
+#define SRC_OCCUPANCY_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <vector>
+
+#define OCC_MAGIC		"ASTIOCC"
+#define OCC_VERSION		1
+#define OCC_ARRAY_MAX	4096	//< 数组容器的像元数上限
+#define OCC_WORDS		1024	//< 位图容器的64位字数
+
+/*!
+ * @struct occupancy_header 位图文件头
+ */
+typedef struct {
+	char magic[8];		//< OCC_MAGIC
+	uint32_t version;	//< OCC_VERSION
+	uint32_t byteorder;	//< 0x01020304, 以本机字节序写入
+	int32_t nside;
+	int32_t scheme;		//< 编号方案, HEALPIX_RING或HEALPIX_NEST
+	uint64_t catkey;	//< 中间星表的参数与源文件键值, 见catcache_key()
+	int64_t ncont;		//< 容器数量
+	int64_t count;		//< 占用像元数
+} occupancy_header;
+
+/*!
+ * @struct occupancy_container 容器: 键值相同的像元
+ */
+typedef struct {
+	uint64_t key;
+	uint32_t card;	//< 像元数
+	std::vector<uint16_t> array;	//< 数组容器: 升序排列的低16位
+	std::vector<uint64_t> bits;		//< 位图容器: OCC_WORDS个字. 非空时为位图容器
+} occupancy_container;
+
+/*!
+ * @struct OccupancyMap 像元占用位图
+ */
+struct OccupancyMap {
+protected:
+	int nside;
+	int scheme;
+	std::vector<occupancy_container> cont;	//< 按键值升序排列
+
+protected:
+	/*!
+	 * @brief 查找或插入键值为key的容器
+	 */
+	occupancy_container& Container(uint64_t key);
+	/*!
+	 * @brief 向容器加入升序且不重复的低16位
+	 */
+	static void AddLow(occupancy_container& c, const uint16_t* low, int n);
+
+public:
+	OccupancyMap();
+	/*!
+	 * @brief 清空并设置网格. 编号方案由occupancy_scheme()决定
+	 */
+	void Reset(int nside);
+	int Nside() const {
+		return nside;
+	}
+	int Scheme() const {
+		return scheme;
+	}
+	void clear() {
+		cont.clear();
+	}
+	void swap(OccupancyMap& other);
+	/*!
+	 * @brief 加入像元
+	 */
+	void Add(const int64_t* pix, int n);
+	/*!
+	 * @brief 加入恒星所在的像元
+	 * @param ra, spd 位置, 量纲: 毫角秒
+	 */
+	void AddStars(const uint32_t* ra, const uint32_t* spd, int n);
+	/*!
+	 * @brief 并入另一位图. 两者网格须一致
+	 */
+	void Merge(const OccupancyMap& other);
+	bool Contains(int64_t pix) const;
+	/*!
+	 * @brief 查找不小于pix的首个占用像元
+	 * @return
+	 * 像元编号. 没有时返回-1
+	 * @note
+	 * 遍历: for (pix = map.Next(0); pix >= 0; pix = map.Next(pix + 1))
+	 */
+	int64_t Next(int64_t pix) const;
+	/*!
+	 * @brief 占用像元数
+	 */
+	int64_t Count() const;
+	/*!
+	 * @brief 容器占用的字节数
+	 */
+	int64_t Bytes() const;
+	/*!
+	 * @brief 写入文件. 先写入临时文件, 完成后改名
+	 * @param catkey 中间星表的键值, 供后续构建判断能否复用
+	 */
+	bool Save(const char* filepath, uint64_t catkey) const;
+	/*!
+	 * @brief 读取文件
+	 * @param nside  期望的网格
+	 * @param catkey 输出: 中间星表的键值
+	 * @return
+	 * 文件存在, 完整且网格一致时返回true
+	 */
+	bool Load(const char* filepath, int nside, uint64_t& catkey);
+};
+
+/*!
+ * @brief 位图采用的编号方案: nside为2的幂时为HEALPIX_NEST, 否则为HEALPIX_RING
+ */
+int occupancy_scheme(int nside);
+/*!
+ * @brief 位图文件路径: 与中间星表同目录, <星表文件名去掉.fit>.occ<nside>
+ * @param filepath 输出: 路径, 长度为PATH_MAX
+ * @return
+ * 路径超出PATH_MAX时返回false
+ */
+bool occupancy_path(const char* pathcat, int nside, char* filepath);
+
+#endif /* SRC_OCCUPANCY_H_ */
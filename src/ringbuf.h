@@ -0,0 +1,66 @@
+/**
+ * @file ringbuf.h 单生产者/单消费者无锁环形队列
+ */
+
+#ifndef SRC_RINGBUF_H_
+#define SRC_RINGBUF_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/*!
+ * @class spsc_ring 单生产者/单消费者无锁环形队列
+ * - 容量向上取整为2的幂
+ * - 仅一个线程调用TryPush(), 仅一个线程调用TryPop()
+ */
+template <class T>
+class spsc_ring {
+protected:
+	std::vector<T> buff;	//< 存储区
+	size_t mask;			//< 容量 - 1
+	alignas(64) std::atomic<size_t> head;	//< 消费位置
+	alignas(64) std::atomic<size_t> tail;	//< 生产位置
+
+public:
+	explicit spsc_ring(size_t capacity) {
+		size_t n(1);
+		while (n < capacity) n <<= 1;
+		buff.resize(n);
+		mask = n - 1;
+		head.store(0);
+		tail.store(0);
+	}
+
+	size_t Capacity() const {
+		return mask + 1;
+	}
+
+	/*!
+	 * @brief 入队
+	 * @return
+	 * 队列已满时返回false
+	 */
+	bool TryPush(const T& val) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) > mask) return false;
+		buff[t & mask] = val;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*!
+	 * @brief 出队
+	 * @return
+	 * 队列为空时返回false
+	 */
+	bool TryPop(T& val) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		val = buff[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+#endif /* SRC_RINGBUF_H_ */
@@ -8,6 +8,9 @@
 #include <stdint.h>
 #include "kdtree.h"
 
+#define STARTREE_NLEAF	25	//< 星表K-D树叶节点的平均恒星数
+#define STARTREE_QUANT_ERROR	0.01	//< 量化误差上限与jitter之比. 单位球面上弦长与角距一致, 通常为u32
+
 typedef struct {
 	kdtree_t*		tree;
 //	qfits_header*	header;
@@ -0,0 +1,443 @@
+/**
+ * @file tblcomp.cpp 二进制表分块压缩的并行读写
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tblcomp.h"
+
+using namespace std;
+
+typedef vector<string> fits_cards;
+typedef vector<vector<unsigned char> > tile_columns;	//< 瓦片内各列的压缩数据
+
+const char* tbl_compress_algor(const char* name) {
+	if (!strcasecmp(name, "rice") || !strcasecmp(name, "RICE_1")) return "RICE_1";
+	if (!strcasecmp(name, "gzip") || !strcasecmp(name, "GZIP_1")) return "GZIP_1";
+	if (!strcasecmp(name, "gzip2") || !strcasecmp(name, "GZIP_2")) return "GZIP_2";
+	return NULL;
+}
+
+bool tbl_is_compressed(FITSHandler& hin) {
+	int type, zflag(0), status(0);
+
+	fits_get_hdu_type(hin(), &type, &status);
+	if (status || type != BINARY_TBL) return false;
+	fits_read_key(hin(), TLOGICAL, "ZTABLE", &zflag, NULL, &status);
+	return !status && zflag;
+}
+
+/*!
+ * @brief 读取当前HDU头区的全部关键字记录(不含END)
+ */
+static void read_cards(fitsfile* fptr, fits_cards& cards, int* status) {
+	char card[FLEN_CARD];
+	int nkey, nmore, i;
+
+	cards.clear();
+	fits_get_hdrspace(fptr, &nkey, &nmore, status);
+	for (i = 1; i <= nkey && !*status; ++i) {
+		fits_read_record(fptr, i, card, status);
+		cards.push_back(card);
+	}
+}
+
+/*!
+ * @brief 以cards为头区在文件尾创建HDU, 并按rows修正表结构
+ * @param rows  表行数, NAXIS2
+ * @param zrows 原始表行数, ZNAXIS2. 小于0时不修改
+ * @note
+ * 堆为空(PCOUNT = 0), 写入变长数组时由cfitsio扩展
+ */
+static void write_cards(fitsfile* fptr, const fits_cards& cards, LONGLONG rows, LONGLONG zrows, int* status) {
+	fits_create_hdu(fptr, status);
+	for (size_t i = 0; i < cards.size() && !*status; ++i) fits_write_record(fptr, cards[i].c_str(), status);
+	fits_modify_key_lng(fptr, "NAXIS2", rows, "&", status);
+	fits_modify_key_lng(fptr, "PCOUNT", 0, "&", status);
+	if (zrows >= 0) fits_modify_key_lng(fptr, "ZNAXIS2", zrows, "&", status);
+	fits_set_hdustruc(fptr, status);
+}
+
+/*!
+ * @brief 读取压缩表第row行(瓦片)各列的压缩数据
+ */
+static void read_tile(fitsfile* fptr, LONGLONG row, int ncol, tile_columns& cols, int* status) {
+	LONGLONG len, offset;
+
+	cols.resize(ncol);
+	for (int c = 0; c < ncol && !*status; ++c) {
+		fits_read_descriptll(fptr, c + 1, row, &len, &offset, status);
+		cols[c].resize(*status ? 0 : size_t(len));
+		if (len > 0) fits_read_col(fptr, TBYTE, c + 1, row, 1, len, NULL, &cols[c][0], NULL, status);
+	}
+}
+
+/*!
+ * @brief 向压缩表第row行(瓦片)写入各列的压缩数据. 数据追加到堆
+ */
+static void write_tile(fitsfile* fptr, LONGLONG row, tile_columns& cols, int* status) {
+	for (size_t c = 0; c < cols.size() && !*status; ++c) {
+		if (cols[c].size())
+			fits_write_col(fptr, TBYTE, int(c + 1), row, 1, LONGLONG(cols[c].size()), &cols[c][0], status);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 压缩 */
+/*!
+ * @struct comp_tile 压缩结果暂存区
+ */
+typedef struct {
+	int state;			//< 0: 未完成; 1: 完成; -1: 失败
+	tile_columns cols;	//< 各列压缩数据
+} comp_tile;
+
+/*!
+ * @struct comp_pool 压缩线程共享数据
+ * 工作线程按序领取瓦片, 领先写入位置不超过window个瓦片
+ */
+struct comp_pool {
+	const unsigned char* data;	//< 原始表数据区
+	long rowlen;		//< 行长
+	LONGLONG nrows;		//< 原始表行数
+	long tilelen;		//< 每瓦片行数
+	long ntile;			//< 瓦片数
+	const char* algor;	//< 压缩算法
+	fits_cards cards;	//< 原始表头区
+	fits_cards zcards;	//< 压缩表头区, 由瓦片0得到
+
+	mutex mtx;
+	condition_variable cv_tile;	//< 通知: 可领取新瓦片
+	condition_variable cv_done;	//< 通知: 有瓦片完成压缩
+	long next_tile;		//< 下一个待领取的瓦片
+	long next_write;	//< 下一个待写入的瓦片
+	long window;		//< 暂存区数量
+	bool abort;
+	vector<comp_tile> slot;	//< 暂存区, 瓦片t使用slot[t % window]
+};
+
+/*!
+ * @brief 在内存文件中压缩瓦片t
+ */
+static bool compress_tile(comp_pool* pool, long t, comp_tile& tile) {
+	FITSHandler tin, tout;
+	LONGLONG first = LONGLONG(t) * pool->tilelen;
+	LONGLONG rows  = pool->nrows - first < pool->tilelen ? pool->nrows - first : pool->tilelen;
+	long tilelen   = pool->tilelen;
+	int ncol;
+
+	if (!tin("mem://", 2) || !tout("mem://", 2)) return false;
+	// 以瓦片内的行构建小表, 由FZALGOR/FZTILELN指定算法与瓦片长度
+	fits_create_img(tin(), BYTE_IMG, 0, NULL, tin.Status());
+	write_cards(tin(), pool->cards, rows, -1, tin.Status());
+	fits_update_key(tin(), TSTRING, "FZALGOR", (void*) pool->algor, NULL, tin.Status());
+	fits_update_key(tin(), TLONG, "FZTILELN", &tilelen, NULL, tin.Status());
+	fits_write_tblbytes(tin(), 1, 1, rows * pool->rowlen,
+			(unsigned char*) pool->data + first * pool->rowlen, tin.Status());
+	if (!tin.Success()) return false;
+
+	fits_create_img(tout(), BYTE_IMG, 0, NULL, tout.Status());
+	fits_compress_table(tin(), tout(), tout.Status());
+	fits_get_num_cols(tout(), &ncol, tout.Status());
+	read_tile(tout(), 1, ncol, tile.cols, tout.Status());
+	if (t == 0) read_cards(tout(), pool->zcards, tout.Status());
+	return tout.Success();
+}
+
+static void comp_worker(comp_pool* pool) {
+	long t;
+	bool rslt;
+
+	while (1) {
+		unique_lock<mutex> lck(pool->mtx);
+		while (!pool->abort && pool->next_tile < pool->ntile
+				&& pool->next_tile >= pool->next_write + pool->window)
+			pool->cv_tile.wait(lck);
+		if (pool->abort || pool->next_tile >= pool->ntile) break;
+		t = pool->next_tile++;
+		lck.unlock();
+
+		rslt = compress_tile(pool, t, pool->slot[t % pool->window]);
+
+		lck.lock();
+		pool->slot[t % pool->window].state = rslt ? 1 : -1;
+		pool->cv_done.notify_all();
+	}
+}
+
+/*!
+ * @brief 按最大瓦片长度修正变长数组列的TFORMn, 如1PB(1234)
+ */
+static void update_tforms(fitsfile* fptr, const vector<LONGLONG>& maxlen, int* status) {
+	char keyname[FLEN_KEYWORD], tform[FLEN_VALUE], *ptr;
+
+	for (size_t c = 0; c < maxlen.size() && !*status; ++c) {
+		fits_make_keyn("TFORM", int(c + 1), keyname, status);
+		fits_read_key_str(fptr, keyname, tform, NULL, status);
+		if (*status || !(ptr = strchr(tform, '('))) continue;
+		sprintf (ptr, "(%lld)", (long long) maxlen[c]);
+		fits_update_key(fptr, TSTRING, keyname, tform, "&", status);
+	}
+}
+
+bool tbl_compress_hdu(FITSHandler& hin, FITSHandler& hout, const char* algor, long tilelen, int nthread) {
+	FITSTableMap map;
+	fits_table_geometry& geom = map.geom;
+	size_t c;
+
+	if (!hin() || !hout() || !hin.Success() || !hout.Success()) return false;
+	// 筛选可压缩的表
+	bool plain = tbl_is_compressed(hin) || !hin.TableGeometry(geom) || geom.nrows == 0;
+	for (c = 0; !plain && c < geom.cols.size(); ++c) plain = geom.cols[c].typecode < 0;
+	if (plain || !hin.MapTable(map)) {
+		*hin.Status() = 0;
+		fits_copy_hdu(hin(), hout(), 0, hout.Status());
+		return hout.Success();
+	}
+
+	comp_pool* pool = new comp_pool;
+	vector<LONGLONG> maxlen;
+	vector<thread> workers;
+	LONGLONG row;
+	long t, i;
+
+	if (tilelen <= 0) tilelen = TBL_TILE_BYTES / geom.rowlen;
+	if (tilelen < 1) tilelen = 1;
+	if (tilelen > geom.nrows) tilelen = long(geom.nrows);
+	pool->data    = map.data;
+	pool->rowlen  = geom.rowlen;
+	pool->nrows   = geom.nrows;
+	pool->tilelen = tilelen;
+	pool->ntile   = long((geom.nrows + tilelen - 1) / tilelen);
+	pool->algor   = algor;
+	pool->next_tile  = 0;
+	pool->next_write = 0;
+	pool->window     = nthread > 1 ? nthread * 2 : 1;
+	pool->abort      = false;
+	pool->slot.resize(pool->window);
+	for (i = 0; i < pool->window; ++i) pool->slot[i].state = 0;
+	read_cards(hin(), pool->cards, hin.Status());
+	if (nthread > 1 && fits_is_reentrant() && hin.Success()) {
+		for (i = 0; i < nthread; ++i) workers.push_back(thread(comp_worker, pool));
+	}
+	map.AdviseSequential();
+
+	for (t = 0; t < pool->ntile && hin.Success() && hout.Success(); ++t) {
+		comp_tile& tile = pool->slot[t % pool->window];
+		if (workers.empty()) tile.state = compress_tile(pool, t, tile) ? 1 : -1;
+		else {
+			unique_lock<mutex> lck(pool->mtx);
+			while (tile.state == 0) pool->cv_done.wait(lck);
+		}
+		if (tile.state < 0) {
+			printf ("failed to compress tile %ld of %ld\n", t + 1, pool->ntile);
+			if (hout.Success()) *hout.Status() = DATA_COMPRESSION_ERR;
+			break;
+		}
+
+		if (t == 0) {
+			write_cards(hout(), pool->zcards, pool->ntile, pool->nrows, hout.Status());
+			maxlen.assign(tile.cols.size(), 0);
+		}
+		row = t + 1;
+		write_tile(hout(), row, tile.cols, hout.Status());
+		for (c = 0; c < tile.cols.size() && c < maxlen.size(); ++c) {
+			if (LONGLONG(tile.cols[c].size()) > maxlen[c]) maxlen[c] = LONGLONG(tile.cols[c].size());
+		}
+
+		lock_guard<mutex> lck(pool->mtx);
+		tile.state = 0;
+		pool->next_write = t + 1;
+		pool->cv_tile.notify_all();
+	}
+	update_tforms(hout(), maxlen, hout.Status());
+
+	{// 结束: 通知并等待工作线程退出
+		lock_guard<mutex> lck(pool->mtx);
+		pool->abort = true;
+		pool->cv_tile.notify_all();
+	}
+	for (i = 0; i < int(workers.size()); ++i) workers[i].join();
+	delete pool;
+
+	return hin.Success() && hout.Success();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 解压 */
+/*!
+ * @struct decomp_tile 待解压的瓦片
+ */
+typedef struct {
+	long tile;			//< 瓦片序号
+	tile_columns cols;	//< 各列压缩数据
+} decomp_tile;
+
+/*!
+ * @struct decomp_pool 解压线程共享数据
+ * 主线程顺序读出压缩数据排队, 工作线程解压后写入数据区的对应位置
+ */
+struct decomp_pool {
+	unsigned char* data;	//< 解压后的数据区
+	long rowlen;			//< 原始表行长
+	LONGLONG nrows;			//< 原始表行数
+	long tilelen;			//< 每瓦片行数
+	fits_cards zcards;		//< 压缩表头区
+	fits_table_geometry geom;	//< 原始表布局, 由瓦片0得到
+
+	mutex mtx;
+	condition_variable cv_job;	//< 通知: 有新瓦片或需退出
+	condition_variable cv_room;	//< 通知: 队列有空位
+	deque<decomp_tile*> jobs;	//< 待解压瓦片
+	size_t window;		//< 队列长度上限
+	bool finish;		//< 已无新瓦片
+	bool failed;		//< 有瓦片解压失败
+};
+
+/*!
+ * @brief 在内存文件中解压单个瓦片
+ */
+static bool decompress_tile(decomp_pool* pool, decomp_tile* job) {
+	FITSHandler tz, tu;
+	LONGLONG first = LONGLONG(job->tile) * pool->tilelen;
+	LONGLONG rows  = pool->nrows - first < pool->tilelen ? pool->nrows - first : pool->tilelen;
+
+	if (!tz("mem://", 2) || !tu("mem://", 2)) return false;
+	// 以单个瓦片构建压缩表
+	fits_create_img(tz(), BYTE_IMG, 0, NULL, tz.Status());
+	write_cards(tz(), pool->zcards, 1, rows, tz.Status());
+	write_tile(tz(), 1, job->cols, tz.Status());
+	if (!tz.Success()) return false;
+
+	fits_create_img(tu(), BYTE_IMG, 0, NULL, tu.Status());
+	fits_uncompress_table(tz(), tu(), tu.Status());
+	if (job->tile == 0 && !tu.TableGeometry(pool->geom)) return false;
+	fits_read_tblbytes(tu(), 1, 1, rows * pool->rowlen, pool->data + first * pool->rowlen, tu.Status());
+	return tu.Success();
+}
+
+static void decomp_worker(decomp_pool* pool) {
+	decomp_tile* job;
+	bool rslt;
+
+	while (1) {
+		unique_lock<mutex> lck(pool->mtx);
+		while (!pool->finish && pool->jobs.empty()) pool->cv_job.wait(lck);
+		if (pool->jobs.empty()) break;
+		job = pool->jobs.front();
+		pool->jobs.pop_front();
+		pool->cv_room.notify_one();
+		rslt = !pool->failed;	// 已有瓦片失败时不再解压, 仅清空队列
+		lck.unlock();
+
+		if (rslt) rslt = decompress_tile(pool, job);
+		delete job;
+		if (!rslt) {
+			lck.lock();
+			pool->failed = true;
+			pool->cv_room.notify_one();
+		}
+	}
+}
+
+bool tbl_load_compressed(FITSHandler& hin, FITSTableMap& map, int nthread) {
+	if (!hin() || !hin.Success() || !tbl_is_compressed(hin)) return false;
+
+	decomp_pool* pool = new decomp_pool;
+	vector<unsigned char> buff;
+	vector<thread> workers;
+	LONGLONG ntile;
+	long tilelen;
+	int ncol, i;
+	long t;
+	bool rslt;
+
+	fits_read_key_lng(hin(), "ZNAXIS1", &pool->rowlen, NULL, hin.Status());
+	fits_read_key(hin(), TLONGLONG, "ZNAXIS2", &pool->nrows, NULL, hin.Status());
+	fits_read_key_lng(hin(), "ZTILELEN", &tilelen, NULL, hin.Status());
+	fits_get_num_rowsll(hin(), &ntile, hin.Status());
+	fits_get_num_cols(hin(), &ncol, hin.Status());
+	read_cards(hin(), pool->zcards, hin.Status());
+	if (!hin.Success() || tilelen < 1) {
+		delete pool;
+		return false;
+	}
+	buff.resize(size_t(pool->nrows * pool->rowlen));
+	pool->data    = buff.empty() ? NULL : &buff[0];
+	pool->tilelen = tilelen;
+	pool->window  = size_t(nthread * 2);
+	pool->finish  = false;
+	pool->failed  = false;
+	if (nthread > 1 && fits_is_reentrant()) {
+		for (i = 0; i < nthread; ++i) workers.push_back(thread(decomp_worker, pool));
+	}
+
+	for (t = 0; t < ntile && hin.Success(); ++t) {
+		decomp_tile* job = new decomp_tile;
+		job->tile = t;
+		read_tile(hin(), t + 1, ncol, job->cols, hin.Status());
+		if (workers.empty()) {
+			if (hin.Success() && !decompress_tile(pool, job)) pool->failed = true;
+			delete job;
+			if (pool->failed) break;
+			continue;
+		}
+
+		unique_lock<mutex> lck(pool->mtx);
+		while (!pool->failed && pool->jobs.size() >= pool->window) pool->cv_room.wait(lck);
+		if (pool->failed) {
+			delete job;
+			break;
+		}
+		pool->jobs.push_back(job);
+		pool->cv_job.notify_one();
+	}
+
+	{// 结束: 通知并等待工作线程退出
+		lock_guard<mutex> lck(pool->mtx);
+		pool->finish = true;
+		pool->cv_job.notify_all();
+	}
+	for (i = 0; i < int(workers.size()); ++i) workers[i].join();
+
+	if ((rslt = hin.Success() && !pool->failed && ntile > 0)) {
+		map.Adopt(buff);
+		map.geom = pool->geom;
+		map.geom.nrows     = pool->nrows;
+		map.geom.datastart = 0;
+		map.geom.dataend   = 0;
+	}
+	else printf ("failed to decompress table of %lld tiles\n", (long long) ntile);
+	delete pool;
+
+	return rslt;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool tbl_compress_file(const char* src, const char* dst, const char* algor, long tilelen, int nthread) {
+	FITSHandler hin, hout;
+	char filepath[FLEN_FILENAME];
+	int nhdu, i;
+	bool rslt;
+
+	if (snprintf(filepath, sizeof(filepath), "!%s", dst) >= int(sizeof(filepath))) return false;	// 覆盖已有文件
+	if (!hin(src) || !hout(filepath, 2)) return false;
+	hin.HDUType(nhdu);
+	for (i = 1, rslt = true; rslt && i <= nhdu; ++i) {
+		rslt = hin.MovetoHDU(i) && tbl_compress_hdu(hin, hout, algor, tilelen, nthread);
+	}
+	if (!rslt) printf ("failed to compress [%s]: %s\n", src, hin.Success() ? hout.GetError() : hin.GetError());
+	hin.Close();
+	if (!hout.Close()) rslt = false;
+	if (!rslt) unlink(dst);
+
+	return rslt;
+}
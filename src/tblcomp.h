@@ -0,0 +1,57 @@
+/**
+ * @file tblcomp.h 二进制表分块压缩(tiled table compression)的并行读写
+ * @note
+ * - 压缩格式即cfitsio的fits_compress_table(): 每ZTILELEN行为一个瓦片, 瓦片内各列分别压缩后存入堆
+ * - fits_compress_table()逐瓦片串行压缩. 此处把每个瓦片作为独立的小表交给工作线程,
+ *   在内存文件中调用fits_compress_table(), 再按瓦片顺序将各列压缩数据写入输出表
+ * - 读取时反向操作: 按顺序读出各瓦片的压缩数据, 由工作线程并行解压到同一数据区
+ * - 工作线程各自使用独立的内存文件. cfitsio未以可重入方式编译时退化为单线程
+ */
+
+#ifndef SRC_TBLCOMP_H_
+#define SRC_TBLCOMP_H_
+
+#include "FITSHandler.hpp"
+
+#define TBL_TILE_BYTES	4194304	//< 自动确定瓦片行数时, 每瓦片的原始字节数
+
+/*!
+ * @brief 由名称查找压缩算法
+ * @param name rice, gzip, gzip2, 或cfitsio名称RICE_1, GZIP_1, GZIP_2
+ * @return
+ * cfitsio的算法名称. 无法识别时返回NULL
+ */
+const char* tbl_compress_algor(const char* name);
+/*!
+ * @brief 检查当前HDU是否分块压缩的二进制表
+ */
+bool tbl_is_compressed(FITSHandler& hin);
+/*!
+ * @brief 将hin的当前HDU以分块压缩格式追加到hout
+ * @param algor   压缩算法, cfitsio名称
+ * @param tilelen 每瓦片行数. 0: 按TBL_TILE_BYTES确定
+ * @param nthread 压缩线程数
+ * @return
+ * 操作结果
+ * @note
+ * 当前HDU不是二进制表、已压缩、含变长数组或为空表时原样复制
+ */
+bool tbl_compress_hdu(FITSHandler& hin, FITSHandler& hout, const char* algor, long tilelen, int nthread);
+/*!
+ * @brief 将hin当前HDU的分块压缩表解压到内存, 由map接管
+ * @return
+ * 当前HDU不是分块压缩表或解压失败时返回false
+ * @note
+ * map.geom描述解压后的表, 其中datastart与dataend无意义
+ */
+bool tbl_load_compressed(FITSHandler& hin, FITSTableMap& map, int nthread);
+/*!
+ * @brief 复制FITS文件, 其中的二进制表以分块压缩格式存储
+ * @param src 源文件
+ * @param dst 目标文件, 已存在时覆盖
+ * @return
+ * 操作结果. 失败时删除目标文件
+ */
+bool tbl_compress_file(const char* src, const char* dst, const char* algor, long tilelen, int nthread);
+
+#endif /* SRC_TBLCOMP_H_ */
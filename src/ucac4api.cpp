@@ -3,121 +3,948 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "ucac4api.h"
-#include "FITSHandler.hpp"
+#include "ucac4pipe.h"
+#include "catcache.h"
+#include "tblcomp.h"
+#include "ATimeSpace.h"
 
 using namespace std;
 
-void build_ucac4_fits(const char* pathcat, index_param& param) {
-	char filename[10];
-	char filepath[100];
-	char pathtmp[] = "/Users/lxm/Data/Temp/ucac4.tmp";
-	int nbuf(1000), nread, nzone, nvalid, ntot, i, j;
-	CatStar star;
-	int band = param.filter_band;
-	char *buff = new char[nbuf * UCAC4_UNIT];
-	char *ptr;
-	FILE *fpcat, *fptmp;
-	short brightcut = short(param.brightcut * 1000.);	// 亮端截断
-
-	ntot  = 0;
-	fptmp = fopen(pathtmp, "wb");
-	// 遍历文件, 将符合条件的数据写入临时文件
-	for (j = 1; j <= 900; ++j) {
-		sprintf (filename, "z%03d", j);
-		sprintf (filepath, "%s/u4b/%s", pathcat, filename);
-		printf ("Reading: %s\n", filename);
-
-		if ((fpcat = fopen(filepath, "rb")) == NULL) {
-			printf ("\t FAIL\n");
-			break;
-		}
-
-		while ((nread = fread(buff, UCAC4_UNIT, nbuf, fpcat)) > 0) {
-			for (i = 0, ptr = buff; i < nread; ++i, ptr += UCAC4_UNIT) {
-				ucac4_resolve_item(ptr, band, star);
-				if (star.mag >= brightcut) {
-					++ntot;
-					fwrite (&star, sizeof(CatStar), 1, fptmp);
-				}
+const char* ucac4_band[UCAC4_NBAND] = {
+//   0    1    2    3    4    5    6    7
+	"B", "V", "g", "r", "i", "J", "H", "K"
+};
+
+/*!
+ * @brief 各提取波段对应的FITS写入器及缓存写入器
+ */
+struct ucac4_band_writer {
+	int zone;	//< 最近写入的天区
+	int bands;	//< 提取的波段集合
+	int caching;	//< 需要写入缓存的波段集合
+	bool occupy;	//< 合并各天区占用的像元
+	CatWriter writer[UCAC4_NBAND];
+	CatCacheWriter cache[UCAC4_NBAND];
+	OccupancyMap occ;	//< 滤光片波段恒星占用的像元
+};
+
+static void write_zone_fits(int zone, const ucac4_zone& data, void* extra) {
+	ucac4_band_writer* bw = (ucac4_band_writer*) extra;
+	if (zone != bw->zone) {// 流水线方式下同一天区分多次交付
+		printf ("Reading: z%03d\n", zone);
+		bw->zone = zone;
+	}
+	for (int b = 0; b < UCAC4_NBAND; ++b) {
+		if (bw->bands & (1 << b)) bw->writer[b].Append(data.band[b]);
+		if ((bw->caching & (1 << b)) && !bw->cache[b].Append(data.band[b])) {
+			printf ("Failed to write catalog cache of band %s\n", ucac4_band[b]);
+			bw->caching &= ~(1 << b);
+		}
+	}
+	if (bw->occupy) bw->occ.Merge(data.occ);
+}
+
+/*!
+ * @brief 由缓存文件写入FITS, 分块追加以限制每次写入量
+ * @param occ 非空时同时统计占用的像元
+ */
+static bool write_cache_fits(const CatCache& cache, CatWriter& writer, OccupancyMap* occ) {
+	const int64_t nblk = 1 << 20;
+	int64_t i, n;
+
+	for (i = 0; i < cache.Rows(); i += n) {
+		n = cache.Rows() - i < nblk ? cache.Rows() - i : nblk;
+		if (!writer.Append(cache.ra + i, cache.spd + i, cache.mag + i, int(n))) return false;
+		if (occ) occ->AddStars(cache.ra + i, cache.spd + i, int(n));
+	}
+	return true;
+}
+
+/*!
+ * @brief 将中间星表替换为分块压缩格式
+ */
+static bool compress_catalog(const char* filepath, const index_param& param) {
+	char pathtmp[PATH_MAX + 8];
+	struct stat st0, st1;
+	bool rslt;
+
+	rslt = snprintf(pathtmp, sizeof(pathtmp), "%s.tmp", filepath) < int(sizeof(pathtmp))
+			&& !stat(filepath, &st0)
+			&& tbl_compress_file(filepath, pathtmp, param.compress, param.tilelen, param.nthread)
+			&& !stat(pathtmp, &st1) && !rename(pathtmp, filepath);
+	if (rslt) {
+		printf ("catalog is compressed by %s: %.1f MB -> %.1f MB\n", param.compress,
+				st0.st_size / 1048576., st1.st_size / 1048576.);
+	}
+	else {
+		unlink(pathtmp);
+		printf ("Failed to compress catalog [%s], it is kept uncompressed\n", filepath);
+	}
+	return rslt;
+}
+
+/*!
+ * @brief 解码星表缓存的目录: --cache-dir, 否则为$XDG_CACHE_HOME/astindex或~/.cache/astindex
+ * @note
+ * UCAC4目录常为共享或只读目录, 缺省时不在其中写入缓存
+ * @return
+ * 目录可用时返回true
+ */
+static bool cache_dir(const index_param& param, char* dir, size_t size) {
+	const char* base;
+	int n;
+
+	if (param.cachedir[0]) return snprintf(dir, size, "%s", param.cachedir) < int(size);
+	if ((base = getenv("XDG_CACHE_HOME")) && base[0]) n = snprintf(dir, size, "%s/astindex", base);
+	else if ((base = getenv("HOME")) && base[0]) {
+		if (snprintf(dir, size, "%s/.cache", base) < int(size)) mkdir(dir, 0755);
+		n = snprintf(dir, size, "%s/.cache/astindex", base);
+	}
+	else return false;
+	return n < int(size) && (!mkdir(dir, 0755) || errno == EEXIST);
+}
+
+/*!
+ * @brief 解析阶段判定大像元及边缘所用的细网格
+ * @return
+ * 细网格nside. 0: 不在解析阶段剔除
+ */
+static int region_nside(const index_param& param) {
+	int fnside = param.UNside ? param.UNside : param.Nside;
+	return param.bighp >= 0 && param.bignside > 0 && fnside > 0 && param.dedup <= 0. ? fnside : 0;
+}
+
+bool build_ucac4_fits(const char* pathcat, index_param& param) {
+	ucac4_band_writer bw;
+	ucac4_footprint fp;
+	catcache_header hdr[UCAC4_NBAND], hdrocc;
+	CatCache cache[UCAC4_NBAND];
+	char filepath[UCAC4_NBAND][PATH_MAX];
+	char pathcache[UCAC4_NBAND][PATH_MAX];
+	char pathocc[PATH_MAX];
+	char cachedir[PATH_MAX];
+	uint64_t catkey(0), occkey;
+	int nzone, b, hits(0);
+	bool multi, rslt(true);
+
+	bw.zone    = 0;
+	bw.bands   = ucac4_extract_bands(param);
+	bw.caching = 0;
+	bw.occupy  = false;
+	multi = bw.bands != (1 << param.filter_band);
+	// 星表目录须为派生的文件名(中间星表, 天区文件, 占用位图及临时文件)留出余量
+	if (strlen(pathcat) + UCAC4_PATH_RESERVE >= sizeof(param.pathcat)) {
+		printf ("UCAC4 directory path is too long: %.64s...\n", pathcat);
+		return false;
+	}
+	snprintf(param.pathucac4, sizeof(param.pathucac4), "%s", pathcat);
+	for (b = 0; b < UCAC4_NBAND; ++b) {
+		if (!(bw.bands & (1 << b))) continue;
+		if (multi) snprintf(filepath[b], PATH_MAX, "%s/astindex-%d-%s.fit", pathcat, param.indexid, ucac4_band[b]);
+		else snprintf(filepath[b], PATH_MAX, "%s/astindex-%d.fit", pathcat, param.indexid);
+		if (!bw.writer[b].Create(filepath[b], ucac4_band[b])) {
+			printf ("Failed to create temporary catalog index [%s]\n", filepath[b]);
+			return false;
+		}
+		bw.writer[b].SetBatch(param.writebatch);
+	}
+	snprintf(param.pathcat, sizeof(param.pathcat), "%s", filepath[param.filter_band]);
+	ucac4_footprint_init(fp, param);
+	if (fp.zone0 > 1 || fp.zone1 < UCAC4_NZONE || fp.nra) {
+		printf ("healpix %d at Nside %d: zone z%03d to z%03d", param.bighp, param.bignside, fp.zone0, fp.zone1);
+		for (b = 0; b < fp.nra; ++b)
+			printf (", RA [%.4f, %.4f)", fp.ra0[b] / double(MILLISEC), fp.ra1[b] / double(MILLISEC));
+		printf ("\n");
+	}
+	if (region_nside(param)) {
+		printf ("stars beyond %d cell(s) of healpix %d at Nside %d are dropped while decoding\n",
+				param.margin > 0 ? param.margin : 0, param.bighp, region_nside(param));
+	}
+	if (param.epoch != 0.) printf ("positions are propagated from J2000 to epoch %.3f\n", param.epoch);
+	if (param.reject || param.reject_objt) {
+		printf ("rejecting stars flagged by%s%s%s", param.reject & UCAC4_REJECT_CDF ? " cdf" : "",
+				param.reject & UCAC4_REJECT_X2M ? " x2m" : "", param.reject & UCAC4_REJECT_LEDA ? " leda" : "");
+		if (param.reject_objt) printf (" objt(mask 0x%08X)", param.reject_objt);
+		printf ("\n");
+	}
+
+	// 占用位图: 中间星表的参数与源文件未变时复用
+	if (param.scanoccupied && param.Nside > 0) {
+		ucac4_cache_header(hdrocc, pathcat, param, param.filter_band, fp);
+		catkey = catcache_key(hdrocc);
+		occupancy_path(param.pathcat, param.Nside, pathocc);
+		if (bw.occ.Load(pathocc, param.Nside, occkey) && occkey == catkey) {
+			printf ("reuse occupancy bitmap [%s], %lld healpixes occupied\n", pathocc, (long long) bw.occ.Count());
+		}
+		else {
+			unlink(pathocc);
+			bw.occ.Reset(param.Nside);
+			bw.occupy = true;
+		}
+	}
+	else if (param.scanoccupied) printf ("scanning occupied healpixes requires Nside\n");
+
+	// 查找可复用的缓存
+	if (param.usecache && !cache_dir(param, cachedir, sizeof(cachedir)))
+		printf ("no usable directory for the catalog cache, caching is disabled\n");
+	else if (param.usecache) {
+		ucac4_cache_header(hdr[0], pathcat, param, 0, fp);
+		for (b = 0; b < UCAC4_NBAND; ++b) {
+			if (!(bw.bands & (1 << b))) continue;
+			hdr[b] = hdr[0];
+			hdr[b].band = b;
+			if (!catcache_path(cachedir, hdr[b], pathcache[b])) {
+				printf ("catalog cache path under [%.64s...] is too long, caching is disabled\n", cachedir);
+				break;
+			}
+			if (cache[b].Open(pathcache[b], hdr[b])) {
+				printf ("reuse catalog cache [%s], %lld stars\n", pathcache[b], (long long) cache[b].Rows());
+				hits |= 1 << b;
 			}
+			else if (bw.cache[b].Create(pathcache[b], hdr[b])) bw.caching |= 1 << b;
+		}
+	}
+
+	if (hits == bw.bands) {// 全部命中: 不再读取UCAC4
+		for (b = 0; b < UCAC4_NBAND; ++b) {
+			if ((bw.bands & (1 << b)) && !write_cache_fits(cache[b], bw.writer[b],
+					bw.occupy && b == param.filter_band ? &bw.occ : NULL)) {
+				printf ("Failed to copy catalog cache of band %s\n", ucac4_band[b]);
+				rslt = false;
+			}
+		}
+	}
+	else {// 遍历文件, 将符合条件的数据直接追加到各波段的二进制表
+		if (param.reader == UCAC4_READ_PIPELINE) {
+			ucac4_pipe_stat stat;
+			nzone = ucac4_scan_pipeline(pathcat, param, write_zone_fits, &bw, &stat);
+			printf ("pipeline: %lld records, %.1f MB, %s reader\n", (long long) stat.nrec,
+					stat.bytes / 1048576., stat.uring ? "io_uring" : "pread");
+			for (b = 0; b < UCAC4_PIPE_NSTAGE; ++b)
+				printf ("  %-8s busy %8.3f s, stall %8.3f s\n", ucac4_pipe_stage[b], stat.busy[b], stat.stall[b]);
 		}
+		else nzone = ucac4_scan_zones(pathcat, param, write_zone_fits, &bw);
+		if (nzone < fp.zone1) {
+			printf ("Reading: z%03d\n\t FAIL\n", nzone + 1);
+			bw.caching = 0;
+			bw.occupy  = false;
+			rslt = false;
+		}
+		for (b = 0; b < UCAC4_NBAND; ++b) {
+			if (!(bw.caching & (1 << b))) bw.cache[b].Abort();
+			else if (bw.cache[b].Close()) printf ("catalog cache is saved to [%s]\n", pathcache[b]);
+		}
+	}
+
+	// 处理结果
+	for (b = 0; b < UCAC4_NBAND; ++b) {
+		if (!(bw.bands & (1 << b))) continue;
+		if (bw.writer[b].Close()) {
+			printf ("catalog UCAC4 is saved to [%s], %lld stars\n", filepath[b], bw.writer[b].Rows());
+			if (param.compress[0]) compress_catalog(filepath[b], param);
+		}
+		else {
+			printf ("build_ucac4_fits() failed: %s\n", bw.writer[b].GetError());
+			rslt = false;
+		}
+	}
+	if (bw.occupy) {
+		printf ("%lld healpixes at Nside %d are occupied, %.1f KB", (long long) bw.occ.Count(), param.Nside,
+				bw.occ.Bytes() / 1024.);
+		if (bw.occ.Save(pathocc, catkey)) printf (", saved to [%s]\n", pathocc);
+		else printf (", failed to save [%s]\n", pathocc);
+	}
+	return rslt;
+}
+
+void ucac4_cache_header(catcache_header& hdr, const char* pathcat, const index_param& param,
+		int band, const ucac4_footprint& fp) {
+	char filepath[PATH_MAX];
+	struct stat st;
+	uint64_t sum = 14695981039346656037ULL;
+	int64_t vals[3];
+	int zone, i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.band      = band;
+	hdr.brightcut = short(param.brightcut * 1000.);
+	hdr.epoch     = int32_t(floor(param.epoch * 1000. + 0.5));
+	hdr.reject    = param.reject;
+	hdr.reject_objt = param.reject_objt;
+	if ((hdr.rgnside = region_nside(param))) {
+		hdr.bignside = param.bignside;
+		hdr.bighp    = param.bighp;
+		hdr.margin   = param.margin > 0 ? param.margin : 0;
+	}
+	hdr.zone0     = fp.zone0;
+	hdr.zone1     = fp.zone1;
+	hdr.nra       = fp.nra;
+	for (i = 0; i < fp.nra; ++i) {
+		hdr.ra0[i] = fp.ra0[i];
+		hdr.ra1[i] = fp.ra1[i];
+	}
+	// 源文件校验和: 以天区文件大小及修改时间代替内容, 无需读取数据
+	for (zone = fp.zone0; zone <= fp.zone1; ++zone) {
+		snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", pathcat, zone);
+		if (stat(filepath, &st)) memset(&st, 0, sizeof(st));
+		vals[0] = zone;
+		vals[1] = st.st_size;
+		vals[2] = st.st_mtime;
+		for (i = 0; i < int(sizeof(vals)); ++i) {// FNV-1a
+			sum ^= ((const unsigned char*) vals)[i];
+			sum *= 1099511628211ULL;
+		}
+		hdr.capacity += st.st_size / UCAC4_UNIT;
+	}
+	hdr.srcsum = sum;
+}
+
+void ucac4_resolve_item(const char *buff, int band, CatStar& star) {
+	star.ra     = ((const uint32_t*) buff)[0];
+	star.spd    = ((const uint32_t*) buff)[1];
+	if (band < 5) star.mag = ((const short*)(buff + 46))[band];
+	else star.mag = ((const short*)(buff + 34))[band - 5];
+}
+
+void ucac4_decoder_init(ucac4_decoder& dec, const index_param& param, int band) {
+	dec.band      = band < 0 ? param.filter_band : band;
+	dec.brightcut = short(param.brightcut * 1000.);
+	dec.dt        = 0.;
+	// 质量标志编译为对记录中两个32位字的掩码测试, 以及对目标类型的位表查找
+	dec.flagmask[0] = param.reject & UCAC4_REJECT_CDF ? 0x00FF0000 : 0;
+	dec.flagmask[1] = (param.reject & UCAC4_REJECT_LEDA ? 0x000000FF : 0)
+			| (param.reject & UCAC4_REJECT_X2M ? 0x0000FF00 : 0);
+	dec.objtmask    = param.reject_objt;
+	dec.filter      = dec.flagmask[0] || dec.flagmask[1] || dec.objtmask;
+	dec.occnside    = param.scanoccupied && dec.band == param.filter_band ? param.Nside : 0;
+	dec.region      = region_nside(param)
+			? healpix_region_get(param.bignside, param.bighp, region_nside(param), param.margin) : NULL;
+	if (param.epoch != 0.) {// 历元差在初始化时计算一次, 由同一解析参数处理的各批记录共用
+		AstroUtil::ATimeSpace ats;
+		ats.SetEpoch(param.epoch);
+		dec.dt = ats.JulianCentury() * 100.;
+	}
+}
+
+int ucac4_extract_bands(const index_param& param) {
+	return (param.bands | (1 << param.filter_band)) & ((1 << UCAC4_NBAND) - 1);
+}
+
+/*!
+ * @brief 星等在记录中的字节偏移
+ */
+static inline int mag_offset(int band) {
+	return band < 5 ? 46 + band * 2 : 34 + (band - 5) * 2;
+}
+
+/*!
+ * @brief 记录是否带有需剔除的质量标志
+ */
+static inline bool reject_flags(const ucac4_decoder& dec, const char* ptr) {
+	uint32_t objt = *((const uint8_t*)(ptr + 13));
+	return (*((const uint32_t*)(ptr + 12)) & dec.flagmask[0])
+			| (*((const uint32_t*)(ptr + 66)) & dec.flagmask[1])
+			| ((dec.objtmask >> (objt < 31 ? objt : 31)) & 1);
+}
+
+static int decode_batch_scalar(const ucac4_decoder& dec, const char* raw, int n,
+		uint32_t* ra, uint32_t* spd, short* mag, uint8_t* mask) {
+	const char* ptr;
+	int magoff = mag_offset(dec.band);
+	int i, nvalid(0);
+
+	for (i = 0, ptr = raw; i < n; ++i, ptr += UCAC4_UNIT) {
+		ra[i]   = ((const uint32_t*) ptr)[0];
+		spd[i]  = ((const uint32_t*) ptr)[1];
+		mag[i]  = *((const short*)(ptr + magoff));
+		mask[i] = mag[i] >= dec.brightcut && !(dec.filter && reject_flags(dec, ptr));
+		nvalid += mask[i];
+	}
+	return nvalid;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * SSE2: 每次处理4条记录. 没有gather指令, 由标量加载拼装向量, 向量化比较与星等压缩
+ */
+__attribute__((target("sse2")))
+static int decode_batch_sse2(const ucac4_decoder& dec, const char* raw, int n,
+		uint32_t* ra, uint32_t* spd, short* mag, uint8_t* mask) {
+	const char* ptr = raw;
+	int magoff = mag_offset(dec.band);
+	int i, bits, nvalid(0);
+	const __m128i cut = _mm_set1_epi32(int(dec.brightcut) - 1);
+	__m128i vra, vspd, vmag, vmask;
+
+	for (i = 0; i + 4 <= n; i += 4, ptr += 4 * UCAC4_UNIT) {
+		vra  = _mm_setr_epi32(*(const int*)(ptr),
+							  *(const int*)(ptr + UCAC4_UNIT),
+							  *(const int*)(ptr + 2 * UCAC4_UNIT),
+							  *(const int*)(ptr + 3 * UCAC4_UNIT));
+		vspd = _mm_setr_epi32(*(const int*)(ptr + 4),
+							  *(const int*)(ptr + UCAC4_UNIT + 4),
+							  *(const int*)(ptr + 2 * UCAC4_UNIT + 4),
+							  *(const int*)(ptr + 3 * UCAC4_UNIT + 4));
+		vmag = _mm_setr_epi32(*(const short*)(ptr + magoff),
+							  *(const short*)(ptr + UCAC4_UNIT + magoff),
+							  *(const short*)(ptr + 2 * UCAC4_UNIT + magoff),
+							  *(const short*)(ptr + 3 * UCAC4_UNIT + magoff));
+		vmask = _mm_cmpgt_epi32(vmag, cut);
+		if (dec.filter) {// SSE2没有可变移位, 标志逐条判断后拼装
+			vmask = _mm_andnot_si128(_mm_setr_epi32(-int(reject_flags(dec, ptr)),
+					-int(reject_flags(dec, ptr + UCAC4_UNIT)),
+					-int(reject_flags(dec, ptr + 2 * UCAC4_UNIT)),
+					-int(reject_flags(dec, ptr + 3 * UCAC4_UNIT))), vmask);
+		}
+		_mm_storeu_si128((__m128i*)(ra + i),  vra);
+		_mm_storeu_si128((__m128i*)(spd + i), vspd);
+		_mm_storel_epi64((__m128i*)(mag + i), _mm_packs_epi32(vmag, vmag));
+		bits = _mm_movemask_ps(_mm_castsi128_ps(vmask));
+		mask[i]     = bits & 1;
+		mask[i + 1] = (bits >> 1) & 1;
+		mask[i + 2] = (bits >> 2) & 1;
+		mask[i + 3] = (bits >> 3) & 1;
+		nvalid += __builtin_popcount(bits);
+	}
+	if (i < n) nvalid += decode_batch_scalar(dec, ptr, n - i, ra + i, spd + i, mag + i, mask + i);
+	return nvalid;
+}
+
+/*
+ * AVX2: 每次处理8条记录. 以gather按UCAC4_UNIT步长加载赤经/南天极距离/星等
+ * 星等以32位加载(偏移+4不越过记录末尾), 左移再算术右移得到符号扩展的16位值
+ */
+__attribute__((target("avx2")))
+static int decode_batch_avx2(const ucac4_decoder& dec, const char* raw, int n,
+		uint32_t* ra, uint32_t* spd, short* mag, uint8_t* mask) {
+	const char* ptr = raw;
+	int magoff = mag_offset(dec.band);
+	int i, bits, j, nvalid(0);
+	const __m256i cut = _mm256_set1_epi32(int(dec.brightcut) - 1);
+	const __m256i idx = _mm256_setr_epi32(0, UCAC4_UNIT, 2 * UCAC4_UNIT, 3 * UCAC4_UNIT,
+			4 * UCAC4_UNIT, 5 * UCAC4_UNIT, 6 * UCAC4_UNIT, 7 * UCAC4_UNIT);
+	const __m256i fm0  = _mm256_set1_epi32(int(dec.flagmask[0]));
+	const __m256i fm1  = _mm256_set1_epi32(int(dec.flagmask[1]));
+	const __m256i om   = _mm256_set1_epi32(int(dec.objtmask));
+	const __m256i c31  = _mm256_set1_epi32(31);
+	const __m256i cff  = _mm256_set1_epi32(0xFF);
+	const __m256i one  = _mm256_set1_epi32(1);
+	__m256i vra, vspd, vmag, vmask, w0, w1, vrej;
+
+	for (i = 0; i + 8 <= n; i += 8, ptr += 8 * UCAC4_UNIT) {
+		vra  = _mm256_i32gather_epi32((const int*) ptr, idx, 1);
+		vspd = _mm256_i32gather_epi32((const int*)(ptr + 4), idx, 1);
+		vmag = _mm256_i32gather_epi32((const int*)(ptr + magoff), idx, 1);
+		vmag = _mm256_srai_epi32(_mm256_slli_epi32(vmag, 16), 16);
+		vmask = _mm256_cmpgt_epi32(vmag, cut);
+		if (dec.filter) {// 标志字掩码测试, 目标类型以可变移位查位表
+			w0   = _mm256_i32gather_epi32((const int*)(ptr + 12), idx, 1);
+			w1   = _mm256_i32gather_epi32((const int*)(ptr + 66), idx, 1);
+			vrej = _mm256_or_si256(_mm256_and_si256(w0, fm0), _mm256_and_si256(w1, fm1));
+			vrej = _mm256_or_si256(vrej, _mm256_and_si256(_mm256_srlv_epi32(om,
+					_mm256_min_epu32(_mm256_and_si256(_mm256_srli_epi32(w0, 8), cff), c31)), one));
+			vmask = _mm256_and_si256(_mm256_cmpeq_epi32(vrej, _mm256_setzero_si256()), vmask);
+		}
+		_mm256_storeu_si256((__m256i*)(ra + i),  vra);
+		_mm256_storeu_si256((__m256i*)(spd + i), vspd);
+		_mm_storeu_si128((__m128i*)(mag + i), _mm_packs_epi32(
+				_mm256_castsi256_si128(vmag), _mm256_extracti128_si256(vmag, 1)));
+		bits = _mm256_movemask_ps(_mm256_castsi256_ps(vmask));
+		for (j = 0; j < 8; ++j) mask[i + j] = (bits >> j) & 1;
+		nvalid += __builtin_popcount(bits);
+	}
+	if (i < n) nvalid += decode_batch_scalar(dec, ptr, n - i, ra + i, spd + i, mag + i, mask + i);
+	return nvalid;
+}
+#endif
+
+typedef int (*decode_batch_func)(const ucac4_decoder&, const char*, int,
+		uint32_t*, uint32_t*, short*, uint8_t*);
 
+/*!
+ * @brief 按CPU能力选择批量解析实现
+ */
+static decode_batch_func select_decode_batch() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return decode_batch_avx2;
+	if (__builtin_cpu_supports("sse2")) return decode_batch_sse2;
+#endif
+	return decode_batch_scalar;
+}
+
+int ucac4_decode_batch(const ucac4_decoder& dec, const char* raw, int n,
+		uint32_t* ra, uint32_t* spd, short* mag, uint8_t* mask) {
+	static const decode_batch_func func = select_decode_batch();
+	int nvalid = func(dec, raw, n, ra, spd, mag, mask);
+	if (dec.dt != 0.) ucac4_propagate_batch(dec, raw, n, ra, spd);
+	return nvalid;
+}
+
+/*
+ * 自行改正
+ * - cos(DEC)以极距y = PI/2 - |DEC|的正弦计算: sin(y)的Taylor多项式(至y^19), 天极附近相对误差仍小于1E-13.
+ *   标量与向量实现运算次序一致, 结果逐位相同
+ * - 赤经方向自行除以cos(DEC). 天极附近以PM_MINCOS限制, 避免除零
+ */
+#define PM_NCOEF	10
+#define PM_MINCOS	1E-9
+static const double pm_sin_coef[PM_NCOEF] = {// sin(y)/y的Taylor系数, 按y^2降幂排列
+	-1.0 / 121645100408832000., 1.0 / 355687428096000., -1.0 / 1307674368000., 1.0 / 6227020800.,
+	-1.0 / 39916800., 1.0 / 362880., -1.0 / 5040., 1.0 / 120., -1.0 / 6., 1.0
+};
+static const double MAS2RAD     = M_PI / 180. / MILLISEC;
+static const double MILLISEC90  = 90. * MILLISEC;
+static const double MILLISEC180 = 180. * MILLISEC;
+
+static void propagate_scalar(const ucac4_decoder& dec, const char* raw, int n, uint32_t* ra, uint32_t* spd) {
+	const double scale = dec.dt * 0.1;	// 自行量纲: 0.1mas/yr
+	const char* ptr;
+	double r, s, y, y2, c;
+	int i, k;
+
+	for (i = 0, ptr = raw; i < n; ++i, ptr += UCAC4_UNIT) {
+		r  = double(int(ra[i]));
+		s  = double(int(spd[i]));
+		y  = (MILLISEC90 - fabs(s - MILLISEC90)) * MAS2RAD;
+		y2 = y * y;
+		for (k = 1, c = pm_sin_coef[0]; k < PM_NCOEF; ++k) c = c * y2 + pm_sin_coef[k];
+		c = c * y;
+		if (c < PM_MINCOS) c = PM_MINCOS;
+		r = r + double(*(const short*)(ptr + 24)) * scale / c;
+		s = s + double(*(const short*)(ptr + 26)) * scale;
+		if (s < 0.) {
+			s = -s;
+			r = r + MILLISEC180;
+		}
+		else if (s > MILLISEC180) {
+			s = 2. * MILLISEC180 - s;
+			r = r + MILLISEC180;
+		}
+		r = r - floor(r / MILLISEC360) * MILLISEC360;
+		ra[i]  = uint32_t(int(nearbyint(r)));
+		spd[i] = uint32_t(int(nearbyint(s)));
+		if (ra[i] >= MILLISEC360) ra[i] -= MILLISEC360;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * AVX2: 每次处理4条记录. 以32位gather一次取得RA*cos(DEC)及DEC方向自行, 双精度计算
+ */
+__attribute__((target("avx2")))
+static void propagate_avx2(const ucac4_decoder& dec, const char* raw, int n, uint32_t* ra, uint32_t* spd) {
+	const char* ptr = raw;
+	int i, k;
+	const __m128i idx   = _mm_setr_epi32(0, UCAC4_UNIT, 2 * UCAC4_UNIT, 3 * UCAC4_UNIT);
+	const __m128i full  = _mm_set1_epi32(MILLISEC360);
+	const __m256d scale = _mm256_set1_pd(dec.dt * 0.1);
+	const __m256d zero  = _mm256_setzero_pd();
+	const __m256d d90   = _mm256_set1_pd(MILLISEC90);
+	const __m256d d180  = _mm256_set1_pd(MILLISEC180);
+	const __m256d d360  = _mm256_set1_pd(2. * MILLISEC180);
+	const __m256d mas2rad = _mm256_set1_pd(MAS2RAD);
+	const __m256d mincos  = _mm256_set1_pd(PM_MINCOS);
+	__m128i vpm, vi;
+	const __m256d sign  = _mm256_set1_pd(-0.0);
+	__m256d r, s, y, y2, c, pmr, pmd, lt, gt;
+
+	for (i = 0; i + 4 <= n; i += 4, ptr += 4 * UCAC4_UNIT) {
+		vpm = _mm_i32gather_epi32((const int*)(ptr + 24), idx, 1);
+		pmr = _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(vpm, 16), 16));
+		pmd = _mm256_cvtepi32_pd(_mm_srai_epi32(vpm, 16));
+		r   = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(ra + i)));
+		s   = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(spd + i)));
+		y   = _mm256_mul_pd(_mm256_sub_pd(d90, _mm256_andnot_pd(sign, _mm256_sub_pd(s, d90))), mas2rad);
+		y2  = _mm256_mul_pd(y, y);
+		c   = _mm256_set1_pd(pm_sin_coef[0]);
+		for (k = 1; k < PM_NCOEF; ++k)
+			c = _mm256_add_pd(_mm256_mul_pd(c, y2), _mm256_set1_pd(pm_sin_coef[k]));
+		c = _mm256_max_pd(_mm256_mul_pd(c, y), mincos);
+		r = _mm256_add_pd(r, _mm256_div_pd(_mm256_mul_pd(pmr, scale), c));
+		s = _mm256_add_pd(s, _mm256_mul_pd(pmd, scale));
+		// 越过天极
+		lt = _mm256_cmp_pd(s, zero, _CMP_LT_OQ);
+		gt = _mm256_cmp_pd(s, d180, _CMP_GT_OQ);
+		s  = _mm256_blendv_pd(s, _mm256_sub_pd(zero, s), lt);
+		s  = _mm256_blendv_pd(s, _mm256_sub_pd(d360, s), gt);
+		r  = _mm256_add_pd(r, _mm256_and_pd(_mm256_or_pd(lt, gt), d180));
+		// 赤经归一化到[0, 360)
+		r  = _mm256_sub_pd(r, _mm256_mul_pd(_mm256_floor_pd(_mm256_div_pd(r, _mm256_set1_pd(MILLISEC360))),
+				_mm256_set1_pd(MILLISEC360)));
+		vi = _mm256_cvtpd_epi32(r);
+		vi = _mm_sub_epi32(vi, _mm_and_si128(_mm_cmpgt_epi32(vi, _mm_sub_epi32(full, _mm_set1_epi32(1))), full));
+		_mm_storeu_si128((__m128i*)(ra + i), vi);
+		_mm_storeu_si128((__m128i*)(spd + i), _mm256_cvtpd_epi32(s));
+	}
+	if (i < n) propagate_scalar(dec, ptr, n - i, ra + i, spd + i);
+}
+#endif
+
+typedef void (*propagate_func)(const ucac4_decoder&, const char*, int, uint32_t*, uint32_t*);
+
+static propagate_func select_propagate() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return propagate_avx2;
+#endif
+	return propagate_scalar;
+}
+
+void ucac4_propagate_batch(const ucac4_decoder& dec, const char* raw, int n, uint32_t* ra, uint32_t* spd) {
+	static const propagate_func func = select_propagate();
+	func(dec, raw, n, ra, spd);
+}
+
+int ucac4_compact(uint32_t* ra, uint32_t* spd, short* mag, const uint8_t* mask, int n) {
+	int i, k;
+
+	for (i = k = 0; i < n; ++i) {// 无分支压缩: 总是写入, 仅在保留时前移
+		ra[k]  = ra[i];
+		spd[k] = spd[i];
+		mag[k] = mag[i];
+		k += mask[i];
+	}
+	return k;
+}
+
+/*!
+ * @brief 批量解析连续存放的n条记录, 将通过筛选的星追加到batch
+ */
+static void decode_records(const ucac4_decoder& dec, const char* buff, int n, CatBatch& batch) {
+	uint8_t mask[UCAC4_BATCH], inside[UCAC4_BATCH];
+	int i, j, m, k, nvalid;
+
+	for (i = 0; i < n; i += m, buff += m * UCAC4_UNIT) {
+		m = n - i < UCAC4_BATCH ? n - i : UCAC4_BATCH;
+		k = batch.size();
+		batch.resize(k + m);
+		nvalid = ucac4_decode_batch(dec, buff, m, &batch.ra[k], &batch.spd[k], &batch.mag[k], mask);
+		if (dec.region && nvalid) {// 剔除大像元及其边缘以外的恒星
+			dec.region->Select(&batch.ra[k], &batch.spd[k], m, inside);
+			for (j = 0, nvalid = 0; j < m; ++j) nvalid += (mask[j] &= inside[j]);
+		}
+		if (nvalid < m) {
+			batch.resize(k + ucac4_compact(&batch.ra[k], &batch.spd[k], &batch.mag[k], mask, m));
+		}
+	}
+}
+
+void ucac4_decode_zone(const ucac4_decoder* dec, int bands, const char* buff, int n,
+		ucac4_zone& data) {
+	for (int b = 0; b < UCAC4_NBAND; ++b) {
+		if (!(bands & (1 << b))) continue;
+		int k = data.band[b].size();
+		decode_records(dec[b], buff, n, data.band[b]);
+		if (dec[b].occnside > 0) {// 在解析线程中统计占用的像元, 写入时只需合并
+			if (data.occ.Nside() != dec[b].occnside) data.occ.Reset(dec[b].occnside);
+			data.occ.AddStars(&data.band[b].ra[k], &data.band[b].spd[k], data.band[b].size() - k);
+		}
+	}
+}
+
+void ucac4_footprint_init(ucac4_footprint& fp, const index_param& param) {
+	healpix_bound bound;
+	double pad(0.0);
+	double spdlo, spdhi;
+	int fnside;
+
+	fp.zone0 = 1;
+	fp.zone1 = UCAC4_NZONE;
+	fp.nra   = 0;
+	if (param.bighp < 0 || param.bignside <= 0) return;
+
+	// 边缘扩展margin个均匀化像元, 按像元最大尺度的1.5倍估计
+	fnside = param.UNside ? param.UNside : param.Nside;
+	if (param.margin > 0 && fnside > 0)
+		pad = param.margin * 1.5 * sqrt(M_PI / 3.) / fnside;
+	healpix_nest_bound(param.bignside, param.bighp, pad, bound);
+
+	spdlo = (bound.declo * 180. / M_PI + 90.) * MILLISEC;
+	spdhi = (bound.dechi * 180. / M_PI + 90.) * MILLISEC;
+	fp.zone0 = int(spdlo / UCAC4_ZONE_SPD) + 1;
+	fp.zone1 = int(spdhi / UCAC4_ZONE_SPD) + 1;
+	if (fp.zone0 < 1) fp.zone0 = 1;
+	if (fp.zone1 > UCAC4_NZONE) fp.zone1 = UCAC4_NZONE;
+	if (bound.allra) return;
+
+	uint32_t ralo = uint32_t(floor(bound.ralo * 180. / M_PI * MILLISEC));
+	uint32_t rahi = uint32_t(ceil(bound.rahi * 180. / M_PI * MILLISEC)) + 1;
+	if (rahi > MILLISEC360) rahi = MILLISEC360;
+	if (bound.ralo < bound.rahi) {
+		fp.nra = 1;
+		fp.ra0[0] = ralo;
+		fp.ra1[0] = rahi;
+	}
+	else {// 跨越赤经0点
+		fp.nra = 2;
+		fp.ra0[0] = 0;
+		fp.ra1[0] = rahi;
+		fp.ra0[1] = ralo;
+		fp.ra1[1] = MILLISEC360;
+	}
+}
+
+/*!
+ * @brief 由赤经区间计算需读取的记录范围. 天区内记录按赤经升序排列
+ * @param getra 取第i条记录的赤经, 形如bool(int i, uint32_t& ra), 读取失败时返回false
+ * @param lo, hi 输出: 记录范围[lo, hi)
+ * @return
+ * 记录范围数量. 读取赤经失败时返回-1
+ */
+template <class GetRA>
+static int zone_slices(const ucac4_footprint* fp, int nrec, GetRA getra, int* lo, int* hi) {
+	if (!fp || fp->nra == 0) {
+		lo[0] = 0;
+		hi[0] = nrec;
+		return 1;
+	}
+
+	int i, n(0), l, r, m;
+	uint32_t bound[2], ra;
+
+	for (i = 0; i < fp->nra; ++i) {
+		bound[0] = fp->ra0[i];
+		bound[1] = fp->ra1[i];
+		for (int k = 0; k < 2; ++k) {// 二分查找第一条赤经不小于bound[k]的记录
+			for (l = 0, r = nrec; l < r; ) {
+				m = (l + r) / 2;
+				if (!getra(m, ra)) return -1;
+				if (ra < bound[k]) l = m + 1;
+				else r = m;
+			}
+			(k ? hi : lo)[n] = l;
+		}
+		if (hi[n] > lo[n]) ++n;
+	}
+	return n;
+}
+
+int ucac4_zone_slices(int fd, int nrec, const ucac4_footprint* fp, int* lo, int* hi) {
+	return zone_slices(fp, nrec, [fd](int k, uint32_t& ra) {
+		return pread(fd, &ra, sizeof(ra), off_t(k) * UCAC4_UNIT) == sizeof(ra);
+	}, lo, hi);
+}
+
+/*!
+ * @brief fread方式: 分块复制到缓冲区后解析
+ * @return
+ * 文件打开失败、定位失败或读取不足时返回false
+ */
+static bool read_zone_fread(const char* filepath, const ucac4_decoder* dec, int bands,
+		const ucac4_footprint* fp, ucac4_zone& data) {
+	int nbuf(1000), nread, nrec, nslice, i, j;
+	int lo[2], hi[2];
+	long size;
+	char *buff;
+	FILE *fpcat;
+	bool rslt(true);
+
+	if ((fpcat = fopen(filepath, "rb")) == NULL) return false;
+	if (fseek(fpcat, 0, SEEK_END) || (size = ftell(fpcat)) < 0) {
+		fclose(fpcat);
+		return false;
+	}
+	nrec = int(size / UCAC4_UNIT);
+	nslice = zone_slices(fp, nrec, [fpcat](int k, uint32_t& ra) {
+		return !fseek(fpcat, long(k) * UCAC4_UNIT, SEEK_SET) && fread(&ra, sizeof(ra), 1, fpcat) == 1;
+	}, lo, hi);
+	if (nslice < 0) {
 		fclose(fpcat);
+		return false;
+	}
+
+	buff = new char[nbuf * UCAC4_UNIT];
+	for (i = 0; i < nslice && rslt; ++i) {
+		if (fseek(fpcat, long(lo[i]) * UCAC4_UNIT, SEEK_SET)) rslt = false;
+		for (j = lo[i]; j < hi[i] && rslt; j += nread) {
+			nread = hi[i] - j < nbuf ? hi[i] - j : nbuf;
+			if (int(fread(buff, UCAC4_UNIT, nread, fpcat)) != nread) rslt = false;
+			else ucac4_decode_zone(dec, bands, buff, nread, data);
+		}
 	}
+	if (ferror(fpcat)) rslt = false;
 	delete []buff;
-	fflush(fptmp);
-	fseek(fptmp, 0, SEEK_SET);
+	fclose(fpcat);
 
-	// 写入FITS文件
-	FITSHandler hfit;
-	sprintf(param.pathcat, "%s/astindex-%d.fit", pathcat, param.indexid);
-	if (!hfit(param.pathcat, 2)) {
-		printf ("Failed to create temporary catalog index\n");
+	return rslt;
+}
+
+/*!
+ * @brief mmap方式: 映射整个文件, 按UCAC4_UNIT步长原位解析
+ * @return
+ * 1: 成功; 0: 文件打开失败; -1: 映射失败, 由调用者改用fread方式
+ */
+static int read_zone_mmap(const char* filepath, const ucac4_decoder* dec, int bands,
+		const ucac4_footprint* fp, ucac4_zone& data) {
+	struct stat st;
+	const char *base;
+	void *addr;
+	int fd, nrec, nslice, i, b;
+	int lo[2], hi[2];
+
+	if ((fd = open(filepath, O_RDONLY)) < 0) return 0;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
 	}
-	else {
-		// HDU 1
-		fits_create_img(hfit(), BYTE_IMG, 0, NULL, hfit.Status());
-		fits_write_comment(hfit(),
-				"simplified binary TYCHO2 catalog, just stores RA/DEC and Magnitude, expected to be used for celestial fix. "
-				"including all-sky stars from tycho2 and its' supplementary catalog. "
-				"RA is stored as 32-bit unsigned integer in milli arcsecs. "
-				"DEC is transformed to distance from SOUTH Pole and then stored as 32-bit unsigned ingeter in milli arcsecs. "
-				"Magnitude refers to V band from BT and VT, is stored as 16-bit integer in milli mag.",
-				hfit.Status());
-		fits_write_comment(hfit(),
-				"RA is stored as 32-bit unsigned integer in milli arcsecs. ",
-				hfit.Status());
-		fits_write_comment(hfit(),
-				"DEC is transformed to distance from SOUTH Pole and then stored as 32-bit unsigned ingeter in milli arcsecs. ",
-				hfit.Status());
-		fits_write_comment(hfit(),
-				"Magnitude refers to V band from BT and VT, is stored as 16-bit integer in milli mag.",
-				hfit.Status());
-
-		// HDU 2
-		char *ttype3[] = {"RA", "DEC", "Mag"};
-		char *tform3[] = {"1J", "1J", "1I"};
-		char *tunit3[] = {"mas", "mas", "millimag"};
-		CatStar* stars = new CatStar[nbuf];
-		uint32_t* ra  = new uint32_t[nbuf];
-		uint32_t* spd = new uint32_t[nbuf];
-		short* mag = new short[nbuf];
-		int haswrite(1);
-
-		fits_create_tbl(hfit(), BINARY_TBL, ntot, 3, ttype3, tform3, tunit3, NULL, hfit.Status());
-		while ((nread = fread(stars, sizeof(CatStar), nbuf, fptmp)) > 0) {
-			for (i = 0; i < nread; ++i) {
-				ra[i]  = stars[i].ra;
-				spd[i] = stars[i].spd;
-				mag[i] = stars[i].mag;
-			}
+	if (st.st_size < UCAC4_UNIT) {// 空天区
+		close(fd);
+		return 1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) return -1;
 
-			fits_write_col(hfit(), TUINT, 1, haswrite, 1, nread, ra,  hfit.Status());
-			fits_write_col(hfit(), TUINT, 2, haswrite, 1, nread, spd, hfit.Status());
-			fits_write_col(hfit(), TUINT, 3, haswrite, 1, nread, mag, hfit.Status());
-			haswrite += nread;
+	base = (const char*) addr;
+	nrec = int(st.st_size / UCAC4_UNIT);
+	nslice = zone_slices(fp, nrec, [base](int k, uint32_t& ra) {
+		ra = ((const uint32_t*)(base + long(k) * UCAC4_UNIT))[0];
+		return true;
+	}, lo, hi);
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	for (i = 0; i < nslice; ++i) {
+		const char* ptr = base + long(lo[i]) * UCAC4_UNIT;
+		long page = long(ptr - base) & ~(sysconf(_SC_PAGESIZE) - 1);
+		madvise((char*) addr + page, long(hi[i] - lo[i]) * UCAC4_UNIT + (ptr - base - page),
+				MADV_WILLNEED);
+		for (b = 0; b < UCAC4_NBAND; ++b) {
+			if (bands & (1 << b)) data.band[b].reserve(data.band[b].size() + hi[i] - lo[i]);
 		}
+		ucac4_decode_zone(dec, bands, ptr, hi[i] - lo[i], data);
+	}
+	munmap(addr, st.st_size);
 
-		// 处理结果
-		if (hfit.Success()) printf ("catalog UCAC4 is saved to [%s]\n", param.pathcat);
-		else printf ("build_ucac4_fits() failed: %s\n", hfit.GetError());
+	return 1;
+}
+
+bool ucac4_read_zone(const char* pathcat, int zone, const index_param& param,
+		ucac4_zone& data, const ucac4_footprint* fp) {
+	char filepath[PATH_MAX];
+	ucac4_decoder dec[UCAC4_NBAND];
+	int bands = ucac4_extract_bands(param);
+	int rslt, b;
 
-		delete []stars;
-		delete []ra;
-		delete []spd;
-		delete []mag;
+	for (b = 0; b < UCAC4_NBAND; ++b) ucac4_decoder_init(dec[b], param, b);
+	data.clear();
+	snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", pathcat, zone);
+	if (param.reader != UCAC4_READ_FREAD) {
+		if ((rslt = read_zone_mmap(filepath, dec, bands, fp, data)) >= 0)
+			return rslt == 1;
+		data.clear();
 	}
+	return read_zone_fread(filepath, dec, bands, fp, data);
+}
 
-	// 结束: 释放资源
-	fclose(fptmp);
-	remove(pathtmp);
+/*!
+ * @struct ucac4_zone_pool 多线程解析天区文件时的共享状态
+ * - 工作线程按编号领取天区, 解析结果存入对应槽位
+ * - 调用线程按编号顺序合并槽位, 保证输出顺序与单线程一致
+ * - 领取编号最多超前合并位置window个天区, 限制驻留内存
+ */
+struct ucac4_zone_pool {
+	const char* pathcat;
+	const index_param* param;
+	ucac4_footprint fp;	//< 需读取的天区及赤经范围
+	int window;		//< 允许超前合并位置的天区数量
+	int next_zone;	//< 下一个待领取的天区
+	int next_merge;	//< 下一个待合并的天区
+	bool abort;		//< 终止标志
+	ucac4_zone slot[UCAC4_NZONE + 1];	//< 各天区解析结果
+	int state[UCAC4_NZONE + 1];	//< 0: 未完成; 1: 完成; -1: 失败
+	mutex mtx;
+	condition_variable cv_zone;		//< 通知: 可领取新天区
+	condition_variable cv_merge;	//< 通知: 有天区完成解析
+};
+
+static void zone_worker(ucac4_zone_pool* pool) {
+	ucac4_zone stars;
+	int zone;
+	bool rslt;
+
+	while (1) {
+		unique_lock<mutex> lck(pool->mtx);
+		while (!pool->abort && pool->next_zone <= pool->fp.zone1
+				&& pool->next_zone >= pool->next_merge + pool->window)
+			pool->cv_zone.wait(lck);
+		if (pool->abort || pool->next_zone > pool->fp.zone1) break;
+		zone = pool->next_zone++;
+		lck.unlock();
+
+		rslt = ucac4_read_zone(pool->pathcat, zone, *pool->param, stars, &pool->fp);
+
+		lck.lock();
+		pool->slot[zone].swap(stars);
+		pool->state[zone] = rslt ? 1 : -1;
+		pool->cv_merge.notify_all();
+	}
 }
 
-void ucac4_resolve_item(char *buff, int band, CatStar& star) {
-	star.ra     = ((uint32_t*) buff)[0];
-	star.spd    = ((uint32_t*) buff)[1];
-	if (band < 5) star.mag = ((short*)(buff + 46))[band];
-	else star.mag = ((short*)(buff + 34))[band - 5];
+int ucac4_scan_zones(const char* pathcat, const index_param& param,
+		ucac4_zone_handler handler, void* extra) {
+	ucac4_zone stars;
+	ucac4_footprint fp;
+	int nthread = param.nthread;
+	int zone, i;
+
+	ucac4_footprint_init(fp, param);
+	if (nthread <= 1) {// 单线程: 顺序读取
+		for (zone = fp.zone0; zone <= fp.zone1; ++zone) {
+			if (!ucac4_read_zone(pathcat, zone, param, stars, &fp)) break;
+			handler(zone, stars, extra);
+		}
+		return zone - 1;
+	}
+
+	ucac4_zone_pool* pool = new ucac4_zone_pool;
+	vector<thread> workers;
+
+	pool->pathcat    = pathcat;
+	pool->param      = &param;
+	pool->fp         = fp;
+	pool->window     = nthread * 2;
+	pool->next_zone  = fp.zone0;
+	pool->next_merge = fp.zone0;
+	pool->abort      = false;
+	memset(pool->state, 0, sizeof(pool->state));
+	for (i = 0; i < nthread; ++i) workers.push_back(thread(zone_worker, pool));
+
+	for (zone = fp.zone0; zone <= fp.zone1; ++zone) {
+		unique_lock<mutex> lck(pool->mtx);
+		while (pool->state[zone] == 0) pool->cv_merge.wait(lck);
+		if (pool->state[zone] < 0) break;
+		stars.swap(pool->slot[zone]);
+		pool->slot[zone].clear();
+		pool->next_merge = zone + 1;
+		pool->cv_zone.notify_all();
+		lck.unlock();
+
+		handler(zone, stars, extra);
+	}
+
+	{// 结束: 通知并等待工作线程退出
+		lock_guard<mutex> lck(pool->mtx);
+		pool->abort = true;
+		pool->cv_zone.notify_all();
+	}
+	for (i = 0; i < nthread; ++i) workers[i].join();
+	delete pool;
+
+	return zone - 1;
 }
@@ -8,10 +8,18 @@
 #include <string.h>
 #include "build_index.h"
 #include "cat_index.h"
+#include "catcache.h"
+#include "healpix.h"
+#include "occupancy.h"
 
 #define MILLISEC		3600000		//< 1度=3600000毫角秒
 #define MILLISEC360		1296000000	// 360度对应的毫角秒
 #define UCAC4_UNIT		78			//< UCAC4每个条目的占用空间, 量纲: 字节
+#define UCAC4_NZONE		900			//< UCAC4天区文件数量: z001~z900
+#define UCAC4_ZONE_SPD	720000		//< 每个天区的赤纬宽度, 量纲: mas. z001起始于南天极
+#define UCAC4_BATCH		4096		//< 批量解析时每批记录数
+#define UCAC4_NBAND		8			//< 可提取的星等波段数量
+#define UCAC4_PATH_RESERVE	64		//< 星表目录路径之外为派生文件名预留的长度
 
 // UCAC4原始星表结构：
 typedef struct ucac4_item {
@@ -64,19 +72,175 @@ public:
     }
 }* ucac4item_ptr;
 ///////////////////////////////////////////////////////////////////////////////
-static const char* ucac4_band[] = {// UCAC4星表波段名称定义
-//   0    1    2    3    4    5    6    7
-	"B", "V", "g", "r", "i", "J", "H", "K"
+extern const char* ucac4_band[UCAC4_NBAND];	// UCAC4星表波段名称定义: BVgriJHK
+
+/*!
+ * @struct ucac4_decoder 批量解析参数
+ */
+typedef struct {
+	int band;			//< 滤光片波段索引
+	short brightcut;	//< 亮端截断, 量纲: 毫星等
+	double dt;			//< 目标历元与J2000之差, 量纲: 年. 0: 不做自行改正
+	bool filter;		//< 是否按质量标志剔除
+	uint32_t flagmask[2];	//< 标志字掩码. [0]: 偏移12起的4字节(cdf); [1]: 偏移66起的4字节(leda, x2m)
+	uint32_t objtmask;		//< 剔除的目标类型, 位v对应objt == v
+	const healpix_region* region;	//< 大像元及其边缘. 非空时剔除区域外的恒星
+	int occnside;		//< 统计占用像元的网格. 0: 不统计
+} ucac4_decoder;
+
+/*!
+ * @struct ucac4_zone 单个天区的解析结果
+ * 每个提取波段一组列, 各自按该波段星等做亮端截断; 未提取的波段为空
+ */
+struct ucac4_zone {
+	CatBatch band[UCAC4_NBAND];
+	OccupancyMap occ;	//< 滤光片波段恒星占用的像元. 仅在解析参数occnside > 0时统计
+
+public:
+	void clear() {
+		for (int i = 0; i < UCAC4_NBAND; ++i) band[i].clear();
+		occ.clear();
+	}
+
+	void swap(ucac4_zone& other) {
+		for (int i = 0; i < UCAC4_NBAND; ++i) band[i].swap(other.band[i]);
+		occ.swap(other.occ);
+	}
 };
 
+/*!
+ * @struct ucac4_footprint 需读取的天区及赤经范围
+ * 由-H/-s指定的大像元及-m边缘计算, 用于跳过与之不相交的数据
+ */
+typedef struct {
+	int zone0, zone1;			//< 天区编号范围, [zone0, zone1]
+	int nra;					//< 赤经区间数量. 0: 不限赤经
+	uint32_t ra0[2], ra1[2];	//< 赤经区间[ra0, ra1), 量纲: 毫角秒
+} ucac4_footprint;
+
+/*!
+ * @brief 天区解析结果的回调函数
+ * @param zone  天区编号, [1, UCAC4_NZONE]
+ * @param data  该天区中通过亮端截断的恒星
+ * @param extra 调用者附加参数
+ */
+typedef void (*ucac4_zone_handler)(int zone, const ucac4_zone& data, void* extra);
+
 /*!
  * @brief 由UCAC4星表构建临时FITS文件
+ * @note
+ * - 仅提取filter_band时输出<pathcat>/astindex-<indexid>.fit;
+ *   同时提取多个波段时, 每个波段输出<pathcat>/astindex-<indexid>-<波段>.fit.
+ *   结束后param.pathcat指向filter_band对应的文件
+ * - param.usecache有效时, 解析结果同时写入缓存目录; 参数与源文件一致的后续构建直接复用缓存,
+ *   全部波段命中时不再读取UCAC4
+ * @return
+ * 全部天区读取成功且中间星表写入完成时返回true. 星表目录路径超出PATH_MAX - UCAC4_PATH_RESERVE时返回false
+ */
+bool build_ucac4_fits(const char* pathcat, index_param& param);
+/*!
+ * @brief 由索引构建参数初始化批量解析参数
+ * @param band 波段索引. < 0时使用param.filter_band
+ * @note
+ * - 指定大像元且不去重(dedup <= 0)时, 在解析阶段即剔除大像元及其边缘以外的恒星.
+ *   去重时保留区域外的恒星, 使区域边界附近的去重结果不变
+ * - scanoccupied有效时, 滤光片波段的解析结果同时统计Nside网格中占用的像元
+ */
+void ucac4_decoder_init(ucac4_decoder& dec, const index_param& param, int band = -1);
+/*!
+ * @brief 单次遍历中提取的波段集合
+ * @return
+ * 位i对应波段i. param.bands与param.filter_band的并集
+ */
+int ucac4_extract_bands(const index_param& param);
+/*!
+ * @brief 批量解析n条原始记录, 按列输出
+ * 剔除星等亮于dec.brightcut, 或带有dec指定质量标志的记录
+ * @param raw  n条连续存放的原始记录, 步长UCAC4_UNIT
+ * @param ra   输出: 赤经, n个元素
+ * @param spd  输出: 南天极距离, n个元素
+ * @param mag  输出: dec.band对应星等, n个元素
+ * @param mask 输出: 1: 通过筛选; 0: 剔除
+ * @return
+ * 通过筛选的记录数
+ * @note
+ * - 运行时按CPU能力选择AVX2/SSE2/标量实现, 结果一致
+ * - dec.dt非0时, 输出坐标已由ucac4_propagate_batch()改正到目标历元
+ */
+int ucac4_decode_batch(const ucac4_decoder& dec, const char* raw, int n,
+		uint32_t* ra, uint32_t* spd, short* mag, uint8_t* mask);
+/*!
+ * @brief 按自行将n条记录的坐标由J2000历元推算到目标历元
+ * @param raw 原始记录, 提供RA*cos(DEC)及DEC方向自行
+ * @param ra, spd 输入: J2000历元坐标; 输出: 目标历元坐标. 量纲: 毫角秒
+ * @note
+ * - UCAC4给出的位置已归算到J2000历元, 故推算间隔为dec.dt, 与cepra/cepdc无关
+ * - 越过天极时赤经翻转180度
+ */
+void ucac4_propagate_batch(const ucac4_decoder& dec, const char* raw, int n, uint32_t* ra, uint32_t* spd);
+/*!
+ * @brief 按mask原位压缩列, 保留mask为1的行
+ * @return
+ * 保留的行数
+ */
+int ucac4_compact(uint32_t* ra, uint32_t* spd, short* mag, const uint8_t* mask, int n);
+/*!
+ * @brief 对bands中的每个波段解析同一段原始记录, 追加到data
+ * @param dec 各波段的解析参数, UCAC4_NBAND个元素
+ */
+void ucac4_decode_zone(const ucac4_decoder* dec, int bands, const char* raw, int n,
+		ucac4_zone& data);
+/*!
+ * @brief 计算需读取的天区及赤经范围
+ * @note
+ * 未指定大像元(bighp < 0或bignside <= 0)时覆盖全天
+ */
+void ucac4_footprint_init(ucac4_footprint& fp, const index_param& param);
+/*!
+ * @brief 填写缓存文件头的参数部分
+ * @param band 星等波段索引
+ * @note
+ * 源文件校验和由footprint内各天区文件的大小与修改时间计算
+ */
+void ucac4_cache_header(catcache_header& hdr, const char* pathcat, const index_param& param,
+		int band, const ucac4_footprint& fp);
+/*!
+ * @brief 由赤经区间计算天区文件中需读取的记录范围
+ * @param fd     天区文件描述符
+ * @param nrec   天区记录数
+ * @param lo, hi 输出: 记录范围[lo, hi), 至多2段
+ * @return
+ * 记录范围数量. 读取赤经失败时返回-1
+ */
+int ucac4_zone_slices(int fd, int nrec, const ucac4_footprint* fp, int* lo, int* hi);
+/*!
+ * @brief 读取并解析单个天区文件
+ * @param pathcat   UCAC4根目录
+ * @param zone      天区编号, [1, UCAC4_NZONE]
+ * @param param     使用filter_band, bands, brightcut和reader
+ * @param data      输出: 各提取波段中星等不亮于brightcut的恒星
+ * @param fp        非空时仅读取赤经落在fp区间内的记录
+ * @return
+ * 天区文件打开失败、定位失败或读取不足时返回false
+ * @note
+ * reader不是UCAC4_READ_FREAD时使用mmap方式, 映射失败时自动改用fread方式
+ */
+bool ucac4_read_zone(const char* pathcat, int zone, const index_param& param,
+		ucac4_zone& data, const ucac4_footprint* fp = NULL);
+/*!
+ * @brief 遍历天区, 按天区编号顺序将解析结果交给handler
+ * @note
+ * - param.nthread <= 1时在调用线程中顺序执行
+ * - 指定大像元时仅遍历ucac4_footprint_init()给出的天区及赤经范围
+ * @return
+ * 最后一个成功处理的天区编号. 遇到无法打开的天区文件时终止
  */
-void build_ucac4_fits(const char* pathcat, index_param& param);
+int ucac4_scan_zones(const char* pathcat, const index_param& param,
+		ucac4_zone_handler handler, void* extra);
 /*!
  * @brief 解析星表条目
  * @param band 滤光片波段索引
  */
-void ucac4_resolve_item(char *buff, int band, CatStar& star);
+void ucac4_resolve_item(const char *buff, int band, CatStar& star);
 
 #endif /* SRC_UCAC4API_H_ */
@@ -0,0 +1,412 @@
+/**
+ * @file ucac4pipe.cpp 读取/解析/写入三级流水线方式遍历UCAC4天区
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include "ucac4pipe.h"
+#include "ringbuf.h"
+#include "uring.h"
+
+using namespace std;
+
+const char* ucac4_pipe_stage[UCAC4_PIPE_NSTAGE] = {
+	"reader", "decoder", "writer"
+};
+
+/*!
+ * @brief 数据块类型
+ */
+enum {
+	PIPE_DATA,	///< 记录数据
+	PIPE_END,	///< 遍历结束
+	PIPE_FAIL	///< 天区文件打开或读取失败, 遍历终止
+};
+
+/*!
+ * @struct pipe_raw 原始记录块
+ */
+struct pipe_raw {
+	int type;		//< 数据块类型
+	int zone;		//< 天区编号
+	bool last;		//< 是否为该天区的最后一块. 该块读取完成后关闭fd
+	int fd;			//< 天区文件描述符
+	off_t offset;	//< 首条记录在文件中的偏移
+	int nrec;		//< 记录数
+	int nread;		//< 已读取字节数
+	bool done;		//< 读取是否完成
+	int error;		//< 读取错误, errno. 0: 已读取全部记录
+	struct iovec iov;	//< io_uring读缓冲区
+	char* buff;		//< 存储区, UCAC4_PIPE_BLOCK条记录
+};
+
+/*!
+ * @struct pipe_decoded 解析结果块
+ */
+struct pipe_decoded {
+	int type;		//< 数据块类型
+	int zone;		//< 天区编号
+	bool last;		//< 是否为该天区的最后一块
+	ucac4_zone data;	//< 各波段解析结果
+};
+
+/*!
+ * @struct ucac4_pipe 流水线共享状态
+ * 每个队列只有一个生产者线程和一个消费者线程:
+ * - raw_full:  读取级 -> 解析级
+ * - raw_free:  解析级 -> 读取级
+ * - dec_full:  解析级 -> 写入级
+ * - dec_free:  写入级 -> 解析级
+ */
+struct ucac4_pipe {
+	const char* pathcat;
+	ucac4_footprint fp;
+	ucac4_decoder dec[UCAC4_NBAND];
+	int bands;
+	spsc_ring<pipe_raw*> raw_full, raw_free;
+	spsc_ring<pipe_decoded*> dec_full, dec_free;
+	ucac4_pipe_stat stat;
+
+public:
+	ucac4_pipe()
+		: raw_full(UCAC4_PIPE_DEPTH), raw_free(UCAC4_PIPE_DEPTH),
+		  dec_full(UCAC4_PIPE_DEPTH), dec_free(UCAC4_PIPE_DEPTH) {
+		memset(&stat, 0, sizeof(stat));
+	}
+};
+
+static inline double pipe_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief 队列空或满时让出处理器. 长时间等待时改为休眠, 避免空转
+ */
+static inline void pipe_backoff(int i) {
+	if (i < 64) this_thread::yield();
+	else this_thread::sleep_for(chrono::microseconds(50));
+}
+
+template <class T>
+static T pop_wait(spsc_ring<T>& ring, double& stall) {
+	T val;
+	if (ring.TryPop(val)) return val;
+	double t0 = pipe_clock();
+	for (int i = 0; !ring.TryPop(val); ++i) pipe_backoff(i);
+	stall += pipe_clock() - t0;
+	return val;
+}
+
+template <class T>
+static void push_wait(spsc_ring<T>& ring, const T& val, double& stall) {
+	if (ring.TryPush(val)) return;
+	double t0 = pipe_clock();
+	for (int i = 0; !ring.TryPush(val); ++i) pipe_backoff(i);
+	stall += pipe_clock() - t0;
+}
+
+/*!
+ * @struct zone_cursor 按天区顺序将需读取的记录范围划分为数据块
+ */
+struct zone_cursor {
+	const char* pathcat;
+	const ucac4_footprint* fp;
+	int zone;		//< 当前天区
+	int fd;			//< 当前天区文件. < 0: 尚未打开
+	int nslice;		//< 当前天区的记录范围数量
+	int islice;		//< 当前记录范围
+	int next;		//< 下一条待划分的记录
+	int lo[2], hi[2];	//< 记录范围
+
+public:
+	zone_cursor(const char* path, const ucac4_footprint* footprint) {
+		pathcat = path;
+		fp      = footprint;
+		zone    = fp->zone0;
+		fd      = -1;
+		nslice = islice = next = 0;
+	}
+
+	/*!
+	 * @brief 划分下一个数据块
+	 * @return
+	 * 数据块类型. 无记录的天区输出一个nrec为0的块
+	 * @note
+	 * 天区最后一块的fd由调用者关闭
+	 */
+	int Next(pipe_raw* blk) {
+		blk->nread = 0;
+		blk->error = 0;
+		if (fd < 0) {
+			if (zone > fp->zone1) return PIPE_END;
+
+			char filepath[PATH_MAX];
+			struct stat st;
+
+			snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", pathcat, zone);
+			if ((fd = open(filepath, O_RDONLY)) < 0) {
+				blk->zone = zone;
+				return PIPE_FAIL;
+			}
+			errno = 0;
+			if (fstat(fd, &st) || (nslice = ucac4_zone_slices(fd, int(st.st_size / UCAC4_UNIT), fp, lo, hi)) < 0) {
+				printf ("Failed to read z%03d: %s\n", zone, errno ? strerror(errno) : "short read");
+				close(fd);
+				fd = -1;
+				blk->zone = zone;
+				return PIPE_FAIL;
+			}
+			islice = 0;
+			next   = nslice ? lo[0] : 0;
+		}
+
+		blk->zone = zone;
+		blk->fd   = fd;
+		if (islice < nslice) {
+			blk->offset = off_t(next) * UCAC4_UNIT;
+			blk->nrec   = hi[islice] - next < UCAC4_PIPE_BLOCK ? hi[islice] - next : UCAC4_PIPE_BLOCK;
+			if ((next += blk->nrec) >= hi[islice] && ++islice < nslice) next = lo[islice];
+		}
+		else {
+			blk->offset = 0;
+			blk->nrec   = 0;
+		}
+		if ((blk->last = islice >= nslice)) {
+			fd = -1;
+			++zone;
+		}
+		return PIPE_DATA;
+	}
+
+	/*!
+	 * @brief 遍历终止时关闭当前天区文件
+	 */
+	void Close() {
+		if (fd >= 0) close(fd);
+		fd = -1;
+	}
+};
+
+/*!
+ * @brief 以pread读取数据块的剩余部分
+ * @return
+ * 0: 读取完整; 其它: errno. 文件在读取范围内结束时为EIO
+ */
+static int pread_block(pipe_raw* blk) {
+	int len = blk->nrec * UCAC4_UNIT;
+	ssize_t rslt;
+
+	for (; blk->nread < len; blk->nread += int(rslt)) {
+		rslt = pread(blk->fd, blk->buff + blk->nread, len - blk->nread, blk->offset + blk->nread);
+		if (rslt < 0 && errno == EINTR) rslt = 0;
+		else if (rslt <= 0) return rslt < 0 ? errno : EIO;
+	}
+	return 0;
+}
+
+/*!
+ * @brief 交付解析级前处理读取完成的数据块: 关闭天区文件, 读取失败时终止遍历
+ * @return
+ * 读取失败时返回false
+ */
+static bool finish_block(ucac4_pipe* pipe, pipe_raw* blk) {
+	if (blk->last) close(blk->fd);
+	if (blk->error) {
+		printf ("Failed to read z%03d at byte %lld: %s\n", blk->zone, (long long)(blk->offset + blk->nread),
+				strerror(blk->error));
+		blk->type = PIPE_FAIL;
+		return false;
+	}
+	pipe->stat.nrec  += blk->nrec;
+	pipe->stat.bytes += blk->nread;
+	return true;
+}
+
+/*!
+ * @brief 读取级: pread同步读取
+ */
+static void read_stage_pread(ucac4_pipe* pipe) {
+	zone_cursor cursor(pipe->pathcat, &pipe->fp);
+	double& stall = pipe->stat.stall[0];
+	pipe_raw* blk;
+
+	do {
+		blk = pop_wait(pipe->raw_free, stall);
+		if ((blk->type = cursor.Next(blk)) == PIPE_DATA) {
+			blk->error = pread_block(blk);
+			if (!finish_block(pipe, blk)) cursor.Close();
+		}
+		push_wait(pipe->raw_full, blk, stall);
+	} while (blk->type == PIPE_DATA);
+}
+
+/*!
+ * @brief 读取级: io_uring异步读取
+ * - 最多UCAC4_PIPE_DEPTH个数据块同时在途, 按提交顺序交付解析级
+ * - io_uring调用失败时等待已提交的请求全部完成, 未完成的数据块改为pread重新读取
+ * - 读取失败的数据块以PIPE_FAIL交付, 等待其余在途请求完成后结束
+ */
+static void read_stage_uring(ucac4_pipe* pipe, uring_reader& ring) {
+	zone_cursor cursor(pipe->pathcat, &pipe->fp);
+	double& stall = pipe->stat.stall[0];
+	deque<pipe_raw*> inflight;	// 按提交顺序排列的在途数据块
+	deque<pipe_raw*>::iterator it;
+	pipe_raw* blk;
+	void* user;
+	int type(PIPE_DATA), res, len;
+	bool async(true);	// false: io_uring失败后改为同步读取
+	bool drained;
+
+	while (type == PIPE_DATA || !inflight.empty()) {
+		// 有空闲数据块时提交新请求. 无在途请求时才阻塞等待空闲块
+		while (type == PIPE_DATA) {
+			if (inflight.empty()) blk = pop_wait(pipe->raw_free, stall);
+			else if (!pipe->raw_free.TryPop(blk)) break;
+			type = blk->type = cursor.Next(blk);
+			blk->done = type != PIPE_DATA || blk->nrec == 0;
+			if (!blk->done) {
+				blk->iov.iov_base = blk->buff;
+				blk->iov.iov_len  = blk->nrec * UCAC4_UNIT;
+				if (!async || !ring.Read(blk->fd, &blk->iov, blk->offset, blk)) {// 队列已满或异常: 同步读取
+					blk->error = pread_block(blk);
+					blk->done  = true;
+				}
+			}
+			inflight.push_back(blk);
+		}
+
+		// 按顺序交付已完成的数据块
+		while (!inflight.empty() && inflight.front()->done) {
+			blk = inflight.front();
+			inflight.pop_front();
+			if (blk->type == PIPE_DATA && !finish_block(pipe, blk)) {// 读取失败: 其余在途数据块不再交付
+				push_wait(pipe->raw_full, blk, stall);
+				ring.Drain();
+				for (it = inflight.begin(); it != inflight.end(); ++it) {
+					if ((*it)->type == PIPE_DATA && (*it)->last) close((*it)->fd);
+				}
+				cursor.Close();
+				return;
+			}
+			push_wait(pipe->raw_full, blk, stall);
+		}
+		if (inflight.empty()) continue;
+
+		// 等待一个请求完成. 读取不完整时继续读取剩余部分
+		if (!ring.Wait(user, res)) {// 须在已提交的请求全部完成后才能复用其缓冲区
+			async   = false;
+			drained = ring.Drain();
+			for (it = inflight.begin(); it != inflight.end(); ++it) {
+				blk = *it;
+				if (blk->done) continue;
+				blk->nread = 0;
+				blk->error = drained ? pread_block(blk) : EIO;
+				blk->done  = true;
+			}
+			continue;
+		}
+		blk = (pipe_raw*) user;
+		len = blk->nrec * UCAC4_UNIT;
+		if (res > 0) blk->nread += res;
+		else if (res != -EINTR && res != -EAGAIN) blk->error = res < 0 ? -res : EIO;
+		if (blk->error || blk->nread >= len) blk->done = true;
+		else {
+			blk->iov.iov_base = blk->buff + blk->nread;
+			blk->iov.iov_len  = len - blk->nread;
+			if (!ring.Read(blk->fd, &blk->iov, blk->offset + blk->nread, blk)) {
+				blk->error = pread_block(blk);
+				blk->done  = true;
+			}
+		}
+	}
+}
+
+static void read_stage(ucac4_pipe* pipe) {
+	uring_reader ring;
+	double t0 = pipe_clock();
+
+	if ((pipe->stat.uring = ring.Init(UCAC4_PIPE_DEPTH))) read_stage_uring(pipe, ring);
+	else read_stage_pread(pipe);
+	pipe->stat.busy[0] = pipe_clock() - t0 - pipe->stat.stall[0];
+}
+
+/*!
+ * @brief 解析级
+ */
+static void decode_stage(ucac4_pipe* pipe) {
+	double& stall = pipe->stat.stall[1];
+	double t0 = pipe_clock();
+	pipe_raw* raw;
+	pipe_decoded* out;
+	int type;
+
+	do {
+		raw = pop_wait(pipe->raw_full, stall);
+		out = pop_wait(pipe->dec_free, stall);
+		type = out->type = raw->type;
+		out->zone = raw->zone;
+		out->last = raw->last;
+		out->data.clear();
+		if (type == PIPE_DATA && raw->nrec)
+			ucac4_decode_zone(pipe->dec, pipe->bands, raw->buff, raw->nrec, out->data);
+		push_wait(pipe->raw_free, raw, stall);
+		push_wait(pipe->dec_full, out, stall);
+	} while (type == PIPE_DATA);
+	pipe->stat.busy[1] = pipe_clock() - t0 - stall;
+}
+
+int ucac4_scan_pipeline(const char* pathcat, const index_param& param,
+		ucac4_zone_handler handler, void* extra, ucac4_pipe_stat* stat) {
+	ucac4_pipe pipe;
+	pipe_raw raw[UCAC4_PIPE_DEPTH];
+	pipe_decoded* dec = new pipe_decoded[UCAC4_PIPE_DEPTH];
+	char* buff = new char[UCAC4_PIPE_DEPTH * UCAC4_PIPE_BLOCK * UCAC4_UNIT];
+	double& stall = pipe.stat.stall[2];
+	double t0 = pipe_clock();
+	pipe_decoded* blk;
+	int i, b, type, last;
+
+	pipe.pathcat = pathcat;
+	pipe.bands   = ucac4_extract_bands(param);
+	ucac4_footprint_init(pipe.fp, param);
+	for (b = 0; b < UCAC4_NBAND; ++b) ucac4_decoder_init(pipe.dec[b], param, b);
+	// 预分配数据块
+	for (i = 0; i < UCAC4_PIPE_DEPTH; ++i) {
+		raw[i].buff = buff + i * UCAC4_PIPE_BLOCK * UCAC4_UNIT;
+		pipe.raw_free.TryPush(raw + i);
+		for (b = 0; b < UCAC4_NBAND; ++b) {
+			if (pipe.bands & (1 << b)) dec[i].data.band[b].reserve(UCAC4_PIPE_BLOCK);
+		}
+		pipe.dec_free.TryPush(dec + i);
+	}
+
+	thread reader(read_stage, &pipe);
+	thread decoder(decode_stage, &pipe);
+
+	// 写入级
+	last = pipe.fp.zone0 - 1;
+	do {
+		blk = pop_wait(pipe.dec_full, stall);
+		if ((type = blk->type) == PIPE_DATA) {
+			handler(blk->zone, blk->data, extra);
+			if (blk->last) last = blk->zone;
+		}
+		push_wait(pipe.dec_free, blk, stall);
+	} while (type == PIPE_DATA);
+	pipe.stat.busy[2] = pipe_clock() - t0 - stall;
+
+	reader.join();
+	decoder.join();
+	if (stat) *stat = pipe.stat;
+	delete []buff;
+	delete []dec;
+
+	return last;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file ucac4pipe.h 读取/解析/写入三级流水线方式遍历UCAC4天区
+ * @note
+ * - 读取级: 独立线程按天区顺序读取原始记录块. 系统支持io_uring时异步读取, 多个块同时在途;
+ *   否则以pread同步读取
+ * - 解析级: 独立线程将原始记录块解析为各波段的列
+ * - 写入级: 调用线程将解析结果交给handler
+ * - 各级之间以无锁环形队列传递预分配的数据块, 数据块用后经回收队列交还上一级复用
+ */
+
+#ifndef SRC_UCAC4PIPE_H_
+#define SRC_UCAC4PIPE_H_
+
+#include "ucac4api.h"
+
+#define UCAC4_PIPE_NSTAGE	3		//< 流水线级数
+#define UCAC4_PIPE_BLOCK	16384	//< 每个原始数据块的记录数
+#define UCAC4_PIPE_DEPTH	8		//< 相邻两级之间预分配的数据块数量
+
+extern const char* ucac4_pipe_stage[UCAC4_PIPE_NSTAGE];	//< 流水线各级名称
+
+/*!
+ * @struct ucac4_pipe_stat 流水线运行统计
+ * 各级时间之和等于该级线程的运行时间. 阻塞于空输入队列或满输出队列的时间计入stall
+ */
+typedef struct {
+	double busy[UCAC4_PIPE_NSTAGE];		//< 各级工作时间, 量纲: 秒
+	double stall[UCAC4_PIPE_NSTAGE];	//< 各级等待相邻级的时间, 量纲: 秒
+	int64_t nrec;	//< 读取的原始记录数
+	int64_t bytes;	//< 读取的字节数
+	bool uring;		//< 读取级是否使用io_uring
+} ucac4_pipe_stat;
+
+/*!
+ * @brief 以流水线方式遍历天区, 按天区编号顺序将解析结果交给handler
+ * @param stat 非空时输出运行统计
+ * @return
+ * 最后一个完整处理的天区编号. 遇到无法打开的天区文件时终止
+ * @note
+ * - 同一天区可能分多次交付handler, 每次对应一个原始数据块, 顺序与文件中记录顺序一致
+ * - 不使用param.nthread; 范围与ucac4_scan_zones()一致
+ */
+int ucac4_scan_pipeline(const char* pathcat, const index_param& param,
+		ucac4_zone_handler handler, void* extra, ucac4_pipe_stat* stat = NULL);
+
+#endif /* SRC_UCAC4PIPE_H_ */
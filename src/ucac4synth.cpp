@@ -0,0 +1,170 @@
+/**
+ * @file ucac4synth.cpp 生成与UCAC4格式逐字节一致的模拟天区文件
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "ucac4synth.h"
+#include "ucac4api.h"
+
+using namespace std;
+
+#define GAL_RA		192.85948	//< 北银极赤经, 量纲: 度
+#define GAL_DEC		27.12825	//< 北银极赤纬, 量纲: 度
+#define GAL_SCALE	12.0		//< 面密度随银纬衰减的特征尺度, 量纲: 度
+#define GAL_FLOOR	0.1			//< 银极处相对面密度
+#define MAG_SLOPE	0.3			//< 星等计数斜率
+#define MAG_FAINT	16.5		//< 暗端星等
+
+/*!
+ * @brief 以赤道坐标计算相对面密度, 取值(GAL_FLOOR, 1]
+ */
+static double density(double ra, double dec) {
+	double sinb = sin(dec) * sin(GAL_DEC * M_PI / 180.)
+			+ cos(dec) * cos(GAL_DEC * M_PI / 180.) * cos(ra - GAL_RA * M_PI / 180.);
+	double b = fabs(asin(sinb)) * 180. / M_PI;
+	return GAL_FLOOR + (1. - GAL_FLOOR) * exp(-b / GAL_SCALE);
+}
+
+/*!
+ * @brief 全天平均相对面密度, 用于由目标记录数计算候选数量
+ */
+static double mean_density() {
+	static double mean = -1.;
+	if (mean < 0.) {
+		const int n = 400;
+		double sum(0.), wsum(0.), dec, w;
+		for (int i = 0; i < n; ++i) {
+			dec = ((i + 0.5) / n - 0.5) * M_PI;
+			w = cos(dec);
+			for (int j = 0; j < n * 2; ++j) sum += w * density((j + 0.5) / n * M_PI, dec);
+			wsum += w * n * 2;
+		}
+		mean = sum / wsum;
+	}
+	return mean;
+}
+
+static inline void put16(char* rec, int off, int val) {
+	short v = short(val < -32768 ? -32768 : (val > 32767 ? 32767 : val));
+	memcpy(rec + off, &v, sizeof(v));
+}
+
+static inline void put32(char* rec, int off, int val) {
+	memcpy(rec + off, &val, sizeof(val));
+}
+
+static inline char clamp8(double val, int lo, int hi) {
+	int v = int(floor(val + 0.5));
+	return char(v < lo ? lo : (v > hi ? hi : v));
+}
+
+bool ucac4_synth_zone(const char* pathcat, int zone, double scale, uint64_t seed, int& nrec) {
+	mt19937_64 rng(seed ^ (uint64_t(zone) * 0x9E3779B97F4A7C15ULL));
+	uniform_real_distribution<double> uni(0., 1.);
+	normal_distribution<double> gauss(0., 1.);
+	double declo = ((zone - 1) * UCAC4_ZONE_SPD / double(MILLISEC) - 90.) * M_PI / 180.;
+	double dechi = (zone * UCAC4_ZONE_SPD / double(MILLISEC) - 90.) * M_PI / 180.;
+	double area = (sin(dechi) - sin(declo)) * 0.5;	// 天区面积占全天的比例
+	double ncand = UCAC4_TOTAL * scale * area / mean_density();
+	int64_t i, n = int64_t(ncand) + (uni(rng) < ncand - floor(ncand) ? 1 : 0);
+	vector<uint32_t> ra, spd;
+	vector<size_t> order;
+	char filepath[PATH_MAX];
+	char rec[UCAC4_UNIT];
+	FILE* fp;
+
+	// 按面密度接受-拒绝抽样位置
+	for (i = 0; i < n; ++i) {
+		double a = uni(rng) * 2. * M_PI;
+		double d = asin(sin(declo) + uni(rng) * (sin(dechi) - sin(declo)));
+		if (uni(rng) > density(a, d)) continue;
+		uint32_t r = uint32_t(a * 180. / M_PI * MILLISEC);
+		uint32_t s = uint32_t((d * 180. / M_PI + 90.) * MILLISEC);
+		if (r >= MILLISEC360) r = MILLISEC360 - 1;
+		if (s < uint32_t((zone - 1) * UCAC4_ZONE_SPD)) s = (zone - 1) * UCAC4_ZONE_SPD;
+		if (s >= uint32_t(zone * UCAC4_ZONE_SPD)) s = zone * UCAC4_ZONE_SPD - 1;
+		ra.push_back(r);
+		spd.push_back(s);
+	}
+	nrec = int(ra.size());
+	order.resize(nrec);
+	for (i = 0; i < nrec; ++i) order[i] = i;
+	sort(order.begin(), order.end(), [&ra](size_t x, size_t y) { return ra[x] < ra[y]; });
+
+	snprintf(filepath, sizeof(filepath), "%s/u4b/z%03d", pathcat, zone);
+	if ((fp = fopen(filepath, "wb")) == NULL) return false;
+	const double c0 = pow(10., MAG_SLOPE * 8.), c1 = pow(10., MAG_SLOPE * MAG_FAINT);
+	for (i = 0; i < nrec; ++i) {
+		double mag, color, v, j;
+		int k;
+
+		// 星等: 0.5%为亮于8等的亮星, 其余按计数斜率抽样
+		if (uni(rng) < 0.005) mag = 1. + uni(rng) * 7.;
+		else mag = log10(c0 + uni(rng) * (c1 - c0)) / MAG_SLOPE;
+		color = 0.3 + 0.9 * uni(rng);	// B-V
+		v = mag + 0.05 + 0.1 * gauss(rng);
+		j = v - 1.2 * color - 0.3 + 0.1 * gauss(rng);
+
+		memset(rec, 0, sizeof(rec));
+		put32(rec, 0, int(ra[order[i]]));
+		put32(rec, 4, int(spd[order[i]]));
+		put16(rec, 8,  int(mag * 1000.));
+		put16(rec, 10, int(mag * 1000. + 30. * gauss(rng)));
+		rec[12] = clamp8(2. + mag - 8. + 3. * uni(rng), 1, 99);	// sigmag
+		rec[13] = uni(rng) < 0.97 ? 0 : char(1 + int(uni(rng) * 3));	// objt
+		rec[14] = uni(rng) < 0.98 ? 0 : char(1 + int(uni(rng) * 5));	// cdf
+		rec[15] = clamp8(10. + 40. * uni(rng), 1, 127);	// sigra
+		rec[16] = clamp8(10. + 40. * uni(rng), 1, 127);	// sigdc
+		rec[17] = clamp8(1. + 30. * uni(rng), 1, 127);	// na1
+		rec[18] = clamp8(rec[17] * uni(rng), 1, 127);	// nu1
+		rec[19] = clamp8(1. + 9. * uni(rng), 1, 127);	// cu1
+		put16(rec, 20, int(10000. + 300. * gauss(rng)));	// cepra
+		put16(rec, 22, int(10000. + 300. * gauss(rng)));	// cepdc
+		put16(rec, 24, int(60. * gauss(rng)));	// pmrac
+		put16(rec, 26, int(60. * gauss(rng)));	// pmdc
+		rec[28] = clamp8(10. + 90. * uni(rng), 1, 127);	// sigpmr
+		rec[29] = clamp8(10. + 90. * uni(rng), 1, 127);	// sigpmd
+		if (uni(rng) < 0.95) {// 2MASS
+			put32(rec, 30, int(uni(rng) * 2147483647.));
+			put16(rec, 34, int(j * 1000.));
+			put16(rec, 36, int((j - 0.3 * color) * 1000.));
+			put16(rec, 38, int((j - 0.3 * color - 0.1) * 1000.));
+			for (k = 0; k < 3; ++k) {
+				rec[40 + k] = char(int(uni(rng) * 6) * 10 + 5);
+				rec[43 + k] = clamp8(2. + 18. * uni(rng), 1, 127);
+			}
+		}
+		if (v < 16.8 && uni(rng) < 0.85) {// APASS
+			put16(rec, 46, int((v + color) * 1000.));
+			put16(rec, 48, int(v * 1000.));
+			put16(rec, 50, int((v - 0.3 + 0.3 * color) * 1000.));
+			put16(rec, 52, int((v - 0.2 * color) * 1000.));
+			put16(rec, 54, int((v - 0.4 * color) * 1000.));
+			for (k = 0; k < 5; ++k) rec[56 + k] = clamp8(2. + 30. * uni(rng), 1, 127);
+		}
+		else {
+			for (k = 0; k < 5; ++k) {
+				put16(rec, 46 + k * 2, 20000);
+				rec[56 + k] = 99;
+			}
+		}
+		rec[61] = char(int(uni(rng) * 4) * 10 + int(uni(rng) * 4));	// gcflg
+		put32(rec, 62, int(uni(rng) * 999999999.));	// icf
+		rec[66] = uni(rng) < 0.001 ? 1 : 0;	// leda
+		rec[67] = uni(rng) < 0.01 ? 1 : 0;	// x2m
+		put32(rec, 68, zone * 1000000 + int(i) + 1);	// rnm
+		put16(rec, 72, zone * 288 / UCAC4_NZONE + 1);	// zn2
+		put32(rec, 74, int(i) + 1);	// rn2
+		if (fwrite(rec, UCAC4_UNIT, 1, fp) != 1) {
+			fclose(fp);
+			return false;
+		}
+	}
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file ucac4synth.h 生成与UCAC4格式逐字节一致的模拟天区文件, 用于测试与性能评估
+ * @note
+ * - 全天记录数按UCAC4总数(113780093)乘以比例因子, 面密度随银纬变化, 银道面附近约为银极的10倍
+ * - 星等分布按计数随星等指数增长(log N ~ 0.3m)至16.5等, 兼有少量亮星
+ * - 各字段取值范围与UCAC4一致; APASS/2MASS星等按一定比例缺失
+ * - 天区内记录按赤经升序排列. 各天区的随机数种子由seed与天区编号决定, 单独生成部分天区时结果不变
+ */
+
+#ifndef SRC_UCAC4SYNTH_H_
+#define SRC_UCAC4SYNTH_H_
+
+#include <stdint.h>
+
+#define UCAC4_TOTAL		113780093	//< UCAC4全天记录数
+
+/*!
+ * @brief 生成单个模拟天区文件<pathcat>/u4b/z<zone>
+ * @param scale 记录数相对UCAC4的比例
+ * @param nrec  输出: 天区记录数
+ * @return
+ * 文件写入成功返回true
+ */
+bool ucac4_synth_zone(const char* pathcat, int zone, double scale, uint64_t seed, int& nrec);
+
+#endif /* SRC_UCAC4SYNTH_H_ */
@@ -0,0 +1,915 @@
+/**
+ * @file uniformize.cpp 星表均匀化(cut-an)的并行实现
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "uniformize.h"
+#include "healpix.h"
+
+using namespace std;
+
+#define UNIFORM_BLOCK	65536	//< 每次读取并计算网格单元的行数
+#define UNIFORM_SPILL_BUF	4096	//< 外排序时每路读写缓冲区的最少记录数
+#define DEDUP_CELL_MIN	1.9073486328125E-6	//< 去重网格边长下限2^-19, 使各轴网格坐标可用21位表示
+#define DEDUP_GRID_BIAS	((1 << 19) + 1)		//< 网格坐标偏置, 使相邻网格的坐标非负
+#define DEDUP_SLAB_BYTES	64	//< 去重时片内每颗恒星的工作区字节数
+#define UNIFORM_ENTRY_BYTES	24	//< 内存方式下每颗恒星的工作区字节数: 划分, 选取及输出顺序
+
+/*!
+ * @struct uniform_entry 划分到分区后的恒星
+ */
+typedef struct {
+	uint32_t row;	//< 在中间星表中的行号
+	uint16_t off;	//< 所在网格单元相对分区首单元的偏移
+	short mag;		//< 星等. 量纲: 毫星等
+} uniform_entry;
+
+/*!
+ * @brief 亮度顺序: 星等升序, 星等相同时按行号. 全序保证结果与线程数及分区方式无关
+ */
+static inline bool brighter(const uniform_entry& a, const uniform_entry& b) {
+	return a.mag < b.mag || (a.mag == b.mag && a.row < b.row);
+}
+
+/*!
+ * @struct uniform_record 外排序记录, 按(网格单元, 星等, 行号)排序
+ */
+typedef struct {
+	int64_t cell;	//< 网格单元
+	uint32_t row;	//< 在中间星表中的行号
+	short mag;		//< 星等. 量纲: 毫星等
+} uniform_record;
+
+static inline bool record_less(const uniform_record& a, const uniform_record& b) {
+	return a.cell < b.cell || (a.cell == b.cell && (a.mag < b.mag || (a.mag == b.mag && a.row < b.row)));
+}
+
+/*!
+ * @struct uniform_spill 临时文件中的有序顺串. 文件创建后即删除目录项, 关闭描述符时释放
+ */
+typedef struct {
+	int fd;
+	int64_t nrec;	//< 记录数
+} uniform_spill;
+
+/*!
+ * @struct uniform_merge 归并任务: 合并相邻有序区间[lo, mid)与[mid, hi)
+ */
+typedef struct {
+	int64_t lo, mid, hi;
+} uniform_merge;
+
+/*!
+ * @struct uniform_pool 并行均匀化的共享状态
+ * - 分区p包含网格单元[p * span, (p + 1) * span)
+ * - 划分阶段各线程处理固定的行区间, 先计数后写入, 写入位置由计数的前缀和确定, 无需加锁
+ * - 选取阶段各线程以原子计数领取分区
+ */
+struct uniform_pool {
+	const index_param* param;
+	const CatReader* reader;
+	int nthread;
+	int nside;		//< 网格, UNside
+	int sweeps;		//< 每个单元保留的恒星数
+	const healpix_region* region;	//< 大像元及其边缘. NULL: 全天
+	int64_t span;	//< 每个分区的单元数
+	int npart;		//< 分区数
+	vector<int64_t> slot;			//< 线程t在分区p中的恒星数, 前缀和后为写入位置. 下标: t * npart + p
+	vector<int64_t> start;			//< 各分区在entry中的起始位置, npart + 1个元素
+	vector<uniform_entry> entry;	//< 按分区排列的恒星
+	vector<vector<uniform_entry> > sel;	//< 各分区的入选恒星, 按遍次及亮度排列
+	vector<int64_t> nsel;			//< 分区p第s遍的入选数. 下标: p * sweeps + s
+	vector<int64_t> dst;			//< 分区p第s遍在输出中的起始位置. 下标同nsel
+	vector<int64_t> sweep_start;	//< 各遍在输出中的起始位置, sweeps + 1个元素
+	vector<uniform_entry> order;	//< 输出顺序
+	vector<uniform_merge> merge;	//< 本轮归并任务
+	CatBatch* stars;				//< 输出: 入选恒星
+	uint8_t* sweep;					//< 输出: 遍次
+	atomic<int> next;				//< 下一个待领取的任务
+
+	// 外排序: 各线程将记录排序后写入临时文件, 再多路归并
+	long long budget;		//< 内存上限, 量纲: 字节. 0: 不限制
+	int64_t runlen;			//< 每个顺串的记录数
+	char tmpdir[PATH_MAX];	//< 临时文件目录
+	vector<uniform_spill> spill;	//< 有序顺串
+	vector<vector<uniform_entry> > bysweep;	//< 各遍的入选恒星
+	bool failed;			//< 临时文件读写失败
+	mutex mtx;
+
+	// 去重: 单位球面xyz空间的均匀网格, 沿x方向按网格列分片
+	double cell;		//< 网格边长, 不小于去重半径对应的弦长
+	double chord2;		//< 去重半径对应弦长的平方
+	int64_t ixmin;		//< 最小网格列号
+	int64_t width;		//< 每片包含的网格列数
+	int nslab;			//< 分片数
+	int slab0, slab1;	//< 本轮处理的片[slab0, slab1)
+	vector<int64_t> dslot;		//< 线程t在片s中的行数, 前缀和后为写入位置. 下标: t * nslab + s
+	vector<int64_t> dstart;		//< 本轮各片在drow中的起始位置, slab1 - slab0 + 1个元素
+	vector<uint32_t> drow;		//< 按片排列的行号. 片边界列上的恒星同时计入相邻片
+	vector<uint8_t> dup;		//< 各行是否重复, 按位存储. 空: 不去重
+	atomic<long long> ndup;		//< 重复恒星数量
+	int npass;			//< 扫描星表的轮数
+};
+
+typedef void (*uniform_stage)(uniform_pool*, int);
+
+static void run_stage(uniform_pool* pool, uniform_stage stage) {
+	vector<thread> workers;
+	int t;
+
+	pool->next = 0;
+	if (pool->nthread <= 1) stage(pool, 0);
+	else {
+		for (t = 0; t < pool->nthread; ++t) workers.push_back(thread(stage, pool, t));
+		for (t = 0; t < pool->nthread; ++t) workers[t].join();
+	}
+}
+
+/*!
+ * @brief 由赤经与南天极距离计算单位矢量
+ */
+static inline void mas2xyz(uint32_t ra, uint32_t spd, double* xyz) {
+	const double mas2rad = M_PI / 648000000.;
+	double alpha = ra * mas2rad, delta = spd * mas2rad - M_PI_2;
+	double cd = cos(delta);
+
+	xyz[0] = cd * cos(alpha);
+	xyz[1] = cd * sin(alpha);
+	xyz[2] = sin(delta);
+}
+
+static inline int64_t grid_coord(double v, double cell) {
+	return int64_t(floor(v / cell));
+}
+
+/*!
+ * @brief 去重划分. 第1遍(count == true)统计各片的行数, 第2遍将本轮各片的行号写入drow
+ * @note
+ * 网格列位于片边界时, 行号同时写入相邻片, 作为该片的只读参照
+ */
+static void dedup_rows(uniform_pool* pool, int t, bool count) {
+	CatBatch batch;
+	long long rows = pool->reader->Rows();
+	long long first = rows * t / pool->nthread, last = rows * (t + 1) / pool->nthread;
+	int64_t* slot = &pool->dslot[int64_t(t) * pool->nslab];
+	int64_t ix, lo, sl[3];
+	double xyz[3];
+	int n, i, m, k;
+
+	for (; first < last; first += n) {
+		n = last - first < UNIFORM_BLOCK ? int(last - first) : UNIFORM_BLOCK;
+		batch.clear();
+		pool->reader->Read(first, n, batch);
+		for (i = 0; i < n; ++i) {
+			mas2xyz(batch.ra[i], batch.spd[i], xyz);
+			ix = grid_coord(xyz[0], pool->cell) - pool->ixmin;
+			sl[0] = ix / pool->width;
+			lo = sl[0] * pool->width;
+			m = 1;
+			if (ix == lo && sl[0] > 0) sl[m++] = sl[0] - 1;
+			if (ix == lo + pool->width - 1 && sl[0] < pool->nslab - 1) sl[m++] = sl[0] + 1;
+			for (k = 0; k < m; ++k) {
+				if (count) ++slot[sl[k]];
+				else if (sl[k] >= pool->slab0 && sl[k] < pool->slab1) pool->drow[slot[sl[k]]++] = uint32_t(first + i);
+			}
+		}
+	}
+}
+
+static void dedup_count_stage(uniform_pool* pool, int t) {
+	dedup_rows(pool, t, true);
+}
+
+static void dedup_scatter_stage(uniform_pool* pool, int t) {
+	dedup_rows(pool, t, false);
+}
+
+/*!
+ * @brief 去重阶段. 每片以网格坐标建立散列表, 片内每颗恒星只检查相邻的27个网格
+ * @note
+ * 半径内存在更亮的恒星时标记为重复. 判定只依赖于恒星集合, 与处理顺序无关
+ */
+static void dedup_stage(uniform_pool* pool, int t) {
+	const CatReader* reader = pool->reader;
+	vector<double> xyz;
+	vector<int32_t> grid;	// 网格坐标, 加DEDUP_GRID_BIAS
+	vector<uniform_entry> star;
+	vector<uint64_t> key;
+	vector<int> head, next;
+	int64_t ixlo, ixhi;
+	uint64_t k2;
+	int s, n, i, j, bits, dx, dy, dz;
+	long long ndup;
+	bool found;
+
+	while ((s = pool->slab0 + pool->next++) < pool->slab1) {
+		const uint32_t* drow = &pool->drow[pool->dstart[s - pool->slab0]];
+
+		n = int(pool->dstart[s - pool->slab0 + 1] - pool->dstart[s - pool->slab0]);
+		xyz.resize(3 * n);
+		grid.resize(3 * n);
+		star.resize(n);
+		key.resize(n);
+		next.resize(n);
+		for (bits = 1; (1 << bits) < 2 * n; ++bits);
+		head.assign(1 << bits, -1);
+
+		for (i = 0; i < n; ++i) {
+			uint32_t row = drow[i];
+			star[i].row = row;
+			star[i].mag = reader->mag[row];
+			mas2xyz(reader->ra[row], reader->spd[row], &xyz[3 * i]);
+			for (j = 0; j < 3; ++j)
+				grid[3 * i + j] = int32_t(grid_coord(xyz[3 * i + j], pool->cell) + DEDUP_GRID_BIAS);
+			key[i] = (uint64_t(grid[3 * i]) << 42) | (uint64_t(grid[3 * i + 1]) << 21) | uint64_t(grid[3 * i + 2]);
+			uint64_t h = (key[i] * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+			next[i] = head[h];
+			head[h] = i;
+		}
+
+		// 仅判定本片网格列上的恒星, 相邻片的边界列只作参照
+		ixlo = int64_t(s) * pool->width + pool->ixmin + DEDUP_GRID_BIAS;
+		ixhi = ixlo + pool->width;
+		for (i = 0, ndup = 0; i < n; ++i) {
+			if (grid[3 * i] < ixlo || grid[3 * i] >= ixhi) continue;
+			for (dx = -1, found = false; dx <= 1 && !found; ++dx) {
+				for (dy = -1; dy <= 1 && !found; ++dy) {
+					for (dz = -1; dz <= 1 && !found; ++dz) {
+						k2 = (uint64_t(grid[3 * i] + dx) << 42) | (uint64_t(grid[3 * i + 1] + dy) << 21)
+								| uint64_t(grid[3 * i + 2] + dz);
+						for (j = head[(k2 * 0x9E3779B97F4A7C15ULL) >> (64 - bits)]; j >= 0 && !found; j = next[j]) {
+							if (key[j] != k2 || !brighter(star[j], star[i])) continue;
+							double d0 = xyz[3 * i] - xyz[3 * j];
+							double d1 = xyz[3 * i + 1] - xyz[3 * j + 1];
+							double d2 = xyz[3 * i + 2] - xyz[3 * j + 2];
+							found = d0 * d0 + d1 * d1 + d2 * d2 <= pool->chord2;
+						}
+					}
+				}
+			}
+			if (found) {
+				__sync_fetch_and_or(&pool->dup[star[i].row >> 3], uint8_t(1 << (star[i].row & 7)));
+				++ndup;
+			}
+		}
+		pool->ndup += ndup;
+	}
+}
+
+/*!
+ * @brief 标记半径param->dedup内存在更亮恒星的行
+ * @param budget 内存上限, 量纲: 字节. 0: 不限制
+ * @note
+ * 有内存上限时增加分片数, 使并行处理的各片工作区之和不超过上限的一半; 相邻的片合为一轮,
+ * 每轮重新扫描星表, 仅收集本轮各片的行号
+ */
+static void dedup_catalog(uniform_pool* pool, long long budget) {
+	double radius = pool->param->dedup / 206264.80624709636;	// 角秒转换为弧度
+	long long rows = pool->reader->Rows();
+	int64_t ncol, nslab, total, k, limit;
+	int s, t;
+
+	pool->chord2 = 4. * sin(radius * 0.5) * sin(radius * 0.5);
+	pool->cell   = sqrt(pool->chord2);
+	if (pool->cell < DEDUP_CELL_MIN) pool->cell = DEDUP_CELL_MIN;
+	pool->ixmin  = grid_coord(-1., pool->cell);
+	ncol         = grid_coord(1., pool->cell) - pool->ixmin + 1;
+	nslab        = int64_t(pool->nthread) * 16;
+	if (budget > 0) {
+		k = rows * DEDUP_SLAB_BYTES * pool->nthread / (budget / 2) + 1;
+		if (nslab < k) nslab = k;
+	}
+	pool->nslab  = int(ncol < nslab ? ncol : nslab);
+	pool->width  = (ncol + pool->nslab - 1) / pool->nslab;
+	pool->nslab  = int((ncol + pool->width - 1) / pool->width);
+	pool->ndup   = 0;
+	pool->dup.assign((rows + 7) / 8, 0);
+
+	pool->slab0 = pool->slab1 = 0;
+	pool->dslot.assign(int64_t(pool->nthread) * pool->nslab, 0);
+	run_stage(pool, dedup_count_stage);
+	limit = budget > 0 ? budget / 2 / sizeof(uint32_t) : INT64_MAX;
+	for (pool->slab0 = 0; pool->slab0 < pool->nslab; pool->slab0 = pool->slab1) {
+		pool->dstart.assign(1, 0);
+		for (s = pool->slab0, total = 0; s < pool->nslab; ++s) {
+			for (t = 0, k = 0; t < pool->nthread; ++t) k += pool->dslot[int64_t(t) * pool->nslab + s];
+			if (s > pool->slab0 && total + k > limit) break;
+			for (t = 0; t < pool->nthread; ++t) {
+				k = pool->dslot[int64_t(t) * pool->nslab + s];
+				pool->dslot[int64_t(t) * pool->nslab + s] = total;
+				total += k;
+			}
+			pool->dstart.push_back(total);
+		}
+		pool->slab1 = s;
+		pool->drow.resize(total);
+		run_stage(pool, dedup_scatter_stage);
+		run_stage(pool, dedup_stage);
+		++pool->npass;
+	}
+	vector<uint32_t>().swap(pool->drow);
+}
+
+/*!
+ * @brief 计算[first, first + n)行所在的网格单元. 重复或不在大像元及其边缘内的恒星记为-1
+ */
+static void locate_block(uniform_pool* pool, long long first, int n,
+		CatBatch& batch, vector<int64_t>& cell, vector<uint8_t>& mask) {
+	batch.clear();
+	pool->reader->Read(first, n, batch);
+	cell.resize(n);
+	healpix_mas2pix_batch(pool->nside, HEALPIX_RING, &batch.ra[0], &batch.spd[0], n, &cell[0]);
+	if (pool->region) {
+		mask.resize(n);
+		pool->region->Select(&batch.ra[0], &batch.spd[0], n, &mask[0]);
+		for (int i = 0; i < n; ++i) {
+			if (!mask[i]) cell[i] = -1;
+		}
+	}
+	if (!pool->dup.empty()) {
+		for (int i = 0; i < n; ++i) {
+			if ((pool->dup[(first + i) >> 3] >> ((first + i) & 7)) & 1) cell[i] = -1;
+		}
+	}
+}
+
+/*!
+ * @brief 划分阶段. 第1遍(count == true)统计各分区的恒星数, 第2遍写入entry
+ * @note
+ * 两遍各自计算网格单元, 以计算量换取不保存逐星的单元编号
+ */
+static void partition_rows(uniform_pool* pool, int t, bool count) {
+	CatBatch batch;
+	vector<int64_t> cell;
+	vector<uint8_t> mask;
+	long long rows = pool->reader->Rows();
+	long long first = rows * t / pool->nthread, last = rows * (t + 1) / pool->nthread;
+	int64_t* slot = &pool->slot[int64_t(t) * pool->npart];
+	int64_t p;
+	int n, i;
+
+	for (; first < last; first += n) {
+		n = last - first < UNIFORM_BLOCK ? int(last - first) : UNIFORM_BLOCK;
+		locate_block(pool, first, n, batch, cell, mask);
+		for (i = 0; i < n; ++i) {
+			if (cell[i] < 0) continue;
+			p = cell[i] / pool->span;
+			if (count) ++slot[p];
+			else {
+				uniform_entry& e = pool->entry[slot[p]++];
+				e.row = uint32_t(first + i);
+				e.off = uint16_t(cell[i] - p * pool->span);
+				e.mag = batch.mag[i];
+			}
+		}
+	}
+}
+
+static void count_stage(uniform_pool* pool, int t) {
+	partition_rows(pool, t, true);
+}
+
+static void scatter_stage(uniform_pool* pool, int t) {
+	partition_rows(pool, t, false);
+}
+
+/*!
+ * @brief 选取阶段. 每个单元以sweeps个元素的堆保留最亮的恒星, 堆顶为其中最暗者
+ */
+static void select_stage(uniform_pool* pool, int t) {
+	int sweeps = pool->sweeps;
+	int64_t span = pool->span, off, k;
+	vector<uniform_entry> heap(span * sweeps);
+	vector<int> fill(span);
+	vector<int64_t> pos(sweeps);
+	int p, s;
+
+	while ((p = pool->next++) < pool->npart) {
+		int64_t* nsel = &pool->nsel[int64_t(p) * sweeps];
+		vector<uniform_entry>& sel = pool->sel[p];
+
+		for (k = pool->start[p]; k < pool->start[p + 1]; ++k) {
+			const uniform_entry& e = pool->entry[k];
+			uniform_entry* h = &heap[e.off * sweeps];
+			int& m = fill[e.off];
+
+			if (m < sweeps) {
+				h[m++] = e;
+				push_heap(h, h + m, brighter);
+			}
+			else if (brighter(e, h[0])) {
+				pop_heap(h, h + sweeps, brighter);
+				h[sweeps - 1] = e;
+				push_heap(h, h + sweeps, brighter);
+			}
+		}
+
+		// 单元内第s亮的恒星属于第s遍
+		for (off = 0; off < span; ++off) {
+			sort_heap(&heap[off * sweeps], &heap[off * sweeps] + fill[off], brighter);
+			for (s = 0; s < fill[off]; ++s) ++nsel[s];
+		}
+		for (s = 0, k = 0; s < sweeps; k += nsel[s++]) pos[s] = k;
+		sel.resize(k);
+		for (off = 0; off < span; ++off) {
+			for (s = 0; s < fill[off]; ++s) sel[pos[s]++] = heap[off * sweeps + s];
+			fill[off] = 0;
+		}
+		for (s = 0, k = 0; s < sweeps; k += nsel[s++]) sort(sel.begin() + k, sel.begin() + k + nsel[s], brighter);
+	}
+}
+
+/*!
+ * @brief 汇集阶段. 将各分区的入选恒星复制到所属遍次的输出区间
+ */
+static void gather_stage(uniform_pool* pool, int t) {
+	int sweeps = pool->sweeps;
+	int64_t k, n;
+	int p, s;
+
+	while ((p = pool->next++) < pool->npart) {
+		vector<uniform_entry>& sel = pool->sel[p];
+		for (s = 0, k = 0; s < sweeps; ++s, k += n) {
+			n = pool->nsel[int64_t(p) * sweeps + s];
+			copy(sel.begin() + k, sel.begin() + k + n, pool->order.begin() + pool->dst[int64_t(p) * sweeps + s]);
+		}
+		vector<uniform_entry>().swap(sel);
+	}
+}
+
+static void merge_stage(uniform_pool* pool, int t) {
+	int i, n = int(pool->merge.size());
+
+	while ((i = pool->next++) < n) {
+		const uniform_merge& task = pool->merge[i];
+		inplace_merge(pool->order.begin() + task.lo, pool->order.begin() + task.mid,
+				pool->order.begin() + task.hi, brighter);
+	}
+}
+
+static void sort_stage(uniform_pool* pool, int t) {
+	int i, n = int(pool->merge.size());
+
+	while ((i = pool->next++) < n) {
+		const uniform_merge& task = pool->merge[i];
+		sort(pool->order.begin() + task.lo, pool->order.begin() + task.hi, brighter);
+	}
+}
+
+/*!
+ * @brief 逐轮两两归并各遍的有序区间
+ * @param runs 各遍的区间边界, 相邻两个边界构成一个有序区间
+ */
+static void merge_sweeps(uniform_pool* pool, vector<vector<int64_t> >& runs) {
+	do {
+		pool->merge.clear();
+		for (int s = 0; s < pool->sweeps; ++s) {
+			vector<int64_t>& r = runs[s];
+			vector<int64_t> next;
+			size_t i;
+
+			for (i = 0; i + 2 < r.size(); i += 2) {
+				uniform_merge task = {r[i], r[i + 1], r[i + 2]};
+				pool->merge.push_back(task);
+				next.push_back(r[i]);
+			}
+			for (; i < r.size(); ++i) next.push_back(r[i]);
+			r.swap(next);
+		}
+		run_stage(pool, merge_stage);
+	} while (!pool->merge.empty());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/* 外排序 */
+/*!
+ * @brief 在tmpdir下创建匿名临时文件
+ * @return
+ * 文件描述符. 失败时返回-1
+ */
+static int open_spill(const char* tmpdir) {
+	char filepath[PATH_MAX + 32];
+	int fd;
+
+	snprintf(filepath, sizeof(filepath), "%s/astindex-uniform-XXXXXX", tmpdir);
+	if ((fd = mkstemp(filepath)) >= 0) unlink(filepath);
+	return fd;
+}
+
+static bool write_spill(int fd, const void* buff, size_t bytes) {
+	const char* ptr = (const char*) buff;
+	ssize_t rc;
+
+	for (; bytes; ptr += rc, bytes -= rc) {
+		if ((rc = write(fd, ptr, bytes)) <= 0) return false;
+	}
+	return true;
+}
+
+static bool read_spill(int fd, void* buff, size_t bytes, off_t offset) {
+	char* ptr = (char*) buff;
+	ssize_t rc;
+
+	for (; bytes; ptr += rc, bytes -= rc, offset += rc) {
+		if ((rc = pread(fd, ptr, bytes, offset)) <= 0) return false;
+	}
+	return true;
+}
+
+/*!
+ * @brief 排序并写出一个顺串
+ */
+static void spill_run(uniform_pool* pool, vector<uniform_record>& run) {
+	uniform_spill spill;
+
+	sort(run.begin(), run.end(), record_less);
+	spill.fd   = open_spill(pool->tmpdir);
+	spill.nrec = int64_t(run.size());
+	bool rslt = spill.fd >= 0 && write_spill(spill.fd, &run[0], run.size() * sizeof(uniform_record));
+	run.clear();
+
+	lock_guard<mutex> lck(pool->mtx);
+	if (rslt) pool->spill.push_back(spill);
+	else {
+		if (spill.fd >= 0) close(spill.fd);
+		pool->failed = true;
+	}
+}
+
+/*!
+ * @brief 生成顺串. 各线程处理固定的行区间, 每积累runlen条记录写出一个顺串
+ */
+static void spill_stage(uniform_pool* pool, int t) {
+	CatBatch batch;
+	vector<int64_t> cell;
+	vector<uint8_t> mask;
+	vector<uniform_record> run;
+	uniform_record rec;
+	long long rows = pool->reader->Rows();
+	long long first = rows * t / pool->nthread, last = rows * (t + 1) / pool->nthread;
+	int n, i;
+
+	run.reserve(pool->runlen);
+	for (; first < last && !pool->failed; first += n) {
+		n = last - first < UNIFORM_BLOCK ? int(last - first) : UNIFORM_BLOCK;
+		locate_block(pool, first, n, batch, cell, mask);
+		for (i = 0; i < n; ++i) {
+			if (cell[i] < 0) continue;
+			rec.cell = cell[i];
+			rec.row  = uint32_t(first + i);
+			rec.mag  = batch.mag[i];
+			run.push_back(rec);
+			if (int64_t(run.size()) == pool->runlen) spill_run(pool, run);
+		}
+	}
+	if (!run.empty()) spill_run(pool, run);
+}
+
+/*!
+ * @struct spill_cursor 顺串的缓冲读取位置
+ */
+struct spill_cursor {
+	const uniform_spill* spill;
+	vector<uniform_record> buff;
+	int64_t done;	//< 已读入缓冲区的记录数
+	size_t pos;		//< 缓冲区内的读取位置
+
+public:
+	bool Fill() {
+		size_t n = spill->nrec - done < int64_t(buff.capacity()) ? size_t(spill->nrec - done) : buff.capacity();
+		buff.resize(n);
+		pos = 0;
+		if (n && !read_spill(spill->fd, &buff[0], n * sizeof(uniform_record), done * sizeof(uniform_record)))
+			return false;
+		done += n;
+		return true;
+	}
+};
+
+/*!
+ * @struct spill_head 归并堆元素
+ */
+typedef struct {
+	uniform_record rec;
+	int src;	//< 所属顺串
+} spill_head;
+
+static inline bool head_after(const spill_head& a, const spill_head& b) {
+	return record_less(b.rec, a.rec);
+}
+
+/*!
+ * @brief 多路归并顺串[first, first + count)
+ * @param bufrec 每路读写缓冲区的记录数
+ * @param out    非空时写入新的顺串; 否则按网格单元流式选取, 结果存入pool->bysweep
+ * @return
+ * 操作结果
+ */
+static bool merge_spills(uniform_pool* pool, size_t first, size_t count, size_t bufrec, uniform_spill* out) {
+	vector<spill_cursor> cursor(count);
+	vector<spill_head> heap;
+	vector<uniform_record> wbuf;
+	spill_head head;
+	int64_t cell(-1);
+	int rank(0), sweeps(pool->sweeps);
+	size_t i;
+	bool rslt(true);
+
+	for (i = 0; i < count && rslt; ++i) {
+		cursor[i].spill = &pool->spill[first + i];
+		cursor[i].done  = 0;
+		cursor[i].buff.reserve(bufrec);
+		if ((rslt = cursor[i].Fill()) && cursor[i].buff.size()) {
+			head.rec = cursor[i].buff[cursor[i].pos++];
+			head.src = int(i);
+			heap.push_back(head);
+		}
+	}
+	make_heap(heap.begin(), heap.end(), head_after);
+	if (out) {
+		out->nrec = 0;
+		if ((out->fd = open_spill(pool->tmpdir)) < 0) rslt = false;
+		wbuf.reserve(bufrec);
+	}
+
+	while (rslt && !heap.empty()) {
+		pop_heap(heap.begin(), heap.end(), head_after);
+		head = heap.back();
+		heap.pop_back();
+
+		if (out) {
+			wbuf.push_back(head.rec);
+			if (wbuf.size() == bufrec) {
+				rslt = write_spill(out->fd, &wbuf[0], wbuf.size() * sizeof(uniform_record));
+				out->nrec += wbuf.size();
+				wbuf.clear();
+			}
+		}
+		else {// 单元内记录按亮度有序, 第rank亮的恒星属于第rank遍
+			if (head.rec.cell != cell) {
+				cell = head.rec.cell;
+				rank = 0;
+			}
+			if (rank < sweeps) {
+				uniform_entry e = {head.rec.row, 0, head.rec.mag};
+				pool->bysweep[rank].push_back(e);
+			}
+			++rank;
+		}
+
+		spill_cursor& c = cursor[head.src];
+		if (c.pos == c.buff.size() && !(rslt = c.Fill())) break;
+		if (c.pos < c.buff.size()) {
+			head.rec = c.buff[c.pos++];
+			heap.push_back(head);
+			push_heap(heap.begin(), heap.end(), head_after);
+		}
+	}
+	if (out && rslt && wbuf.size()) {
+		rslt = write_spill(out->fd, &wbuf[0], wbuf.size() * sizeof(uniform_record));
+		out->nrec += wbuf.size();
+	}
+	return rslt;
+}
+
+/*!
+ * @brief 外排序方式均匀化, 结果存入pool->order与pool->sweep_start
+ * @note
+ * - 内存上限的一半用于生成顺串: 每个线程每次排序runlen条记录
+ * - 归并时每路缓冲区不少于UNIFORM_SPILL_BUF条记录; 顺串多于允许的路数时先逐组归并为较长的顺串
+ * - 最后一轮归并按网格单元流式选取, 只保留入选恒星
+ */
+static bool uniformize_external(uniform_pool* pool) {
+	int64_t half = pool->budget / 2 / sizeof(uniform_record);
+	size_t fanin, bufrec, i;
+	int64_t k, n;
+	int s, t;
+
+	pool->runlen = half / pool->nthread;
+	if (pool->runlen < UNIFORM_SPILL_BUF) pool->runlen = UNIFORM_SPILL_BUF;
+	pool->failed = false;
+	run_stage(pool, spill_stage);
+
+	n = half / UNIFORM_SPILL_BUF - 1;
+	fanin = n > 2 ? size_t(n) : 2;
+	for (i = 0; !pool->failed && pool->spill.size() - i > fanin; i += fanin) {
+		uniform_spill out;
+		out.fd = -1;
+		if (merge_spills(pool, i, fanin, size_t(half / (fanin + 1)), &out)) pool->spill.push_back(out);
+		else {// 未写完的顺串不参与后续归并
+			if (out.fd >= 0) close(out.fd);
+			pool->failed = true;
+		}
+		for (size_t j = i; j < i + fanin; ++j) close(pool->spill[j].fd);
+		++pool->npass;
+	}
+	pool->bysweep.resize(pool->sweeps);
+	if (!pool->failed) {
+		n = int64_t(pool->spill.size() - i);
+		bufrec = size_t(half / (n > 0 ? n : 1));
+		if (!merge_spills(pool, i, size_t(n), bufrec, NULL)) pool->failed = true;
+	}
+	for (; i < pool->spill.size(); ++i) close(pool->spill[i].fd);
+	vector<uniform_spill>().swap(pool->spill);
+	if (pool->failed) {
+		printf ("uniformize: failed to read or write temporary files in [%s]\n", pool->tmpdir);
+		return false;
+	}
+
+	// 各遍分块并行排序后归并
+	vector<vector<int64_t> > runs(pool->sweeps);
+	pool->sweep_start.resize(pool->sweeps + 1);
+	pool->merge.clear();
+	for (s = 0, k = 0; s < pool->sweeps; ++s) {
+		pool->sweep_start[s] = k;
+		pool->order.insert(pool->order.end(), pool->bysweep[s].begin(), pool->bysweep[s].end());
+		n = int64_t(pool->bysweep[s].size());
+		vector<uniform_entry>().swap(pool->bysweep[s]);
+		for (t = 0; t < pool->nthread; ++t) {
+			uniform_merge task = {k + n * t / pool->nthread, 0, k + n * (t + 1) / pool->nthread};
+			if (task.hi == task.lo) continue;
+			pool->merge.push_back(task);
+			runs[s].push_back(task.lo);
+		}
+		runs[s].push_back(k += n);
+	}
+	pool->sweep_start[pool->sweeps] = k;
+	run_stage(pool, sort_stage);
+	merge_sweeps(pool, runs);
+	return true;
+}
+
+/*!
+ * @brief 输出阶段. 各线程处理固定的区间, 由行号取得位置与星等
+ */
+static void emit_stage(uniform_pool* pool, int t) {
+	const CatReader* reader = pool->reader;
+	int64_t total = int64_t(pool->order.size());
+	int64_t i = total * t / pool->nthread, last = total * (t + 1) / pool->nthread;
+	int s = 0;
+
+	for (; i < last; ++i) {
+		const uniform_entry& e = pool->order[i];
+		while (i >= pool->sweep_start[s + 1]) ++s;
+		pool->stars->ra[i]  = reader->ra[e.row];
+		pool->stars->spd[i] = reader->spd[e.row];
+		pool->stars->mag[i] = reader->mag[e.row];
+		pool->sweep[i] = uint8_t(s < 255 ? s + 1 : 255);
+	}
+}
+
+static double uniform_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief 内存方式均匀化, 结果存入pool->order与pool->sweep_start
+ */
+static void uniformize_memory(uniform_pool* pool) {
+	int64_t total, k;
+	double t0, t1, t2;
+	int p, s, t;
+
+	// 划分
+	t0 = uniform_clock();
+	pool->slot.assign(int64_t(pool->nthread) * pool->npart, 0);
+	run_stage(pool, count_stage);
+	pool->start.resize(pool->npart + 1);
+	for (p = 0, total = 0; p < pool->npart; ++p) {
+		pool->start[p] = total;
+		for (t = 0; t < pool->nthread; ++t) {
+			k = pool->slot[int64_t(t) * pool->npart + p];
+			pool->slot[int64_t(t) * pool->npart + p] = total;
+			total += k;
+		}
+	}
+	pool->start[pool->npart] = total;
+	pool->entry.resize(total);
+	run_stage(pool, scatter_stage);
+	t1 = uniform_clock();
+
+	// 选取
+	pool->sel.resize(pool->npart);
+	pool->nsel.assign(int64_t(pool->npart) * pool->sweeps, 0);
+	run_stage(pool, select_stage);
+	vector<uniform_entry>().swap(pool->entry);
+	t2 = uniform_clock();
+
+	// 汇集: 每遍由各分区的有序区间组成, 逐轮两两归并
+	pool->sweep_start.resize(pool->sweeps + 1);
+	pool->dst.resize(pool->nsel.size());
+	vector<vector<int64_t> > runs(pool->sweeps);
+	for (s = 0, k = 0; s < pool->sweeps; ++s) {
+		pool->sweep_start[s] = k;
+		for (p = 0; p < pool->npart; ++p) {
+			pool->dst[int64_t(p) * pool->sweeps + s] = k;
+			if (pool->nsel[int64_t(p) * pool->sweeps + s] == 0) continue;
+			runs[s].push_back(k);
+			k += pool->nsel[int64_t(p) * pool->sweeps + s];
+		}
+		runs[s].push_back(k);
+	}
+	pool->sweep_start[pool->sweeps] = k;
+	pool->order.resize(k);
+	run_stage(pool, gather_stage);
+	merge_sweeps(pool, runs);
+
+	printf ("  partition %.3f s, select %.3f s, merge %.3f s; %d threads, %d partitions\n",
+			t1 - t0, t2 - t1, uniform_clock() - t2, pool->nthread, pool->npart);
+}
+
+bool uniformize_catalog(const index_param& param, CatBatch& stars, startree_t* starkd) {
+	CatReader reader;
+	int64_t ncell, total;
+	double t0;
+	int s;
+	bool external, rslt(true);
+
+	if (param.UNside <= 0 || param.UNside > (1 << 28) || param.sweeps < 1) {
+		printf ("uniformize: invalid Nside %d or sweeps %d\n", param.UNside, param.sweeps);
+		return false;
+	}
+	if (!reader.Open(param.pathcat, param.nthread)) {
+		printf ("uniformize: failed to open catalog [%s]\n", param.pathcat);
+		return false;
+	}
+	if (reader.Rows() > int64_t(UINT32_MAX)) {
+		printf ("uniformize: %lld stars exceed the limit\n", reader.Rows());
+		return false;
+	}
+
+	uniform_pool* pool = new uniform_pool;
+	ncell          = healpix_npix(param.UNside);
+	pool->param    = &param;
+	pool->reader   = &reader;
+	pool->nthread  = param.nthread > 1 ? param.nthread : 1;
+	pool->nside    = param.UNside;
+	pool->sweeps   = param.sweeps;
+	pool->region   = param.bighp >= 0 && param.bignside > 0
+			? healpix_region_get(param.bignside, param.bighp, param.UNside, param.margin) : NULL;
+	// 每个线程至少领取约16个分区, 以平衡负载
+	pool->span     = ncell / (int64_t(pool->nthread) * 16);
+	if (pool->span < 1) pool->span = 1;
+	else if (pool->span > UNIFORM_SPAN_MAX) pool->span = UNIFORM_SPAN_MAX;
+	pool->npart    = int((ncell + pool->span - 1) / pool->span);
+	pool->next     = 0;
+	pool->npass    = 0;
+	pool->budget   = param.memlimit;
+	external = pool->budget > 0 && reader.Rows() * UNIFORM_ENTRY_BYTES > pool->budget;
+	if (external) {// 临时文件目录: 缓存目录, 或中间星表所在目录
+		const char* slash = strrchr(param.pathcat, '/');
+		if (param.cachedir[0]) strcpy(pool->tmpdir, param.cachedir);
+		else if (!slash) strcpy(pool->tmpdir, ".");
+		else if (slash == param.pathcat) strcpy(pool->tmpdir, "/");
+		else {
+			memcpy(pool->tmpdir, param.pathcat, slash - param.pathcat);
+			pool->tmpdir[slash - param.pathcat] = 0;
+		}
+	}
+
+	// 去重
+	if (param.dedup > 0.) {
+		t0 = uniform_clock();
+		dedup_catalog(pool, external ? pool->budget : 0);
+		printf ("dedup: radius %g arcsec, %lld duplicates, %.3f s; %d slabs in %d pass(es)\n", param.dedup,
+				(long long) pool->ndup, uniform_clock() - t0, pool->nslab, pool->npass);
+		pool->npass = 0;
+	}
+
+	t0 = uniform_clock();
+	if (!external) uniformize_memory(pool);
+	else if ((rslt = uniformize_external(pool))) {
+		printf ("  external sort within %.1f MB: %.3f s, %lld records per run, %d intermediate merge(s)\n",
+				pool->budget / 1048576., uniform_clock() - t0, (long long) pool->runlen, pool->npass);
+	}
+
+	if (rslt) {// 输出
+		total = pool->sweep_start[pool->sweeps];
+		stars.resize(int(total));
+		free(starkd->sweep);
+		starkd->sweep = (uint8_t*) malloc(total > 0 ? total : 1);
+		pool->stars = &stars;
+		pool->sweep = starkd->sweep;
+		run_stage(pool, emit_stage);
+
+		printf ("uniformize: %lld stars, Nside %d, %d sweeps -> %lld stars", reader.Rows(), param.UNside,
+				param.sweeps, (long long) total);
+		for (s = 0; s < pool->sweeps && s < 3; ++s)
+			printf ("%s%lld", s ? "/" : " (", (long long) (pool->sweep_start[s + 1] - pool->sweep_start[s]));
+		printf ("%s), %.3f s\n", pool->sweeps > 3 ? "/..." : "", uniform_clock() - t0);
+	}
+
+	delete pool;
+	return rslt;
+}
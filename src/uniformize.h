@@ -0,0 +1,38 @@
+/**
+ * @file uniformize.h 星表均匀化(cut-an): 在UNside的HEALPix网格中逐格选取最亮的恒星
+ * @note
+ * - 每个网格单元保留最亮的sweeps颗恒星. 第k亮的恒星属于第k遍(sweep), 输出按遍次排列,
+ *   同一遍内按亮度排列
+ * - 并行流程: 各线程按行区间计算网格单元并按单元编号基数划分到若干分区;
+ *   各分区由一个线程以定长堆逐单元选取; 最后按遍次汇集各分区结果并归并
+ * - 指定大像元(bighp >= 0, bignside > 0)时仅保留落在大像元内, 或所在单元与大像元内单元
+ *   相距不超过margin个单元的恒星. 大像元以NESTED编号, bignside须为2的幂.
+ *   大像元及边缘覆盖的单元由healpix_region_get()预先计算为像元区间, 逐星判定为二分查找
+ * - dedup > 0时先去重: 角距不大于dedup角秒的每对恒星中剔除较暗者. 在单位球面xyz空间建立
+ *   边长等于该半径弦长的网格散列, 每颗恒星只检查相邻27个网格; 沿x方向按网格列分片并行,
+ *   片边界列的恒星同时作为相邻片的参照
+ * - memlimit > 0且内存方式的工作区超出该值时改用外排序: 按(单元, 亮度)排序的定长记录段写入临时
+ *   文件(创建后即删除), 段数过多时逐级多路归并, 最后一轮多路归并时流式逐单元选取.
+ *   去重的分片按内存上限分批处理. 输出恒星、去重标记位图(每颗恒星1位)及压缩星表的解压
+ *   缓存不计入内存上限
+ */
+
+#ifndef SRC_UNIFORMIZE_H_
+#define SRC_UNIFORMIZE_H_
+
+#include "build_index.h"
+#include "cat_index.h"
+
+#define UNIFORM_SPAN_MAX	65536	//< 每个分区包含的网格单元数上限
+
+/*!
+ * @brief 均匀化中间星表param.pathcat
+ * @param param  使用pathcat, UNside, sweeps, dedup, bighp, bignside, margin, nthread, memlimit和cachedir
+ * @param stars  输出: 入选恒星, 按遍次及亮度排列
+ * @param starkd 输出: starkd->sweep为各入选恒星的遍次, 1起; 多于255遍时记为255. 由malloc分配
+ * @return
+ * 操作结果. 星表无法打开, 参数无效或临时文件读写失败时返回false
+ */
+bool uniformize_catalog(const index_param& param, CatBatch& stars, startree_t* starkd);
+
+#endif /* SRC_UNIFORMIZE_H_ */
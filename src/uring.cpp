@@ -0,0 +1,183 @@
+/**
+ * @file uring.cpp 基于io_uring系统调用的异步文件读取
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+uring_reader::uring_reader() {
+	ring_fd = -1;
+	sq_ptr = cq_ptr = sqe_ptr = NULL;
+	sq_size = cq_size = sqe_size = 0;
+	npending = nsubmit = 0;
+}
+
+uring_reader::~uring_reader() {
+	Close();
+}
+
+#ifdef HAVE_IO_URING
+
+bool uring_reader::Init(unsigned entries) {
+	struct io_uring_params p;
+
+	Close();
+	memset(&p, 0, sizeof(p));
+	if ((ring_fd = int(syscall(__NR_io_uring_setup, entries, &p))) < 0) return false;
+
+	sq_size  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size) sq_size = cq_size;
+		cq_size = 0;
+	}
+	sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED) {
+		sq_ptr = NULL;
+		Close();
+		return false;
+	}
+	if (cq_size) {
+		cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED) {
+			cq_ptr = NULL;
+			Close();
+			return false;
+		}
+	}
+	sqe_ptr = mmap(NULL, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqe_ptr == MAP_FAILED) {
+		sqe_ptr = NULL;
+		Close();
+		return false;
+	}
+
+	char* sq = (char*) sq_ptr;
+	char* cq = (char*) (cq_ptr ? cq_ptr : sq_ptr);
+	sq_head  = (unsigned*) (sq + p.sq_off.head);
+	sq_tail  = (unsigned*) (sq + p.sq_off.tail);
+	sq_mask  = (unsigned*) (sq + p.sq_off.ring_mask);
+	sq_array = (unsigned*) (sq + p.sq_off.array);
+	cq_head  = (unsigned*) (cq + p.cq_off.head);
+	cq_tail  = (unsigned*) (cq + p.cq_off.tail);
+	cq_mask  = (unsigned*) (cq + p.cq_off.ring_mask);
+	cqes     = cq + p.cq_off.cqes;
+	npending = nsubmit = 0;
+	return true;
+}
+
+void uring_reader::Close() {
+	if (sqe_ptr) munmap(sqe_ptr, sqe_size);
+	if (cq_ptr)  munmap(cq_ptr, cq_size);
+	if (sq_ptr)  munmap(sq_ptr, sq_size);
+	if (ring_fd >= 0) close(ring_fd);
+	ring_fd = -1;
+	sq_ptr = cq_ptr = sqe_ptr = NULL;
+	npending = nsubmit = 0;
+}
+
+bool uring_reader::Read(int fd, struct iovec* iov, int64_t offset, void* user) {
+	if (ring_fd < 0) return false;
+
+	unsigned tail = *sq_tail;
+	unsigned idx;
+	struct io_uring_sqe* sqe;
+
+	if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > *sq_mask) return false;	// 队列已满
+	idx = tail & *sq_mask;
+	sqe = (struct io_uring_sqe*) sqe_ptr + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = IORING_OP_READV;
+	sqe->fd        = fd;
+	sqe->addr      = (uint64_t) (uintptr_t) iov;
+	sqe->len       = 1;
+	sqe->off       = uint64_t(offset);
+	sqe->user_data = (uint64_t) (uintptr_t) user;
+	sq_array[idx]  = idx;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++npending;
+	return true;
+}
+
+/*!
+ * @brief 提交已入队的请求并等待至少一个请求完成
+ * @return
+ * 系统调用失败时返回false. 被信号中断时已提交的请求计入nsubmit, 由调用者重试
+ */
+static bool ring_enter(int ring_fd, unsigned& npending, unsigned& nsubmit) {
+	long rslt = syscall(__NR_io_uring_enter, ring_fd, npending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	if (rslt < 0) return errno == EINTR;
+	npending -= unsigned(rslt);
+	nsubmit  += unsigned(rslt);
+	return true;
+}
+
+bool uring_reader::Wait(void*& user, int& res) {
+	if (ring_fd < 0) return false;
+
+	unsigned head;
+	struct io_uring_cqe* cqe;
+
+	while (1) {
+		head = *cq_head;
+		if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) break;
+		if (!(npending + nsubmit) || !ring_enter(ring_fd, npending, nsubmit)) return false;
+	}
+	cqe  = (struct io_uring_cqe*) cqes + (head & *cq_mask);
+	user = (void*) (uintptr_t) cqe->user_data;
+	res  = cqe->res;
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+	--nsubmit;
+	return true;
+}
+
+bool uring_reader::Drain() {
+	if (ring_fd < 0) return true;
+
+	unsigned head;
+
+	while (npending + nsubmit) {
+		head = *cq_head;
+		if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+			--nsubmit;
+		}
+		else if (!ring_enter(ring_fd, npending, nsubmit)) return false;
+	}
+	return true;
+}
+
+#else
+
+bool uring_reader::Init(unsigned entries) {
+	return false;
+}
+
+void uring_reader::Close() {
+}
+
+bool uring_reader::Read(int fd, struct iovec* iov, int64_t offset, void* user) {
+	return false;
+}
+
+bool uring_reader::Wait(void*& user, int& res) {
+	return false;
+}
+
+bool uring_reader::Drain() {
+	return true;
+}
+
+#endif
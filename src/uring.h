@@ -0,0 +1,60 @@
+/**
+ * @file uring.h 基于io_uring系统调用的异步文件读取
+ * @note
+ * - 直接使用系统调用, 不依赖liburing
+ * - 编译环境缺少<linux/io_uring.h>或内核不支持时, Init()返回false, 由调用者改用同步读取
+ */
+
+#ifndef SRC_URING_H_
+#define SRC_URING_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct uring_reader {
+protected:
+	int ring_fd;		//< io_uring文件描述符
+	void* sq_ptr;		//< 提交队列映射
+	void* cq_ptr;		//< 完成队列映射
+	void* sqe_ptr;		//< 提交队列条目映射
+	size_t sq_size, cq_size, sqe_size;	//< 映射长度
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	void* cqes;
+	unsigned npending;	//< 已入队未提交的请求数
+	unsigned nsubmit;	//< 已提交未取得结果的请求数
+
+public:
+	uring_reader();
+	virtual ~uring_reader();
+	/*!
+	 * @brief 创建io_uring
+	 * @param entries 队列深度
+	 * @return
+	 * 系统支持io_uring时返回true
+	 */
+	bool Init(unsigned entries);
+	void Close();
+	/*!
+	 * @brief 加入一个读请求
+	 * @param iov  读缓冲区. 在请求完成前须保持有效
+	 * @param user 请求完成时原样返回
+	 */
+	bool Read(int fd, struct iovec* iov, int64_t offset, void* user);
+	/*!
+	 * @brief 提交已加入的请求, 并等待至少一个请求完成. 被信号中断时重试
+	 * @param user 输出: 完成请求的user
+	 * @param res  输出: 读取字节数, 负数为-errno
+	 * @return
+	 * 没有未完成的请求或系统调用失败时返回false
+	 */
+	bool Wait(void*& user, int& res);
+	/*!
+	 * @brief 提交其余请求并等待全部请求完成, 丢弃结果
+	 * @return
+	 * 全部请求完成时返回true, 此后各请求的缓冲区可复用
+	 */
+	bool Drain();
+};
+
+#endif /* SRC_URING_H_ */